@@ -0,0 +1,126 @@
+/*
+ * anim.c
+ *
+ * Author: Michael Blauberg
+ *
+ * LED matrix animation player. See anim.h.
+ */
+
+#include "anim.h"
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "ledmatrix.h"
+#include "timer0.h"
+
+#define FULL_COLUMN 0xFF
+
+// Animations are made for one panel (with a bit of each mask for each row).
+// On a bigger display they are shown on the bottom left panel.
+#define ANIM_NUM_ROWS PANEL_NUM_ROWS
+
+static const uint8_t* first_change;	// change into the first frame
+static const uint8_t* next_change;	// change into the next frame
+static uint8_t num_frames;
+static uint8_t next_frame;
+static uint16_t last_frame_time;
+static uint8_t playing;
+
+// Send one set of column changes to the matrix, returning the address of
+// the data following it
+static const uint8_t* draw_changes(const uint8_t* data)
+{
+	uint8_t count = pgm_read_byte(data++);
+	while (count--)
+	{
+		uint8_t x = pgm_read_byte(data++);
+		uint8_t mask = pgm_read_byte(data++);
+		if (mask == FULL_COLUMN)
+		{
+			MatrixColumn column = {0};
+			for (uint8_t y = 0; y < ANIM_NUM_ROWS; y++)
+			{
+				column[y] = pgm_read_byte(data++);
+			}
+			ledmatrix_update_column(x, column);
+			continue;
+		}
+		for (uint8_t y = 0; y < ANIM_NUM_ROWS; y++)
+		{
+			if (mask & (1 << y))
+			{
+				ledmatrix_update_pixel(x, y, pgm_read_byte(data++));
+			}
+		}
+	}
+	return data;
+}
+
+// Return the address of the data following a set of column changes
+static const uint8_t* skip_changes(const uint8_t* data)
+{
+	uint8_t count = pgm_read_byte(data++);
+	while (count--)
+	{
+		uint8_t mask = pgm_read_byte(data + 1);
+		data += 2;
+		if (mask == FULL_COLUMN)
+		{
+			data += ANIM_NUM_ROWS;
+			continue;
+		}
+		for (; mask; mask >>= 1)
+		{
+			data += mask & 1;
+		}
+	}
+	return data;
+}
+
+void anim_start(const uint8_t* animation)
+{
+	num_frames = pgm_read_byte(animation);
+	ledmatrix_clear();
+	first_change = draw_changes(animation + 1);
+
+	// The change into the first frame is only needed when looping
+	next_change = skip_changes(first_change);
+	next_frame = 1;
+	last_frame_time = get_fast_ticks();
+	playing = 1;
+}
+
+uint8_t anim_update(uint16_t frame_ms)
+{
+	if (!playing)
+	{
+		return 0;
+	}
+	uint16_t current_time = get_fast_ticks();
+	if ((uint16_t)(current_time - last_frame_time) <= frame_ms)
+	{
+		return 0;
+	}
+	last_frame_time = current_time;
+
+	if (next_frame == num_frames)
+	{
+		// Back to the start
+		next_change = first_change;
+		next_frame = 0;
+	}
+	next_change = draw_changes(next_change);
+	next_frame++;
+	return 1;
+}
+
+void anim_stop(void)
+{
+	playing = 0;
+}
+
+uint16_t anim_ram_usage(void)
+{
+	return sizeof(first_change) + sizeof(next_change) + sizeof(num_frames)
+			+ sizeof(next_frame) + sizeof(last_frame_time)
+			+ sizeof(playing);
+}
@@ -0,0 +1,43 @@
+/*
+ * anim.h
+ *
+ * Author: Michael Blauberg
+ *
+ * Player for LED matrix animations kept in flash (see animdata.h, which is
+ * generated from the animations in animations/ by tools/anim_compiler.py).
+ *
+ * An animation is stored as the number of frames, then the first frame
+ * (as drawn on a clear display) and then the change into each frame from
+ * the one before it - the first frame's change is from the last frame, so
+ * the animation loops. Each of these is a count of changed columns, then
+ * for each changed column:
+ *
+ *     x mask colours...
+ *
+ * where mask has a bit set for each row that changed, followed by the new
+ * colour of each of those rows (bottom row first). A mask of 0xFF means
+ * the whole column is sent to the matrix at once. Only what changes from
+ * frame to frame is ever sent to the matrix.
+ */
+
+#ifndef ANIM_H_
+#define ANIM_H_
+
+#include <stdint.h>
+
+// Clear the display and start playing the given animation from its first
+// frame.
+void anim_start(const uint8_t* animation);
+
+// Show the next frame of the animation once more than frame_ms have passed
+// since the last one. This should be called often. Returns non-zero if a
+// frame was drawn.
+uint8_t anim_update(uint16_t frame_ms);
+
+// Stop playing the animation (anim_update() then does nothing).
+void anim_stop(void);
+
+// Returns the number of bytes of static RAM used by this module
+uint16_t anim_ram_usage(void);
+
+#endif /* ANIM_H_ */
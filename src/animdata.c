@@ -0,0 +1,86 @@
+/*
+ * animdata.c
+ *
+ * Generated by tools/anim_compiler.py from the animations in animations/ - don't edit.
+ */
+
+#include "animdata.h"
+
+// attract.anim: 32 frames in 594 bytes
+const uint8_t anim_attract[] PROGMEM = {
+	0x20, 0x0E, 0x00, 0xFF, 0x0F, 0x0F, 0x0F, 0x0F,
+	0xF0, 0xF0, 0xF0, 0x00, 0x01, 0xA4, 0x0F, 0xF0,
+	0xF0, 0x02, 0xFF, 0x0F, 0x0F, 0x0F, 0x0F, 0xF0,
+	0xF0, 0xF0, 0x00, 0x04, 0xFF, 0x0F, 0x0F, 0x0F,
+	0x0F, 0x00, 0xF0, 0xF0, 0xF0, 0x05, 0xFF, 0x0F,
+	0x00, 0x0F, 0x0F, 0xF0, 0x00, 0x00, 0x00, 0x06,
+	0xFF, 0x0F, 0x00, 0x00, 0x0F, 0x00, 0xF0, 0xF0,
+	0xF0, 0x08, 0xFF, 0x0F, 0x0F, 0x0F, 0x0F, 0xF0,
+	0xF0, 0xF0, 0xF0, 0x09, 0xFF, 0x00, 0x0F, 0x00,
+	0x0F, 0x00, 0xF0, 0x00, 0xF0, 0x0A, 0xFF, 0x0F,
+	0x00, 0x0F, 0x00, 0xF0, 0x00, 0xF0, 0x00, 0x0B,
+	0x20, 0x0F, 0x0C, 0x06, 0x0F, 0x0F, 0x0D, 0x19,
+	0x0F, 0x0F, 0x0F, 0x0E, 0xFF, 0x00, 0x0F, 0x0F,
+	0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0x0F, 0x80, 0xF0,
+	0x05, 0x0B, 0x20, 0x0F, 0x0C, 0x10, 0x00, 0x0D,
+	0x10, 0x0F, 0x0E, 0x80, 0xFF, 0x0F, 0x80, 0xF0,
+	0x05, 0x0B, 0x20, 0x00, 0x0C, 0x20, 0x0F, 0x0D,
+	0x10, 0x00, 0x0E, 0x10, 0xF0, 0x0F, 0x80, 0x00,
+	0x05, 0x0B, 0x10, 0x0F, 0x0C, 0x20, 0x00, 0x0D,
+	0x20, 0x0F, 0x0E, 0x10, 0xFF, 0x0F, 0x10, 0xF0,
+	0x05, 0x0B, 0x10, 0x00, 0x0C, 0x10, 0x0F, 0x0D,
+	0x20, 0x00, 0x0E, 0x20, 0xF0, 0x0F, 0x10, 0x00,
+	0x05, 0x0B, 0x40, 0x0F, 0x0C, 0x10, 0x00, 0x0D,
+	0x10, 0x0F, 0x0E, 0x20, 0xFF, 0x0F, 0x20, 0xF0,
+	0x05, 0x0B, 0x40, 0x00, 0x0C, 0x40, 0x0F, 0x0D,
+	0x10, 0x00, 0x0E, 0x10, 0xF0, 0x0F, 0x20, 0x00,
+	0x05, 0x0B, 0x10, 0x0F, 0x0C, 0x40, 0x00, 0x0D,
+	0x40, 0x0F, 0x0E, 0x10, 0xFF, 0x0F, 0x10, 0xF0,
+	0x05, 0x0B, 0x10, 0x00, 0x0C, 0x10, 0x0F, 0x0D,
+	0x40, 0x00, 0x0E, 0x40, 0xF0, 0x0F, 0x10, 0x00,
+	0x05, 0x0B, 0x20, 0x0F, 0x0C, 0x10, 0x00, 0x0D,
+	0x10, 0x0F, 0x0E, 0x40, 0xFF, 0x0F, 0x40, 0xF0,
+	0x05, 0x0B, 0x20, 0x00, 0x0C, 0x20, 0x0F, 0x0D,
+	0x10, 0x00, 0x0E, 0x10, 0xF0, 0x0F, 0x40, 0x00,
+	0x05, 0x0B, 0x10, 0x0F, 0x0C, 0x20, 0x00, 0x0D,
+	0x20, 0x0F, 0x0E, 0x10, 0xFF, 0x0F, 0x10, 0xF0,
+	0x05, 0x0B, 0x10, 0x00, 0x0C, 0x10, 0x0F, 0x0D,
+	0x20, 0x00, 0x0E, 0x20, 0xF0, 0x0F, 0x10, 0x00,
+	0x04, 0x0C, 0x10, 0x00, 0x0D, 0x10, 0x0F, 0x0E,
+	0x20, 0xFF, 0x0F, 0x20, 0xF0, 0x03, 0x0D, 0x10,
+	0x00, 0x0E, 0x10, 0xF0, 0x0F, 0x20, 0x00, 0x03,
+	0x0B, 0x10, 0x0F, 0x0E, 0x10, 0xFF, 0x0F, 0x10,
+	0xF0, 0x03, 0x0B, 0x10, 0x00, 0x0C, 0x10, 0x0F,
+	0x0F, 0x10, 0x00, 0x03, 0x0B, 0x20, 0x0F, 0x0C,
+	0x10, 0x00, 0x0D, 0x10, 0x0F, 0x04, 0x0B, 0x20,
+	0x00, 0x0C, 0x20, 0x0F, 0x0D, 0x10, 0x00, 0x0E,
+	0x10, 0xF0, 0x05, 0x0B, 0x10, 0x0F, 0x0C, 0x20,
+	0x00, 0x0D, 0x20, 0x0F, 0x0E, 0x10, 0xFF, 0x0F,
+	0x10, 0xF0, 0x05, 0x0B, 0x10, 0x00, 0x0C, 0x10,
+	0x0F, 0x0D, 0x20, 0x00, 0x0E, 0x20, 0xF0, 0x0F,
+	0x10, 0x00, 0x05, 0x0B, 0x40, 0x0F, 0x0C, 0x10,
+	0x00, 0x0D, 0x10, 0x0F, 0x0E, 0x20, 0xFF, 0x0F,
+	0x20, 0xF0, 0x05, 0x0B, 0x40, 0x00, 0x0C, 0x40,
+	0x0F, 0x0D, 0x10, 0x00, 0x0E, 0x10, 0xF0, 0x0F,
+	0x20, 0x00, 0x05, 0x0B, 0x10, 0x0F, 0x0C, 0x40,
+	0x00, 0x0D, 0x40, 0x0F, 0x0E, 0x10, 0xFF, 0x0F,
+	0x10, 0xF0, 0x05, 0x0B, 0x10, 0x00, 0x0C, 0x10,
+	0x0F, 0x0D, 0x40, 0x00, 0x0E, 0x40, 0xF0, 0x0F,
+	0x10, 0x00, 0x05, 0x0B, 0x20, 0x0F, 0x0C, 0x10,
+	0x00, 0x0D, 0x10, 0x0F, 0x0E, 0x40, 0xFF, 0x0F,
+	0x40, 0xF0, 0x05, 0x0B, 0x20, 0x00, 0x0C, 0x20,
+	0x0F, 0x0D, 0x10, 0x00, 0x0E, 0x10, 0xF0, 0x0F,
+	0x40, 0x00, 0x05, 0x0B, 0x10, 0x0F, 0x0C, 0x20,
+	0x00, 0x0D, 0x20, 0x0F, 0x0E, 0x10, 0xFF, 0x0F,
+	0x10, 0xF0, 0x05, 0x0B, 0x10, 0x00, 0x0C, 0x10,
+	0x0F, 0x0D, 0x20, 0x00, 0x0E, 0x20, 0xF0, 0x0F,
+	0x10, 0x00, 0x05, 0x0B, 0x80, 0x0F, 0x0C, 0x10,
+	0x00, 0x0D, 0x10, 0x0F, 0x0E, 0x20, 0xFF, 0x0F,
+	0x20, 0xF0, 0x05, 0x0B, 0x80, 0x00, 0x0C, 0x80,
+	0x0F, 0x0D, 0x10, 0x00, 0x0E, 0x10, 0xF0, 0x0F,
+	0x20, 0x00, 0x05, 0x0B, 0x10, 0x0F, 0x0C, 0x80,
+	0x00, 0x0D, 0x80, 0x0F, 0x0E, 0x10, 0xFF, 0x0F,
+	0x10, 0xF0, 0x05, 0x0B, 0x10, 0x00, 0x0C, 0x10,
+	0x0F, 0x0D, 0x80, 0x00, 0x0E, 0x80, 0xF0, 0x0F,
+	0x10, 0x00,
+};
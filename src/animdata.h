@@ -0,0 +1,15 @@
+/*
+ * animdata.h
+ *
+ * Generated by tools/anim_compiler.py from the animations in animations/ - don't edit.
+ */
+
+#ifndef ANIMDATA_H_
+#define ANIMDATA_H_
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+extern const uint8_t anim_attract[] PROGMEM;
+
+#endif /* ANIMDATA_H_ */
@@ -0,0 +1,142 @@
+/*
+ * autoplay.c
+ *
+ * Author: Michael Blauberg
+ *
+ * Autoplay. See autoplay.h.
+ */
+
+#include "autoplay.h"
+#include <stdint.h>
+#include "game.h"
+#include "playfield.h"
+#include "replay.h"
+
+// Seed of the random numbers at the start of every game
+#define SEED 0xACE1
+
+// Sloppy play misses this many notes in a hundred
+#define SLOPPY_MISS_PERCENT 5
+
+static uint8_t mode = AUTOPLAY_OFF;
+static uint8_t spread = AUTOPLAY_DEFAULT_SPREAD;
+static uint16_t random_state;
+
+// Presses waiting to be made: bit n of pending is set if button n is to
+// be pressed at press_time[n]. Notes in a lane are at least a row apart,
+// so each button only ever has one press waiting.
+static uint8_t pending;
+static uint32_t press_time[PLAYFIELD_NUM_LANES];
+
+// 16 bit xorshift
+static uint16_t next_random(void)
+{
+	random_state ^= random_state << 7;
+	random_state ^= random_state >> 9;
+	random_state ^= random_state << 8;
+	return random_state;
+}
+
+uint8_t autoplay_set(uint8_t new_mode, uint8_t new_spread)
+{
+	if (new_mode > AUTOPLAY_RANDOM)
+	{
+		return 0;
+	}
+	mode = new_mode;
+	spread = new_spread;
+	pending = 0;
+	return 1;
+}
+
+uint8_t autoplay_mode(void)
+{
+	return mode;
+}
+
+uint8_t autoplay_spread(void)
+{
+	return spread;
+}
+
+void autoplay_start(void)
+{
+	random_state = SEED;
+	pending = 0;
+}
+
+// Press the given button at the given time, unless it's already waiting
+static void press(uint8_t button, uint32_t time)
+{
+	if (!(pending & (1 << button)))
+	{
+		pending |= 1 << button;
+		press_time[button] = time;
+	}
+}
+
+void autoplay_step(uint32_t next_step, uint16_t step_ms)
+{
+	if (mode == AUTOPLAY_OFF)
+	{
+		return;
+	}
+	if (mode == AUTOPLAY_RANDOM)
+	{
+		uint16_t r = next_random();
+		if (r & 0x8000)
+		{
+			press(r % PLAYFIELD_NUM_LANES, next_step - step_ms
+					+ (step_ms ? (r >> 2) % step_ms : 0));
+		}
+		return;
+	}
+
+	// Notes one column before the middle of the scoring area are in the
+	// middle from the next step until the one after
+	uint8_t buttons = notes_to_play(PLAYFIELD_SCORING_MIDDLE - 1);
+	uint32_t ideal = next_step + step_ms / 2;
+	for (uint8_t button = 0; button < PLAYFIELD_NUM_LANES; button++)
+	{
+		if (!(buttons & (1 << button)))
+		{
+			continue;
+		}
+		if (mode == AUTOPLAY_PERFECT)
+		{
+			press(button, ideal);
+			continue;
+		}
+		if (next_random() % 100 < SLOPPY_MISS_PERCENT)
+		{
+			continue;
+		}
+		// The sum of two even spreads, so most presses are near the
+		// middle. A press due before now is made straight away.
+		uint16_t width = spread + 1;
+		int16_t error = (int16_t)(next_random() % width)
+				+ (int16_t)(next_random() % width) - spread;
+		press(button, error < 0 && (uint32_t)-error > ideal ? 0
+				: ideal + error);
+	}
+}
+
+int8_t autoplay_next_input(uint32_t current_time)
+{
+	for (uint8_t button = 0; pending && button < PLAYFIELD_NUM_LANES;
+			button++)
+	{
+		if ((pending & (1 << button)) && press_time[button] <= current_time)
+		{
+			pending &= ~(1 << button);
+			return INPUT_LANE0 + button;
+		}
+	}
+	return NO_INPUT;
+}
+
+uint16_t autoplay_ram_usage(void)
+{
+	return sizeof(mode) + sizeof(spread) + sizeof(random_state)
+			+ sizeof(pending) + sizeof(press_time);
+}
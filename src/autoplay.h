@@ -0,0 +1,61 @@
+/*
+ * autoplay.h
+ *
+ * Author: Michael Blauberg
+ *
+ * Autoplay. Plays the game by itself, so long soak tests and benchmarks
+ * (on the board or in the simulation harnesses) run with realistic input
+ * that is the same every time. The presses are handed to the game loop
+ * with the button pushes and serial keys and go the same way from there -
+ * they are recorded for replay, judged as chords and drawn the same.
+ *
+ * Each note is aimed at the middle of the time it spends in the middle of
+ * the scoring area. The modes are
+ *
+ *     perfect  every note played at exactly that time
+ *     sloppy   every note played up to the spread (ms) early or late
+ *              (most near the middle), and one in twenty not played
+ *     random   on about half the steps a random lane is played at a random
+ *              time, whether there's a note or not
+ *
+ * The random numbers start from the same seed every game, so a game at
+ * the same speed is played exactly the same way every time.
+ */
+
+#ifndef AUTOPLAY_H_
+#define AUTOPLAY_H_
+
+#include <stdint.h>
+
+// Modes
+#define AUTOPLAY_OFF		0
+#define AUTOPLAY_PERFECT	1
+#define AUTOPLAY_SLOPPY		2
+#define AUTOPLAY_RANDOM		3
+
+// Spread (ms) of sloppy play unless another is given
+#define AUTOPLAY_DEFAULT_SPREAD 40
+
+// Set the mode, and the spread for sloppy play. Returns zero if the mode
+// isn't one of the above.
+uint8_t autoplay_set(uint8_t mode, uint8_t spread);
+uint8_t autoplay_mode(void);
+uint8_t autoplay_spread(void);
+
+// Start playing a game (forgetting any presses waiting from the last one
+// and starting the random numbers again)
+void autoplay_start(void);
+
+// Called each time the notes advance, with the (game) time the next step
+// is due and how long it is. Works out when to play the notes that will
+// be in the middle of the scoring area after it.
+void autoplay_step(uint32_t next_step, uint16_t step_ms);
+
+// Returns the next press (INPUT_LANE0 to 3 - see replay.h) due by the
+// given game time, or NO_INPUT if there are none
+int8_t autoplay_next_input(uint32_t current_time);
+
+// Returns the number of bytes of static RAM used by this module
+uint16_t autoplay_ram_usage(void);
+
+#endif /* AUTOPLAY_H_ */
@@ -75,6 +75,12 @@ int8_t button_pushed(void)
 	return return_value;
 }
 
+uint16_t buttons_ram_usage(void)
+{
+	return sizeof(last_button_state) + sizeof(button_queue)
+			+ sizeof(queue_length);
+}
+
 // Interrupt handler for a change on buttons
 ISR(PCINT1_vect)
 {
@@ -35,4 +35,8 @@ void init_button_interrupts(void);
  */
 int8_t button_pushed(void);
 
+/* Return the number of bytes of static RAM used by this module.
+ */
+uint16_t buttons_ram_usage(void);
+
 #endif /* BUTTONS_H_ */
@@ -0,0 +1,200 @@
+/*
+ * calibrate.c
+ *
+ * Author: Michael Blauberg
+ *
+ * Input offset calibration. See calibrate.h.
+ */
+
+#include "calibrate.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "buttons.h"
+#include "display.h"
+#include "eestore.h"
+#include "game.h"
+#include "ledmatrix.h"
+#include "playfield.h"
+#include "serialio.h"
+#include "terminalio.h"
+#include "timer0.h"
+
+#define ESCAPE 0x1B
+
+// The bars take a step every STEP_MS, so one reaches the middle of the
+// scoring area every beat (500ms, 120 bpm)
+#define STEP_MS			100
+#define BEAT_MS			(STEP_MS * PLAYFIELD_ROW_SPACING)
+
+// Beats to get into time with, then the beats presses are counted for
+#define LEAD_IN_BEATS	4
+#define COUNTED_BEATS	16
+#define LAST_BAR		(LEAD_IN_BEATS + COUNTED_BEATS - 1)
+
+// Steps until the last bar has left the display
+#define NUM_STEPS		(LAST_BAR * PLAYFIELD_ROW_SPACING + MATRIX_NUM_COLUMNS)
+
+// Time (ms from the start) of bar 0's beat. Like a note, a bar is best hit
+// half way through the step it spends in the middle of the scoring area.
+#define FIRST_BEAT_MS	(PLAYFIELD_SCORING_MIDDLE * STEP_MS + STEP_MS / 2)
+
+// Fewest presses an offset is worked out from
+#define MIN_PRESSES		8
+
+#define ONE_MS			(1 << CALIBRATE_FRACTION_BITS)
+
+// An offset (1/16ms) rounded to the nearest ms
+#define WHOLE_MS(offset) ((int16_t)((offset) + ONE_MS / 2) >> CALIBRATE_FRACTION_BITS)
+
+// Colour of the given column at the given step - a bar (green when it's on
+// the beat) or the background
+static PixelColour bar_colour(int16_t step, uint8_t col)
+{
+	int16_t bar_steps = step - col;
+	if (bar_steps < 0 || bar_steps % PLAYFIELD_ROW_SPACING
+			|| bar_steps / PLAYFIELD_ROW_SPACING > LAST_BAR)
+	{
+		return background_colour(col);
+	}
+	return col == PLAYFIELD_SCORING_MIDDLE ? COLOUR_GREEN : COLOUR_RED;
+}
+
+// Draw the columns that change at the given step
+static void draw_step(int16_t step)
+{
+	MatrixColumn colours;
+	for (uint8_t col = 0; col < MATRIX_NUM_COLUMNS; col++)
+	{
+		PixelColour colour = bar_colour(step, col);
+		if (colour == bar_colour(step - 1, col))
+		{
+			continue;
+		}
+		set_matrix_column_to_colour(colours, background_colour(col));
+		if (colour != background_colour(col))
+		{
+			for (uint8_t y = 0; y < PLAYFIELD_NUM_LANES * PLAYFIELD_LANE_WIDTH;
+					y++)
+			{
+				colours[y] = colour;
+			}
+		}
+		ledmatrix_update_column(col, colours);
+	}
+}
+
+// Integer square root
+static uint16_t square_root(uint32_t x)
+{
+	uint32_t root = 0;
+	for (uint32_t bit = 1UL << 30; bit; bit >>= 2)
+	{
+		if (x >= root + bit)
+		{
+			x -= root + bit;
+			root = (root >> 1) + bit;
+		}
+		else
+		{
+			root >>= 1;
+		}
+	}
+	return root;
+}
+
+void calibrate_run(int8_t row)
+{
+	// Presses counted (the first on each beat) and their offsets from it
+	uint32_t beats_pressed = 0;
+	uint8_t presses = 0;
+	int32_t sum = 0;
+	uint32_t sum_of_squares = 0;
+
+	default_grid();
+	move_terminal_cursor(10, row);
+	clear_to_end_of_line();
+	printf_P(PSTR("Calibrating: press in time as the bars reach the middle "
+			"(escape stops)"));
+
+	uint32_t start = get_current_time();
+	int16_t step = 0;
+	while (step < NUM_STEPS)
+	{
+		uint32_t now = get_current_time() - start;
+		if (now >= (uint32_t)step * STEP_MS)
+		{
+			draw_step(step++);
+		}
+
+		uint8_t pressed = 0;
+		while (button_pushed() != NO_BUTTON_PUSHED)
+		{
+			pressed = 1;
+		}
+		while (serial_input_available())
+		{
+			if (fgetc(stdin) == ESCAPE)
+			{
+				step = NUM_STEPS;
+			}
+			pressed = 1;
+		}
+		if (!pressed || now + BEAT_MS / 2 < FIRST_BEAT_MS)
+		{
+			continue;
+		}
+
+		// Offset from the nearest beat
+		uint8_t bar = (now + BEAT_MS / 2 - FIRST_BEAT_MS) / BEAT_MS;
+		int16_t offset = now - (FIRST_BEAT_MS + (uint32_t)bar * BEAT_MS);
+		if (bar < LEAD_IN_BEATS || bar > LAST_BAR
+				|| (beats_pressed & (1UL << bar)))
+		{
+			continue;
+		}
+		beats_pressed |= 1UL << bar;
+		presses++;
+		sum += offset;
+		sum_of_squares += (int32_t)offset * offset;
+		move_terminal_cursor(10, row);
+		clear_to_end_of_line();
+		printf_P(PSTR("Calibrating: beat %u of %u, %+d ms"),
+				bar - LEAD_IN_BEATS + 1, COUNTED_BEATS, offset);
+	}
+	default_grid();
+
+	move_terminal_cursor(10, row);
+	clear_to_end_of_line();
+	if (presses < MIN_PRESSES)
+	{
+		printf_P(PSTR("Calibration: only %u presses - offset still %+d ms"),
+				presses, WHOLE_MS(calibrate_offset()));
+		return;
+	}
+	// The mean in fixed point (rounded), and the standard deviation
+	int32_t scaled_sum = sum << CALIBRATE_FRACTION_BITS;
+	int16_t mean = (scaled_sum + (sum < 0 ? -(presses / 2) : presses / 2))
+			/ presses;
+	uint32_t mean_square = sum_of_squares / presses;
+	uint32_t square_of_mean = (int32_t)WHOLE_MS(mean) * WHOLE_MS(mean);
+	uint16_t jitter = square_root(mean_square > square_of_mean
+			? mean_square - square_of_mean : 0);
+	if (mean > CALIBRATE_MAX_OFFSET * ONE_MS)
+	{
+		mean = CALIBRATE_MAX_OFFSET * ONE_MS;
+	}
+	else if (mean < -CALIBRATE_MAX_OFFSET * ONE_MS)
+	{
+		mean = -CALIBRATE_MAX_OFFSET * ONE_MS;
+	}
+	uint8_t saved = eestore_write_wait(EESTORE_KEY_INPUT_OFFSET, mean);
+	printf_P(PSTR("Calibration: offset %+d ms, jitter %u ms (%u presses) "
+			"- %S"), WHOLE_MS(mean), jitter, presses,
+			saved ? PSTR("saved") : PSTR("couldn't be saved"));
+}
+
+int16_t calibrate_offset(void)
+{
+	return eestore_read(EESTORE_KEY_INPUT_OFFSET, 0);
+}
@@ -0,0 +1,41 @@
+/*
+ * calibrate.h
+ *
+ * Author: Michael Blauberg
+ *
+ * Input offset calibration. The display, the buttons and the player
+ * between them always make a press a little early or late. Calibration
+ * plays a metronome on the LED matrix - bars move along the lanes like
+ * notes, one reaching the middle of the scoring area every beat - and the
+ * player presses any button (or key) in time with them. The mean offset
+ * of the presses from the beats and their jitter (standard deviation) are
+ * shown, and the offset is saved in EEPROM for the player of this board.
+ *
+ * In a game each press is then judged as if it had been made that much
+ * earlier (see play_chord_at() in game.h), so the score is down to the
+ * player's timing rather than the delays of the display and inputs. The
+ * offset is an average of many presses, so it is kept in fixed point
+ * (1/16ms) rather than whole milliseconds.
+ */
+
+#ifndef CALIBRATE_H_
+#define CALIBRATE_H_
+
+#include <stdint.h>
+
+// Fraction bits of an offset
+#define CALIBRATE_FRACTION_BITS 4
+
+// Largest offset (ms either way) that will be saved
+#define CALIBRATE_MAX_OFFSET 120
+
+// Run the calibration on the LED matrix and terminal (reporting on the
+// given row of the terminal) and save the offset found. Returns once the
+// metronome has finished or escape has been pressed. The display must be
+// redrawn afterwards.
+void calibrate_run(int8_t row);
+
+// Player's offset (1/16ms, positive if their presses are late)
+int16_t calibrate_offset(void);
+
+#endif /* CALIBRATE_H_ */
@@ -14,12 +14,10 @@
 // for an empty board.
 void default_grid(void);
 
-// Shows a starting display.
+// Shows a starting display. The start screen animation is then played
+// with anim_update().
 void show_start_screen(void);
 
-// Update dynamic start screen based on frame number (0-11)
-void update_start_screen(uint8_t frame_number);
-
 // Display countdown timer
 void display_countdown(uint8_t timer);
 
@@ -0,0 +1,375 @@
+/*
+ * eestore.c
+ *
+ * Author: Michael Blauberg
+ *
+ * Wear levelled EEPROM key/value store. See eestore.h.
+ *
+ * The log is an array of 4 byte records: a header byte (the key in the
+ * low bits and a "lap" bit in the top bit), the value (low byte then high
+ * byte) and a check byte. Records are written in order round the log and
+ * the lap bit is flipped each time we go round, so at start up the next
+ * slot to write is the first one that is invalid or from the previous lap.
+ * Reading the log from there onwards (oldest first) and keeping the last
+ * record seen for each key gives the current values.
+ *
+ * The slot at the head and the one after it are kept free of any key's
+ * latest value. After each record is queued, a latest value in the slot
+ * after the new head is copied into the head, so the copy is in the log
+ * before its original is written over and a reset part way through a
+ * write only loses the record being written. (A log from before the gap
+ * was kept can have a latest value at the head. That is written again in
+ * the same slot, and lost if the write is cut off, until the gap is made.)
+ */
+
+#include "eestore.h"
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+
+#define RECORD_SIZE		4
+#define NUM_SLOTS		128
+#define LAP_BIT			0x80
+#define KEY_MASK		0x3F
+#define CHECK_SEED		0x5A
+#define NO_SLOT			0xFF
+
+// Number of records that can be waiting to be written
+#define QUEUE_SIZE		8
+
+static uint8_t store_log[NUM_SLOTS * RECORD_SIZE] EEMEM;
+
+// RAM copy of the stored values and the slot holding each one's latest
+// record (NO_SLOT if the key has never been stored)
+static uint16_t values[EESTORE_NUM_KEYS];
+static uint8_t locations[EESTORE_NUM_KEYS];
+
+// Next slot to be written and the lap bit to write into it
+static uint8_t head;
+static uint8_t lap;
+
+// Queue of records waiting to be written. Records are taken off the
+// queue by the EEPROM ready interrupt handler so we turn off interrupts
+// when changing it outside the handler.
+typedef struct
+{
+	uint8_t slot;
+	uint8_t data[RECORD_SIZE];
+} PendingRecord;
+
+static volatile PendingRecord queue[QUEUE_SIZE];
+static volatile uint8_t queue_insert_pos;
+static volatile uint8_t queue_remove_pos;
+static volatile uint8_t records_in_queue;
+static volatile uint8_t byte_pos;	// next byte of the record at the front
+static uint8_t locked;
+
+static void make_gap(void);
+
+static uint8_t make_check(uint8_t header, uint16_t value)
+{
+	return header ^ (value & 0xFF) ^ (value >> 8) ^ CHECK_SEED;
+}
+
+// Read a record from the log. Returns its header byte if it is valid, or
+// NO_SLOT if it isn't. (Only used at start up.)
+static uint8_t read_record(uint8_t slot, uint16_t* value)
+{
+	uint8_t* address = &store_log[slot * RECORD_SIZE];
+	uint8_t header = eeprom_read_byte(address);
+	*value = eeprom_read_byte(address + 1)
+			| ((uint16_t)eeprom_read_byte(address + 2) << 8);
+	if ((header & KEY_MASK) >= EESTORE_NUM_KEYS
+			|| eeprom_read_byte(address + 3) != make_check(header, *value))
+	{
+		return NO_SLOT;
+	}
+	return header;
+}
+
+void init_eestore(void)
+{
+	uint16_t value;
+	uint8_t header;
+	uint8_t slot;
+
+	for (uint8_t key = 0; key < EESTORE_NUM_KEYS; key++)
+	{
+		locations[key] = NO_SLOT;
+	}
+	records_in_queue = 0;
+	queue_insert_pos = 0;
+	queue_remove_pos = 0;
+	byte_pos = 0;
+	locked = 0;
+
+	// Find the next slot to write - the first that is invalid or left over
+	// from the previous lap
+	header = read_record(0, &value);
+	if (header == NO_SLOT)
+	{
+		// Either a blank log or the first write of a new lap was cut off.
+		// The last slot tells us which.
+		header = read_record(NUM_SLOTS - 1, &value);
+		head = 0;
+		lap = (header == NO_SLOT) ? 0 : ((header & LAP_BIT) ^ LAP_BIT);
+	}
+	else
+	{
+		lap = header & LAP_BIT;
+		for (slot = 1; slot < NUM_SLOTS; slot++)
+		{
+			header = read_record(slot, &value);
+			if (header == NO_SLOT || (header & LAP_BIT) != lap)
+			{
+				break;
+			}
+		}
+		head = slot % NUM_SLOTS;
+		if (head == 0)
+		{
+			// Every slot is from this lap, so the next write starts a new one
+			lap ^= LAP_BIT;
+		}
+	}
+
+	// Replay the log from the oldest record to the newest
+	slot = head;
+	do
+	{
+		header = read_record(slot, &value);
+		if (header != NO_SLOT)
+		{
+			values[header & KEY_MASK] = value;
+			locations[header & KEY_MASK] = slot;
+		}
+		slot = (slot + 1) % NUM_SLOTS;
+	} while (slot != head);
+
+	// A write cut off part way through making the gap leaves a latest
+	// value just after the head. Copy it on (once interrupts are on).
+	make_gap();
+	if (records_in_queue)
+	{
+		EECR |= (1 << EERIE);
+	}
+}
+
+uint16_t eestore_read(uint8_t key, uint16_t default_value)
+{
+	if (key >= EESTORE_NUM_KEYS || locations[key] == NO_SLOT)
+	{
+		return default_value;
+	}
+	return values[key];
+}
+
+// Returns the key whose latest record is in the given slot, or NO_SLOT
+static uint8_t key_in_slot(uint8_t slot)
+{
+	for (uint8_t key = 0; key < EESTORE_NUM_KEYS; key++)
+	{
+		if (locations[key] == slot)
+		{
+			return key;
+		}
+	}
+	return NO_SLOT;
+}
+
+// Add a record for the key (with its value from the RAM copy) at the
+// head of the log. Interrupts must be off and there must be queue space.
+static void queue_record(uint8_t key)
+{
+	volatile PendingRecord* record = &queue[queue_insert_pos];
+	uint8_t header = key | lap;
+	uint16_t value = values[key];
+
+	record->slot = head;
+	record->data[0] = header;
+	record->data[1] = value & 0xFF;
+	record->data[2] = value >> 8;
+	record->data[3] = make_check(header, value);
+	locations[key] = head;
+
+	queue_insert_pos = (queue_insert_pos + 1) % QUEUE_SIZE;
+	records_in_queue++;
+	head++;
+	if (head == NUM_SLOTS)
+	{
+		head = 0;
+		lap ^= LAP_BIT;
+	}
+}
+
+// Copy any key's latest value in the slot after the head into the head,
+// until the head and the slot after it are both free. (Nothing is done if
+// the head itself isn't free.) Interrupts must be off and there must be
+// queue space.
+static void make_gap(void)
+{
+	uint8_t victim;
+	if (key_in_slot(head) != NO_SLOT)
+	{
+		return;
+	}
+	while ((victim = key_in_slot((head + 1) % NUM_SLOTS)) != NO_SLOT)
+	{
+		queue_record(victim);
+	}
+}
+
+uint8_t eestore_write(uint8_t key, uint16_t value)
+{
+	if (key >= EESTORE_NUM_KEYS)
+	{
+		return 0;
+	}
+	if (locations[key] != NO_SLOT && values[key] == value)
+	{
+		return 1;
+	}
+
+	uint8_t interrupts_were_enabled = bit_is_set(SREG, SREG_I);
+	cli();
+
+	// If the key's latest record hasn't started being written yet we can
+	// just change it in place
+	uint8_t result = 0;
+	for (uint8_t i = 0; i < records_in_queue; i++)
+	{
+		uint8_t pos = (queue_remove_pos + i) % QUEUE_SIZE;
+		volatile PendingRecord* record = &queue[pos];
+		if (record->slot == locations[key] && (i != 0 || byte_pos == 0))
+		{
+			uint8_t header = record->data[0];
+			values[key] = value;
+			record->data[1] = value & 0xFF;
+			record->data[2] = value >> 8;
+			record->data[3] = make_check(header, value);
+			result = 1;
+			break;
+		}
+	}
+
+	if (!result)
+	{
+		// Work out how many records we need - this one, a copy of any
+		// other key's latest value at the head (only in an old log) and
+		// the copies that move the free gap on past the head again
+		uint8_t needed = 1;
+		uint8_t slot = head;
+		uint8_t victim;
+		while ((victim = key_in_slot(slot)) != NO_SLOT && victim != key)
+		{
+			needed++;
+			slot = (slot + 1) % NUM_SLOTS;
+		}
+		slot = (slot + 1) % NUM_SLOTS;
+		while ((victim = key_in_slot((slot + 1) % NUM_SLOTS)) != NO_SLOT
+				&& victim != key)
+		{
+			needed++;
+			slot = (slot + 1) % NUM_SLOTS;
+		}
+		if (records_in_queue + needed <= QUEUE_SIZE)
+		{
+			while ((victim = key_in_slot(head)) != NO_SLOT && victim != key)
+			{
+				queue_record(victim);
+			}
+			values[key] = value;
+			queue_record(key);
+			make_gap();
+			result = 1;
+		}
+	}
+
+	if (result && !locked)
+	{
+		// Make sure the EEPROM ready interrupt is on to write the queue
+		EECR |= (1 << EERIE);
+	}
+	if (interrupts_were_enabled)
+	{
+		sei();
+	}
+	return result;
+}
+
+uint8_t eestore_write_wait(uint8_t key, uint16_t value)
+{
+	while (!eestore_write(key, value))
+	{
+		// Nothing will empty the queue if it isn't being written
+		if (key >= EESTORE_NUM_KEYS || locked
+				|| !bit_is_set(SREG, SREG_I))
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+uint8_t eestore_busy(void)
+{
+	return records_in_queue != 0;
+}
+
+void eestore_lock(void)
+{
+	EECR &= ~(1 << EERIE);
+	locked = 1;
+	eeprom_busy_wait();
+}
+
+void eestore_unlock(void)
+{
+	locked = 0;
+	if (records_in_queue)
+	{
+		EECR |= (1 << EERIE);
+	}
+}
+
+uint16_t eestore_ram_usage(void)
+{
+	return sizeof(values) + sizeof(locations) + sizeof(head) + sizeof(lap)
+			+ sizeof(queue) + sizeof(queue_insert_pos)
+			+ sizeof(queue_remove_pos) + sizeof(records_in_queue)
+			+ sizeof(byte_pos) + sizeof(locked);
+}
+
+/*
+ * The EEPROM is ready for another byte. Write the next byte of the record
+ * at the front of the queue (skipping any bytes that already hold the
+ * right value) or turn the interrupt off if there is nothing left to do.
+ */
+ISR(EE_READY_vect)
+{
+	while (records_in_queue > 0)
+	{
+		volatile PendingRecord* record = &queue[queue_remove_pos];
+		uint8_t data = record->data[byte_pos];
+		EEAR = (uint16_t)&store_log[record->slot * RECORD_SIZE + byte_pos];
+		if (++byte_pos == RECORD_SIZE)
+		{
+			byte_pos = 0;
+			queue_remove_pos = (queue_remove_pos + 1) % QUEUE_SIZE;
+			records_in_queue--;
+		}
+
+		EECR |= (1 << EERE);
+		if (EEDR != data)
+		{
+			// Start the write. EEPE must be set within four cycles of
+			// EEMPE (interrupts are already off in here).
+			EEDR = data;
+			EECR |= (1 << EEMPE);
+			EECR |= (1 << EEPE);
+			return;
+		}
+	}
+	EECR &= ~(1 << EERIE);
+}
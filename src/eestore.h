@@ -0,0 +1,61 @@
+/*
+ * eestore.h
+ *
+ * Author: Michael Blauberg
+ *
+ * Persistent key/value store for settings and high scores. Values are
+ * kept in a log of small records in EEPROM which is written round and
+ * round (so writes are spread over the whole log rather than wearing out
+ * one location). Reads are served from a copy in RAM built at start up.
+ *
+ * Writing an EEPROM byte takes about 3.4ms, so writes are never done
+ * directly. They are queued and written one byte at a time from the
+ * EEPROM ready interrupt, so saving a value never holds up the game.
+ */
+
+#ifndef EESTORE_H_
+#define EESTORE_H_
+
+#include <stdint.h>
+
+// Keys for the values we keep. There can be at most EESTORE_NUM_KEYS.
+#define EESTORE_KEY_GAME_SPEED	0
+#define EESTORE_KEY_TRACK		1
+#define EESTORE_KEY_HIGH_SCORE	2
+#define EESTORE_KEY_BOARD		3	// linked board number + 1 (0 if not linked)
+#define EESTORE_KEY_INPUT_OFFSET 4	// player's input offset in 1/16ms (see calibrate.h)
+#define EESTORE_NUM_KEYS		8
+
+// Read the log from EEPROM and build the RAM copy. Must be called before
+// global interrupts are turned on.
+void init_eestore(void);
+
+// Returns the stored value for the key, or default_value if nothing
+// has been stored for it.
+uint16_t eestore_read(uint8_t key, uint16_t default_value);
+
+// Store a value. The RAM copy is updated straight away and the value is
+// queued to be written to EEPROM in the background. Returns 0 if the
+// queue is full (in which case nothing is changed), non-zero otherwise.
+// Writing the value that is already stored does nothing.
+uint8_t eestore_write(uint8_t key, uint16_t value);
+
+// Store a value as eestore_write() does, but if the queue is full wait for
+// the background writes to make room. Returns 0 if the value still can't
+// be queued (the store is locked or interrupts are off). This can take a
+// tenth of a second, so it isn't for use during a game.
+uint8_t eestore_write_wait(uint8_t key, uint16_t value);
+
+// Returns non-zero while there are writes still to be done.
+uint8_t eestore_busy(void);
+
+// Stop background writes (waiting for any byte in progress to finish) so
+// the EEPROM can be accessed directly with the avr/eeprom.h functions,
+// then start them again afterwards.
+void eestore_lock(void);
+void eestore_unlock(void);
+
+// Returns the number of bytes of static RAM used by this module
+uint16_t eestore_ram_usage(void);
+
+#endif /* EESTORE_H_ */
@@ -0,0 +1,33 @@
+/*
+ * flash.h
+ *
+ * Author: Michael Blauberg
+ *
+ * Addresses of data in flash (program memory). Ordinary pointers are 16
+ * bits so can only reach the first 64KB of flash. On parts with more flash
+ * than that, songs stored higher up are reached with 32 bit addresses and
+ * the "far" reads. The ATmega324A's 32KB all fits in 16 bits so it uses the
+ * ordinary (smaller and quicker) reads.
+ */
+
+#ifndef FLASH_H_
+#define FLASH_H_
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#if FLASHEND > 0xFFFF
+typedef uint32_t flash_address_t;
+// Address of an object in flash
+#define FLASH_ADDRESS(object) pgm_get_far_address(object)
+#define flash_read_byte(address) pgm_read_byte_far(address)
+#define flash_read_word(address) pgm_read_word_far(address)
+#else
+typedef uint16_t flash_address_t;
+#define FLASH_ADDRESS(object) ((flash_address_t)(object))
+#define flash_read_byte(address) pgm_read_byte((const uint8_t*)(address))
+#define flash_read_word(address) pgm_read_word((const uint16_t*)(address))
+#endif
+
+#endif /* FLASH_H_ */
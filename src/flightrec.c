@@ -0,0 +1,139 @@
+/*
+ * flightrec.c
+ *
+ * Author: Michael Blauberg
+ *
+ * Flight recorder. See flightrec.h.
+ */
+
+#include "flightrec.h"
+#include <stdio.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include "timer0.h"
+
+typedef struct
+{
+	uint16_t ms;	// bottom 16 bits of the millisecond count
+	uint8_t count;	// timer 0 count (8us) within the millisecond
+	uint8_t event;
+	uint8_t payload;
+} FlightRecord;
+
+static FlightRecord records[FLIGHTREC_RECORDS];
+static uint8_t next_record;		// where the next record goes
+static uint8_t num_records;
+volatile uint8_t flightrec_recording;
+
+static const char game_start_name[] PROGMEM = "start";
+static const char beat_name[] PROGMEM = "beat";
+static const char hit_name[] PROGMEM = "hit";
+static const char miss_name[] PROGMEM = "miss";
+static const char wrong_name[] PROGMEM = "wrong";
+static const char spi_flush_name[] PROGMEM = "spi";
+static const char late_name[] PROGMEM = "late";
+static const char uart_stall_name[] PROGMEM = "tx stall";
+static const char rx_overrun_name[] PROGMEM = "rx lost";
+
+static PGM_P const event_names[FLIGHT_NUM_EVENTS] PROGMEM = {
+	game_start_name, beat_name, hit_name, miss_name, wrong_name,
+	spi_flush_name, late_name, uart_stall_name, rx_overrun_name
+};
+
+void flightrec_add(uint8_t event, uint8_t payload)
+{
+	uint8_t sreg = SREG;
+	cli();
+	uint8_t last = (next_record ? next_record : FLIGHTREC_RECORDS) - 1;
+	if (event >= FLIGHT_FIRST_COUNTED && num_records
+			&& records[last].event == event)
+	{
+		// Count another in the same record
+		if (records[last].payload != UINT8_MAX)
+		{
+			records[last].payload++;
+		}
+		SREG = sreg;
+		return;
+	}
+
+	// Interrupts are off so the tick count can't change while it's read.
+	// If the timer has wrapped around but its interrupt hasn't run yet the
+	// count is from the next millisecond (see get_current_time_us()).
+	FlightRecord* record = &records[next_record];
+	record->ms = get_fast_ticks();
+	record->count = TCNT0;
+	if (TIFR0 & (1 << OCF0A))
+	{
+		record->ms++;
+		record->count = TCNT0;
+	}
+	record->event = event;
+	record->payload = event >= FLIGHT_FIRST_COUNTED ? 1 : payload;
+	if (++next_record == FLIGHTREC_RECORDS)
+	{
+		next_record = 0;
+	}
+	if (num_records < FLIGHTREC_RECORDS)
+	{
+		num_records++;
+	}
+	SREG = sreg;
+}
+
+void flightrec_start(uint8_t track)
+{
+	uint8_t sreg = SREG;
+	cli();
+	next_record = 0;
+	num_records = 0;
+	flightrec_recording = 1;
+	SREG = sreg;
+	flightrec_add(FLIGHT_GAME_START, track);
+}
+
+void flightrec_stop(void)
+{
+	flightrec_recording = 0;
+}
+
+void flightrec_dump(void)
+{
+	printf_P(PSTR("\nFlight recorder: %u events\n"), num_records);
+	uint8_t index = (next_record + FLIGHTREC_RECORDS - num_records)
+			% FLIGHTREC_RECORDS;
+	uint32_t previous = 0;
+	for (uint8_t i = 0; i < num_records; i++)
+	{
+		FlightRecord* record = &records[index];
+		// Times are shown in ms, with the time since the previous record
+		// (allowing for the ms count wrapping)
+		uint32_t time = (uint32_t)record->ms * 1000 + record->count * 8;
+		uint32_t since = i == 0 ? 0 : time >= previous ? time - previous
+				: time + 65536000UL - previous;
+		previous = time;
+		printf_P(PSTR("%5u.%03u +%5lu.%03u %-8S "), record->ms,
+				record->count * 8, since / 1000, (uint16_t)(since % 1000),
+				(PGM_P)pgm_read_word(&event_names[record->event]));
+		if (record->event == FLIGHT_HIT)
+		{
+			printf_P(PSTR("lane %u col %u\n"), record->payload >> 6,
+					record->payload & 0x3F);
+		}
+		else
+		{
+			printf_P(PSTR("%u\n"), record->payload);
+		}
+		if (++index == FLIGHTREC_RECORDS)
+		{
+			index = 0;
+		}
+	}
+}
+
+uint16_t flightrec_ram_usage(void)
+{
+	return sizeof(records) + sizeof(next_record) + sizeof(num_records)
+			+ sizeof(flightrec_recording);
+}
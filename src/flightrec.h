@@ -0,0 +1,78 @@
+/*
+ * flightrec.h
+ *
+ * Author: Michael Blauberg
+ *
+ * Flight recorder. While a game is being played the last few dozen things
+ * that happened (notes advancing, hits, misses, the display being
+ * updated, the serial port holding things up) are kept in RAM, each with
+ * the time it happened to 8us. When something goes wrong - the notes
+ * stutter or an input is lost - the record can be dumped over the serial
+ * port afterwards to see what the game was doing at the time, without
+ * anything having to be printed while it was playing.
+ *
+ * Each record is 5 bytes: the bottom 16 bits of the millisecond count,
+ * the timer 0 count within the millisecond, the event and a byte of
+ * payload. The oldest records are overwritten once the buffer is full.
+ * Events that tend to come in bursts (the serial port holding things up)
+ * are counted in one record while nothing else happens in between.
+ */
+
+#ifndef FLIGHTREC_H_
+#define FLIGHTREC_H_
+
+#include <stdint.h>
+
+// Number of records kept (can be changed with a build flag)
+#ifndef FLIGHTREC_RECORDS
+#define FLIGHTREC_RECORDS 48
+#endif
+
+// Events. The payload of each is given.
+#define FLIGHT_GAME_START	0	// play has started, payload = track
+#define FLIGHT_BEAT			1	// notes advanced, payload = beat (low byte)
+#define FLIGHT_HIT			2	// note hit, payload = lane << 6 | column
+#define FLIGHT_MISS			3	// note left the display unplayed, payload = lane
+#define FLIGHT_WRONG		4	// note played with nothing to hit, payload = lane
+#define FLIGHT_SPI_FLUSH	5	// notes redrawn, payload = columns sent
+#define FLIGHT_LATE			6	// step taken late, payload = ms late
+// Events from here on are counted: the payload of a record is the number
+// of times the event happened in a row (up to 255)
+#define FLIGHT_FIRST_COUNTED	7
+#define FLIGHT_UART_STALL	7	// serial output waited for buffer space
+#define FLIGHT_RX_OVERRUN	8	// serial input lost (input buffer full or
+								// the USART overran)
+#define FLIGHT_NUM_EVENTS	9
+
+// Non-zero while a game is being recorded
+extern volatile uint8_t flightrec_recording;
+
+// Add a record (use flightrec_log())
+void flightrec_add(uint8_t event, uint8_t payload);
+
+// Record an event. This may be called from interrupt handlers. When no
+// game is being recorded it costs a test of one byte; otherwise about 80
+// clock cycles (~10us).
+static inline void flightrec_log(uint8_t event, uint8_t payload)
+{
+	if (flightrec_recording)
+	{
+		flightrec_add(event, payload);
+	}
+}
+
+// Start recording a game on the given track. The previous game's records
+// are discarded.
+void flightrec_start(uint8_t track);
+
+// Stop recording (so that the records of the game are kept while they are
+// dumped)
+void flightrec_stop(void);
+
+// Print the records, oldest first, over the serial port
+void flightrec_dump(void);
+
+// Returns the number of bytes of static RAM used by this module
+uint16_t flightrec_ram_usage(void);
+
+#endif /* FLIGHTREC_H_ */
@@ -0,0 +1,317 @@
+/*
+ * frameserver.c
+ *
+ * Author: Michael Blauberg
+ *
+ * Display server mode. See frameserver.h.
+ */
+
+#include "frameserver.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include <util/crc16.h>
+#include "ledmatrix.h"
+#include "timer0.h"
+
+#define STX 0x02
+#define ACK 0x06
+#define NAK 0x15
+
+#define CMD_PALETTE	'P'
+#define CMD_FILL	'F'
+#define CMD_DELTA	'D'
+#define CMD_END		'E'
+#define CMD_QUIT	'Q'
+
+// Pixels on the display (see frameserver.h for how they are numbered)
+#define NUM_PIXELS	((uint16_t)MATRIX_NUM_COLUMNS * MATRIX_NUM_ROWS)
+
+// Display server mode ends if no packet arrives for this long (ms)
+#define SERVER_TIMEOUT 3000
+
+// Frames per second are worked out over this long (ms)
+#define FPS_INTERVAL 1000
+
+// States of the receive parser (see upload.c)
+#define RX_IDLE		0
+#define RX_COMMAND	1
+#define RX_SEQUENCE	2
+#define RX_LENGTH	3
+#define RX_PAYLOAD	4
+#define RX_CRC		5
+
+// States of a packet buffer
+#define PACKET_EMPTY	0
+#define PACKET_READY	1
+#define PACKET_ERROR	2
+
+#define NUM_PACKETS 2
+#define NO_ROW 0xFF
+
+typedef struct
+{
+	uint8_t command;
+	uint8_t sequence;
+	uint8_t length;
+	uint8_t payload[FRAMESERVER_MAX_PAYLOAD];
+} Packet;
+
+// Packets are received into the two buffers in turn. The receive interrupt
+// handler fills one while frameserver_poll() draws the other.
+static volatile Packet packets[NUM_PACKETS];
+static volatile uint8_t packet_state[NUM_PACKETS];
+static volatile uint8_t rx_packet;	// being received
+static uint8_t next_packet;			// to be drawn next
+static volatile uint8_t rx_state;
+static volatile uint8_t rx_crc;
+static volatile uint8_t rx_count;
+
+static volatile uint8_t active;
+static uint16_t last_packet_time;
+
+static PixelColour palette[FRAMESERVER_PALETTE_SIZE];
+static const PixelColour default_palette[FRAMESERVER_PALETTE_SIZE] PROGMEM = {
+	COLOUR_BLACK, COLOUR_RED, COLOUR_GREEN, COLOUR_ORANGE, COLOUR_YELLOW,
+	COLOUR_HALF_YELLOW, COLOUR_QUART_YELLOW
+};
+
+// The row being drawn. Pixels are collected until the row is finished (or
+// the next pixel isn't the one after) - a whole row is sent in one go and
+// anything less pixel by pixel.
+static MatrixRow row;
+static uint8_t row_y = NO_ROW;
+static uint8_t row_first;
+static uint8_t row_next;
+
+static uint16_t frames;
+static uint16_t fps;
+static uint16_t fps_frames;
+static uint16_t fps_start_time;
+
+uint8_t frameserver_rx_byte(uint8_t c)
+{
+	volatile Packet* packet = &packets[rx_packet];
+	switch (rx_state)
+	{
+		case RX_IDLE:
+			if (c == STX && packet_state[rx_packet] == PACKET_EMPTY)
+			{
+				rx_crc = 0;
+				rx_state = RX_COMMAND;
+				return 1;
+			}
+			return active;
+		case RX_COMMAND:
+			packet->command = c;
+			rx_state = RX_SEQUENCE;
+			break;
+		case RX_SEQUENCE:
+			packet->sequence = c;
+			rx_state = RX_LENGTH;
+			break;
+		case RX_LENGTH:
+			packet->length = c;
+			rx_count = 0;
+			if (c > FRAMESERVER_MAX_PAYLOAD)
+			{
+				packet_state[rx_packet] = PACKET_ERROR;
+				rx_packet ^= 1;
+				rx_state = RX_IDLE;
+				return 1;
+			}
+			rx_state = c ? RX_PAYLOAD : RX_CRC;
+			break;
+		case RX_PAYLOAD:
+			packet->payload[rx_count++] = c;
+			if (rx_count == packet->length)
+			{
+				rx_state = RX_CRC;
+			}
+			break;
+		case RX_CRC:
+			packet_state[rx_packet] = (c == rx_crc) ? PACKET_READY
+					: PACKET_ERROR;
+			rx_packet ^= 1;
+			rx_state = RX_IDLE;
+			return 1;
+	}
+	rx_crc = _crc8_ccitt_update(rx_crc, c);
+	return 1;
+}
+
+// Send the pixels collected for the current row
+static void flush_row(void)
+{
+	if (row_y == NO_ROW)
+	{
+		return;
+	}
+	if (row_first == 0 && row_next == MATRIX_NUM_COLUMNS)
+	{
+		ledmatrix_update_row(row_y, row);
+	}
+	else
+	{
+		for (uint8_t x = row_first; x < row_next; x++)
+		{
+			ledmatrix_update_pixel(x, row_y, row[x]);
+		}
+	}
+	row_y = NO_ROW;
+}
+
+// Draw a run (see frameserver.h) starting at the given pixel. Returns the
+// pixel after the run.
+static uint16_t draw_run(uint16_t pixel, uint8_t run)
+{
+	uint16_t y = pixel / MATRIX_NUM_COLUMNS;
+	uint8_t x = pixel % MATRIX_NUM_COLUMNS;
+	PixelColour colour = palette[run & 0x0F];
+	for (uint8_t count = (run >> 4) + 1; count; count--)
+	{
+		if (y >= MATRIX_NUM_ROWS)
+		{
+			// Off the top of the display
+			break;
+		}
+		if (y != row_y || x != row_next)
+		{
+			flush_row();
+			row_y = y;
+			row_first = x;
+		}
+		row[x] = colour;
+		row_next = ++x;
+		if (x == MATRIX_NUM_COLUMNS)
+		{
+			flush_row();
+			x = 0;
+			y++;
+		}
+	}
+	return pixel + (run >> 4) + 1;
+}
+
+// Draw a packet. Returns the answer to send.
+static uint8_t draw_packet(volatile Packet* packet)
+{
+	uint8_t length = packet->length;
+	volatile uint8_t* payload = packet->payload;
+	uint16_t pixel = payload[0] | ((uint16_t)payload[1] << 8);
+
+	switch (packet->command)
+	{
+		case CMD_PALETTE:
+			if (length == 0 || payload[0] + length - 1
+					> FRAMESERVER_PALETTE_SIZE)
+			{
+				return NAK;
+			}
+			for (uint8_t i = 1; i < length; i++)
+			{
+				palette[payload[0] + i - 1] = payload[i];
+			}
+			return ACK;
+		case CMD_FILL:
+			if (length < 2 || pixel >= NUM_PIXELS)
+			{
+				return NAK;
+			}
+			for (uint8_t i = 2; i < length; i++)
+			{
+				pixel = draw_run(pixel, payload[i]);
+			}
+			flush_row();
+			return ACK;
+		case CMD_DELTA:
+			if (length < 2 || length % 2 || pixel >= NUM_PIXELS)
+			{
+				return NAK;
+			}
+			for (uint8_t i = 2; i < length; i += 2)
+			{
+				pixel = draw_run(pixel + payload[i], payload[i + 1]);
+			}
+			flush_row();
+			return ACK;
+		case CMD_END:
+			frames++;
+			fps_frames++;
+			return ACK;
+		case CMD_QUIT:
+			active = 0;
+			return ACK;
+	}
+	return NAK;
+}
+
+void frameserver_poll(void)
+{
+	uint16_t now = get_fast_ticks();
+	if (active && (uint16_t)(now - fps_start_time) >= FPS_INTERVAL)
+	{
+		fps = (uint32_t)fps_frames * 1000 / (uint16_t)(now - fps_start_time);
+		fps_frames = 0;
+		fps_start_time = now;
+	}
+	if (packet_state[next_packet] == PACKET_EMPTY)
+	{
+		if (active && (uint16_t)(now - last_packet_time) > SERVER_TIMEOUT)
+		{
+			// The host has gone away
+			active = 0;
+		}
+		return;
+	}
+
+	volatile Packet* packet = &packets[next_packet];
+	uint8_t response = NAK;
+	if (packet_state[next_packet] == PACKET_READY)
+	{
+		if (!active)
+		{
+			// The first packet starts the mode with a clear display and
+			// the standard colours
+			ledmatrix_clear();
+			memcpy_P(palette, default_palette, sizeof(palette));
+			frames = 0;
+			fps = 0;
+			fps_frames = 0;
+			fps_start_time = now;
+			active = 1;
+		}
+		response = draw_packet(packet);
+	}
+	last_packet_time = now;
+	printf_P(PSTR("%c%02X"), response, packet->sequence);
+
+	// This buffer can take the next packet but one
+	packet_state[next_packet] = PACKET_EMPTY;
+	next_packet ^= 1;
+}
+
+uint8_t frameserver_active(void)
+{
+	return active;
+}
+
+uint16_t frameserver_frames(void)
+{
+	return frames;
+}
+
+uint16_t frameserver_fps(void)
+{
+	return fps;
+}
+
+uint16_t frameserver_ram_usage(void)
+{
+	return sizeof(packets) + sizeof(packet_state) + sizeof(rx_packet)
+			+ sizeof(next_packet) + sizeof(rx_state) + sizeof(rx_crc)
+			+ sizeof(rx_count) + sizeof(active) + sizeof(last_packet_time)
+			+ sizeof(palette) + sizeof(row) + sizeof(row_y)
+			+ sizeof(row_first) + sizeof(row_next) + sizeof(frames)
+			+ sizeof(fps) + sizeof(fps_frames) + sizeof(fps_start_time);
+}
@@ -0,0 +1,72 @@
+/*
+ * frameserver.h
+ *
+ * Author: Michael Blauberg
+ *
+ * Display server mode. A host streams frames over the serial port and they
+ * are drawn on the LED matrix as they arrive, so the matrix can show
+ * anything a PC can generate without reflashing (see
+ * tools/frame_server.py). Frames are sent as packets like those of a song
+ * upload (see upload.h) but starting with STX:
+ *
+ *     STX(0x02) command sequence length payload[length] crc
+ *
+ * Pixels are numbered along each row of the display from the bottom row
+ * up (pixel y * MATRIX_NUM_COLUMNS + x) and coloured from a palette of 16
+ * colours. Each run of pixels is one byte: the number of pixels less one in
+ * the high four bits and the palette index in the low four. Commands are:
+ *     'P' palette - payload is the first palette index to set, then the
+ *                   colours (PixelColour) to put there
+ *     'F' fill    - payload is a pixel number (2 bytes, low byte first) and
+ *                   runs to draw from there on. A full frame is one or more
+ *                   of these (best split at the ends of rows).
+ *     'D' delta   - payload is a pixel number (2 bytes, low byte first) and
+ *                   pairs of a number of pixels to skip and a run to draw,
+ *                   so only what has changed is sent
+ *     'E' end     - no payload. The frame is complete (this is what frames
+ *                   per second are counted from).
+ *     'Q' quit    - no payload. Leave display server mode.
+ *
+ * Pixels past the last one (e.g. after a skip) aren't drawn, and a fill or
+ * delta packet whose pixel number is past the last pixel is refused.
+ *
+ * Every packet is answered, once it has been drawn, with ACK (0x06) or NAK
+ * (0x15 - the packet was damaged or refused) followed by its sequence number as two
+ * hex digits. Two packets are held, so the host can send a packet while
+ * the one before is being drawn: it may have up to two packets that
+ * haven't been answered. That way the frame rate is limited by the serial
+ * and SPI speeds rather than waiting for answers.
+ *
+ * The mode starts with the first packet received and ends with 'Q' or
+ * when no packet has arrived for a while.
+ */
+
+#ifndef FRAMESERVER_H_
+#define FRAMESERVER_H_
+
+#include <stdint.h>
+
+#define FRAMESERVER_MAX_PAYLOAD 32
+#define FRAMESERVER_PALETTE_SIZE 16
+
+// Called by the serial receive interrupt handler for every byte received.
+// Returns non-zero if the byte was part of a packet (in which case it must
+// not be treated as normal input).
+uint8_t frameserver_rx_byte(uint8_t c);
+
+// Draw any packets that have been received and answer them. This should
+// be called often and returns quickly when there is nothing to do.
+void frameserver_poll(void);
+
+// Returns non-zero while in display server mode
+uint8_t frameserver_active(void);
+
+// Number of frames completed since the mode started, and the frames per
+// second over the last second or so
+uint16_t frameserver_frames(void);
+uint16_t frameserver_fps(void);
+
+// Returns the number of bytes of static RAM used by this module
+uint16_t frameserver_ram_usage(void);
+
+#endif /* FRAMESERVER_H_ */
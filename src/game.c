@@ -13,28 +13,123 @@
 #include "display.h"
 #include "ledmatrix.h"
 #include "terminalio.h"
+#include "songslot.h"
+#include "songlib.h"
+#include "playfield.h"
+#include "flightrec.h"
 
-static const uint8_t track[TRACK_LENGTH] = {0x00,
-	0x00, 0x00, 0x08, 0x08, 0x08, 0x80, 0x04, 0x02,
-	0x04, 0x40, 0x08, 0x80, 0x00, 0x00, 0x04, 0x02,
-	0x04, 0x40, 0x08, 0x04, 0x40, 0x02, 0x20, 0x01,
-	0x10, 0x10, 0x10, 0x10, 0x00, 0x00, 0x02, 0x20,
-	0x04, 0x40, 0x08, 0x80, 0x04, 0x40, 0x02, 0x20,
-	0x04, 0x40, 0x08, 0x04, 0x40, 0x40, 0x02, 0x20,
-	0x04, 0x40, 0x08, 0x04, 0x40, 0x02, 0x20, 0x01,
-	0x10, 0x10, 0x10, 0x10, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x08, 0x08, 0x08, 0x80, 0x04, 0x02,
-	0x04, 0x40, 0x02, 0x08, 0x80, 0x00, 0x02, 0x01,
-	0x04, 0x40, 0x08, 0x80, 0x04, 0x02, 0x20, 0x01,
-	0x10, 0x10, 0x12, 0x20, 0x00, 0x00, 0x02, 0x20,
-	0x04, 0x40, 0x08, 0x04, 0x40, 0x40, 0x02, 0x20,
-	0x04, 0x40, 0x08, 0x04, 0x40, 0x40, 0x02, 0x20,
-	0x04, 0x40, 0x08, 0x04, 0x40, 0x40, 0x02, 0x20,
-	0x01, 0x10, 0x10, 0x10, 0x00, 0x00, 0x00, 0x00};
-
-static uint8_t played_track[TRACK_LENGTH] = {0};
+// The rows of the track about to come onto the display. Rows are decoded
+// from the track a little ahead of when they are needed (see
+// prefetch_rows()) into a small ring indexed by the low bits of the row's
+// index. The ring leaves room for a few more rows than are visible at once
+// (4 on one panel).
+#if PLAYFIELD_VISIBLE_ROWS + 4 <= 8
+#define ROW_WINDOW_SIZE 8
+#elif PLAYFIELD_VISIBLE_ROWS + 4 <= 16
+#define ROW_WINDOW_SIZE 16
+#elif PLAYFIELD_VISIBLE_ROWS + 4 <= 32
+#define ROW_WINDOW_SIZE 32
+#else
+#define ROW_WINDOW_SIZE 64
+#endif
+static uint8_t window_notes[ROW_WINDOW_SIZE];
+#define NOTES(index) window_notes[(index) & (ROW_WINDOW_SIZE - 1)]
+
+// The playfield is kept as bitboards - one bit per column of the display
+// (bit 0 is column 0, where notes appear). For each lane, notes has a bit
+// set in each column holding a note and played in each column holding a
+// note that has been played. rows has a bit set in each column holding a
+// row of the track (with or without notes). Advancing the notes is then a
+// shift of every board.
+#define NUM_LANES PLAYFIELD_NUM_LANES
+static PlayfieldBits notes[NUM_LANES];
+static PlayfieldBits played[NUM_LANES];
+static PlayfieldBits rows;
+
+// What is on the display. Comparing these with the boards above gives
+// exactly the pixels that need to be redrawn.
+static PlayfieldBits drawn_red[NUM_LANES];
+static PlayfieldBits drawn_green[NUM_LANES];
+
+#define COLUMN(col)		((PlayfieldBits)1 << (col))
+
+// The columns of the scoring area, the column notes leave from and all
+// the columns of the display
+#define SCORING_AREA	((COLUMN(PLAYFIELD_SCORING_WIDTH) - 1) \
+		<< PLAYFIELD_SCORING_START)
+#define LAST_COLUMN		COLUMN(MATRIX_NUM_COLUMNS - 1)
+#define ALL_COLUMNS		((LAST_COLUMN << 1) - 1)
+
+// The columns just past the end of the display. A late chord is judged
+// where the notes were up to MAX_JUDGEMENT_STEPS steps ago, so for each
+// lane the notes that have left the display since then without being
+// played are kept here (bit 0 is the column they leave to), as are the
+// rows. A note is only counted as missed once it is further away than
+// that.
+static uint8_t past_notes[NUM_LANES];
+static uint8_t past_rows;
+#define PAST_COLUMNS	((1 << MAX_JUDGEMENT_STEPS) - 1)
+#define OLDEST_PAST_COLUMN	(1 << (MAX_JUDGEMENT_STEPS - 1))
+
+// The last row must have been counted before the game is over
+#if MAX_JUDGEMENT_STEPS < 1 || MAX_JUDGEMENT_STEPS >= PLAYFIELD_ROW_SPACING
+#error "MAX_JUDGEMENT_STEPS must be from 1 to PLAYFIELD_ROW_SPACING - 1"
+#endif
+
+// The columns a note can be hit in - those of the scoring area no further
+// than judgement_window columns from its middle (all of it to begin with)
+static uint8_t judgement_window = PLAYFIELD_SCORING_WIDTH / 2;
+static PlayfieldBits judgement_area = SCORING_AREA;
+
+// Bytes sent to the LED matrix to redraw a whole column, and to redraw one
+// lane of a column pixel by pixel
+#define COLUMN_BYTES	(LEDMATRIX_PANELS_HIGH * (2 + PANEL_NUM_ROWS))
+#define LANE_BYTES		(3 * PLAYFIELD_LANE_WIDTH)
+
+static uint8_t current_track;
+// Rows in the current track (none until one is selected)
+static uint16_t track_length;
+static SongStream track_stream;
+// Index of the next row to be decoded from the track
+static uint16_t next_row;
 uint16_t score;
-uint16_t beat;
+uint16_t notes_missed;
+uint32_t beat;
+// beat / PLAYFIELD_ROW_SPACING and the remainder, kept up to date as the
+// beat advances (so long songs don't need 32 bit division)
+static uint16_t beat_row;
+static uint8_t beat_phase;
+
+// Decode rows of the track into the window, up to as many as there is
+// room for. Rows before beat_row have left the display so their places
+// can be reused.
+void prefetch_rows(void)
+{
+	while (next_row < track_length
+			&& next_row - beat_row < ROW_WINDOW_SIZE)
+	{
+		NOTES(next_row) = songstream_next(&track_stream);
+		next_row++;
+	}
+}
+
+// Put a row of the track into column 0 of the bitboards
+static void add_row(uint16_t index)
+{
+	if (index >= track_length)
+	{
+		return;
+	}
+	rows |= 1;
+	uint8_t row_notes = NOTES(index);
+	for (uint8_t lane = 0; lane < NUM_LANES; lane++)
+	{
+		if (row_notes & (1<<lane))
+		{
+			notes[lane] |= 1;
+		}
+	}
+}
 
 // Initialise the game by resetting the grid and beat
 void initialise_game(void)
@@ -42,161 +137,423 @@ void initialise_game(void)
 	// initialise the display we are using.
 	default_grid();
 	beat = 0;
+	beat_row = 0;
+	beat_phase = 0;
+	score = 0;
+	notes_missed = 0;
+	// start the track from the beginning with none of its notes played
+	// (a replayed game must start from exactly the same state as the one
+	// recorded), decoding the rows that are on the display to begin with
+	if (current_track < NUM_LIBRARY_SONGS)
+	{
+		songstream_open(&track_stream, current_track);
+	}
+	else
+	{
+		songstream_open_raw(&track_stream,
+				songslot_data_address(current_track - NUM_LIBRARY_SONGS));
+	}
+	next_row = 0;
+	prefetch_rows();
+
+	// Rows are PLAYFIELD_ROW_SPACING columns apart, with the first in the
+	// last column. (They aren't drawn until the notes first advance.)
+	rows = 0;
+	past_rows = 0;
+	for (uint8_t lane = 0; lane < NUM_LANES; lane++)
+	{
+		notes[lane] = 0;
+		played[lane] = 0;
+		past_notes[lane] = 0;
+		drawn_red[lane] = 0;
+		drawn_green[lane] = 0;
+	}
+	for (uint8_t index = 0; index < PLAYFIELD_VISIBLE_ROWS; index++)
+	{
+		for (uint8_t lane = 0; lane < NUM_LANES; lane++)
+		{
+			notes[lane] <<= PLAYFIELD_ROW_SPACING;
+		}
+		rows <<= PLAYFIELD_ROW_SPACING;
+		add_row(index);
+	}
 }
 
-void award_points(uint8_t col)
+uint8_t track_available(uint8_t track)
+{
+	return track < NUM_LIBRARY_SONGS || (track < NUM_TRACKS
+			&& songslot_valid(track - NUM_LIBRARY_SONGS));
+}
+
+uint16_t track_rows(uint8_t track)
 {
-	// award points based on the column
-	if (col == 11 || col == 15)
+	if (!track_available(track))
 	{
-		score += 1;
+		return 0;
 	}
-	else if (col == 12 || col == 14)
+	uint16_t rows;
+	if (track < NUM_LIBRARY_SONGS)
 	{
-		score += 2;
+		rows = songlib_rows(track);
 	}
-	else if (col == 13)
+	else
 	{
-		score += 3;
+		rows = songslot_length(track - NUM_LIBRARY_SONGS);
 	}
+	return rows;
 }
 
-// Play a note in the given lane
-void play_note(uint8_t lane)
-{	
-	// Change the value of lane so that they are ordered left to right
-	lane = 3 - lane;
-	// Check if there is a note in the scoring area
-	for (uint8_t col = 11; col < MATRIX_NUM_COLUMNS; col++) 
-	{
-		uint8_t future = MATRIX_NUM_COLUMNS - 1 - col;
-		uint8_t index = (future + beat) / 5;
-		if ((future+beat) % 5)
+uint16_t track_tempo(uint8_t track)
+{
+	if (track < NUM_LIBRARY_SONGS)
+	{
+		return songlib_tempo(track);
+	}
+	// Uploaded songs don't say - they are played at a row a second
+	return 1000;
+}
+
+uint8_t track_tempo_change(uint8_t track, uint8_t index,
+		TempoChange* change)
+{
+	if (track < NUM_LIBRARY_SONGS)
+	{
+		return songlib_tempo_change(track, index, change);
+	}
+	// Uploaded songs keep the same tempo throughout
+	return 0;
+}
+
+void select_track(uint8_t track)
+{
+	if (!track_available(track))
+	{
+		track = BUILT_IN_TRACK;
+	}
+	current_track = track;
+	track_length = track_rows(track);
+}
+
+uint8_t selected_track(void)
+{
+	return current_track;
+}
+
+// How far the given column is from the middle of the scoring area
+static uint8_t distance_from_middle(uint8_t col)
+{
+	return col < PLAYFIELD_SCORING_MIDDLE ? PLAYFIELD_SCORING_MIDDLE - col
+			: col - PLAYFIELD_SCORING_MIDDLE;
+}
+
+void award_points(uint8_t col)
+{
+	// award points based on the column - the most in the middle of the
+	// scoring area (3 if it is 5 columns wide), one fewer for each column
+	// further out
+	if (col >= PLAYFIELD_SCORING_START && col <= PLAYFIELD_SCORING_END)
+	{
+		score += PLAYFIELD_SCORING_WIDTH / 2 + 1 - distance_from_middle(col);
+	}
+}
+
+uint8_t set_judgement_window(uint8_t columns)
+{
+	if (columns > PLAYFIELD_SCORING_WIDTH / 2)
+	{
+		return 0;
+	}
+	judgement_window = columns;
+	judgement_area = 0;
+	for (uint8_t col = PLAYFIELD_SCORING_START; col <= PLAYFIELD_SCORING_END;
+			col++)
+	{
+		if (distance_from_middle(col) <= columns)
 		{
-			continue;
+			judgement_area |= COLUMN(col);
 		}
-		if (index >= TRACK_LENGTH)
+	}
+	return 1;
+}
+
+uint8_t get_judgement_window(void)
+{
+	return judgement_window;
+}
+
+PixelColour background_colour(uint8_t col)
+{
+	// yellows in the scoring area, brightest in the middle
+	if (col < PLAYFIELD_SCORING_START || col > PLAYFIELD_SCORING_END)
+	{
+		return COLOUR_BLACK;
+	}
+	switch (distance_from_middle(col))
+	{
+		case 0:
+			return COLOUR_YELLOW;
+		case 1:
+			return COLOUR_HALF_YELLOW;
+		default:
+			return COLOUR_QUART_YELLOW;
+	}
+}
+
+// Redraw the lanes of a column that have changed. If sending the whole
+// column is fewer bytes than sending the lanes' pixels (with one panel,
+// if more than one lane has changed) the whole column is sent.
+static void draw_column(uint8_t col, uint8_t lanes_changed)
+{
+	PlayfieldBits bit = COLUMN(col);
+	MatrixColumn colours;
+	set_matrix_column_to_colour(colours, background_colour(col));
+	for (uint8_t lane = 0; lane < NUM_LANES; lane++)
+	{
+		if (notes[lane] & bit)
 		{
-			continue;
-		}
-		// Check if there's a note in the lane
-		if (track[index] & (1<<lane))
-		{	
-			// Check if note has been played
-			if (played_track[index] & (1<<lane))
+			// green if the note has been played, red if not
+			PixelColour colour = (played[lane] & bit) ? COLOUR_GREEN
+					: COLOUR_RED;
+			for (uint8_t i = 0; i < PLAYFIELD_LANE_WIDTH; i++)
 			{
-				score -= 1;
-				continue;
+				colours[lane * PLAYFIELD_LANE_WIDTH + i] = colour;
 			}
-			// Mark the note as played
-			played_track[index] |= (1<<lane);
-			// Colour the two pixels green
-			ledmatrix_update_pixel(col, 2*lane, COLOUR_GREEN);
-			ledmatrix_update_pixel(col, 2*lane+1, COLOUR_GREEN);
-			// Award points
-			award_points(col);
 		}
-		else
+	}
+	if (__builtin_popcount(lanes_changed) * LANE_BYTES > COLUMN_BYTES)
+	{
+		ledmatrix_update_column(col, colours);
+		return;
+	}
+	for (uint8_t lane = 0; lanes_changed; lane++, lanes_changed >>= 1)
+	{
+		if (lanes_changed & 1)
 		{
-			score -= 1;
+			for (uint8_t i = 0; i < PLAYFIELD_LANE_WIDTH; i++)
+			{
+				uint8_t y = lane * PLAYFIELD_LANE_WIDTH + i;
+				ledmatrix_update_pixel(col, y, colours[y]);
+			}
 		}
 	}
 }
 
-// Advance the notes oned row down the display
-void advance_note(void)
+// Bring the display up to date with the bitboards, redrawing only the
+// notes that have changed
+static void draw_changes(void)
 {
-	// remove all the current notes; reverse of below
-	for (uint8_t col=0; col<MATRIX_NUM_COLUMNS; col++)
+	PlayfieldBits changed[NUM_LANES];
+	PlayfieldBits any_changed = 0;
+	for (uint8_t lane = 0; lane < NUM_LANES; lane++)
 	{
-		uint8_t future = MATRIX_NUM_COLUMNS - 1 - col;
-		uint8_t index = (future + beat) / 5;
-		if (index >= TRACK_LENGTH)
-		{
-			break;
-		}
-		if ((future+beat) % 5)
+		PlayfieldBits red = notes[lane] & ~played[lane];
+		PlayfieldBits green = notes[lane] & played[lane];
+		changed[lane] = (red ^ drawn_red[lane]) | (green ^ drawn_green[lane]);
+		any_changed |= changed[lane];
+		drawn_red[lane] = red;
+		drawn_green[lane] = green;
+	}
+	uint8_t columns_sent = 0;
+	for (uint8_t col = 0; any_changed; col++, any_changed >>= 1)
+	{
+		if (!(any_changed & 1))
 		{
 			continue;
 		}
-		for (uint8_t lane = 0; lane < 4; lane++)
+		columns_sent++;
+		uint8_t lanes_changed = 0;
+		for (uint8_t lane = 0; lane < NUM_LANES; lane++)
 		{
-			if (track[index] & (1<<lane))
+			if (changed[lane] & COLUMN(col))
 			{
-				PixelColour colour;
-				// yellows in the scoring area
-				if (col==11 || col == 15)
-				{
-					colour = COLOUR_QUART_YELLOW;
-				}
-				else if (col==12 || col == 14)
-				{
-					colour = COLOUR_HALF_YELLOW;
-				}
-				else if (col==13)
-				{
-					colour = COLOUR_YELLOW;
-				}
-				else
-				{
-					colour = COLOUR_BLACK;
-				}
-				ledmatrix_update_pixel(col, 2*lane, colour);
-				ledmatrix_update_pixel(col, 2*lane+1, colour);
+				lanes_changed |= 1 << lane;
 			}
 		}
+		draw_column(col, lanes_changed);
 	}
-	
-	// increment the beat
-	beat++;
+	if (columns_sent)
+	{
+		flightrec_log(FLIGHT_SPI_FLUSH, columns_sent);
+	}
+}
 
-	// draw the new notes
-	for (uint8_t col=0; col<MATRIX_NUM_COLUMNS; col++)
+uint8_t notes_to_play(uint8_t col)
+{
+	uint8_t buttons = 0;
+	for (uint8_t lane = 0; lane < NUM_LANES; lane++)
 	{
-		// col counts from one end, future from the other
-		uint8_t future = MATRIX_NUM_COLUMNS-1-col;
-		// notes are only drawn every five columns
-		if ((future+beat)%5)
+		if (notes[lane] & ~played[lane] & COLUMN(col))
 		{
-			continue;
+			buttons |= 1 << (NUM_LANES - 1 - lane);
 		}
-		
-		// index of which note in the track to play
-		uint8_t index = (future+beat)/5;
-		// if the index is beyond the end of the track,
-		// no note can be drawn
-		if (index >= TRACK_LENGTH)
+	}
+	return buttons;
+}
+
+// Play a note in the given lane
+void play_note(uint8_t lane)
+{
+	play_chord(1 << lane);
+}
+
+void play_chord(uint8_t lanes)
+{
+	play_chord_at(lanes, 0);
+}
+
+// A board as it was (or will be) the given number of steps later (earlier
+// if negative), with the columns that have left the display since then
+// (past, as for past_notes) put back on the end
+static PlayfieldBits board_at(PlayfieldBits bits, uint8_t past, int8_t steps)
+{
+	if (steps >= 0)
+	{
+		return bits << steps;
+	}
+	return (bits & ALL_COLUMNS) >> -steps
+			| (PlayfieldBits)past << (MATRIX_NUM_COLUMNS + steps);
+}
+
+void play_chord_at(uint8_t lanes, int8_t steps)
+{
+	// There is only ever one row of the track in the scoring area, so
+	// every note of the chord is in the same column
+	PlayfieldBits row = board_at(rows, past_rows, steps) & SCORING_AREA;
+	uint8_t col = PLAYFIELD_SCORING_START;
+	while (row && !(row & COLUMN(col)))
+	{
+		col++;
+	}
+	uint8_t hits = 0;
+	for (uint8_t button = 0; button < NUM_LANES; button++)
+	{
+		if (!(lanes & (1 << button)))
 		{
 			continue;
 		}
-		// iterate over the four paths
-		for (uint8_t lane=0; lane<4; lane++)
+		// Change the value of lane so that they are ordered left to right
+		uint8_t lane = NUM_LANES - 1 - button;
+		PlayfieldBits hit = board_at(notes[lane], past_notes[lane], steps)
+				& judgement_area;
+		if (!hit)
 		{
-			// check if there's a note in the specific path
-			if (track[index] & (1<<lane))
+			// Playing when there's no note (or it's outside the
+			// judgement window) loses a point (unless the track has run
+			// out)
+			if (row)
 			{
-				// check if note has been played
-				if (played_track[index] & (1<<lane))
-				{
-					ledmatrix_update_pixel(col, 2*lane, COLOUR_GREEN);
-					ledmatrix_update_pixel(col, 2*lane+1, COLOUR_GREEN);
-					continue;
-				}
-				// colour the note's two pixels red if not played
-				ledmatrix_update_pixel(col, 2*lane, COLOUR_RED);
-				ledmatrix_update_pixel(col, 2*lane+1, COLOUR_RED);
+				score -= 1;
+			}
+			flightrec_log(FLIGHT_WRONG, lane);
+		}
+		else if (board_at(played[lane], 0, steps) & hit)
+		{
+			// The note has already been played
+			score -= 1;
+			flightrec_log(FLIGHT_WRONG, lane);
+		}
+		else
+		{
+			// Mark the note as played, which colours it green (or if it
+			// has left the display, stops it being counted as missed)
+			if (steps >= 0)
+			{
+				played[lane] |= hit >> steps;
+			}
+			else
+			{
+				played[lane] |= hit << -steps;
+				past_notes[lane] &= ~(uint8_t)(hit
+						>> (MATRIX_NUM_COLUMNS + steps));
 			}
+			hits++;
+			flightrec_log(FLIGHT_HIT, lane << 6 | col);
 		}
 	}
+	if (hits)
+	{
+		// One redraw for the whole chord, then points for each note
+		// based on its column
+		draw_changes();
+		while (hits--)
+		{
+			award_points(col);
+		}
+	}
+}
+
+// Advance the notes one column along the display
+void advance_note(void)
+{
+	// count the notes that are now too far past the end of the display
+	// to be played late, and keep the ones leaving the display that
+	// haven't been played
+	for (uint8_t lane = 0; lane < NUM_LANES; lane++)
+	{
+		if (past_notes[lane] & OLDEST_PAST_COLUMN)
+		{
+			notes_missed++;
+			flightrec_log(FLIGHT_MISS, lane);
+		}
+		past_notes[lane] = (past_notes[lane] << 1) & PAST_COLUMNS;
+		if (notes[lane] & ~played[lane] & LAST_COLUMN)
+		{
+			past_notes[lane] |= 1;
+		}
+	}
+	past_rows = (past_rows << 1) & PAST_COLUMNS;
+	if (rows & LAST_COLUMN)
+	{
+		past_rows |= 1;
+	}
+
+	// increment the beat
+	beat++;
+	flightrec_log(FLIGHT_BEAT, beat);
+	if (++beat_phase == PLAYFIELD_ROW_SPACING)
+	{
+		beat_phase = 0;
+		beat_row++;
+	}
+
+	// move everything along a column
+	for (uint8_t lane = 0; lane < NUM_LANES; lane++)
+	{
+		notes[lane] <<= 1;
+		played[lane] <<= 1;
+	}
+	rows <<= 1;
+
+	// every PLAYFIELD_ROW_SPACING beats a new row comes onto the display
+	// (making sure it has been decoded)
+	if (beat_phase == 0)
+	{
+		prefetch_rows();
+		add_row(beat_row + PLAYFIELD_VISIBLE_ROWS - 1);
+	}
+
+	draw_changes();
+}
+
+// Returns the number of bytes of static RAM used by the game
+uint16_t game_ram_usage(void)
+{
+	return sizeof(window_notes) + sizeof(notes) + sizeof(played)
+			+ sizeof(rows) + sizeof(past_notes) + sizeof(past_rows)
+			+ sizeof(drawn_red) + sizeof(drawn_green)
+			+ sizeof(current_track) + sizeof(track_length)
+			+ sizeof(track_stream) + sizeof(next_row) + sizeof(score)
+			+ sizeof(notes_missed) + sizeof(beat) + sizeof(beat_row)
+			+ sizeof(beat_phase) + sizeof(judgement_window)
+			+ sizeof(judgement_area);
 }
 
 // Returns 1 if the game is over, 0 otherwise.
 uint8_t is_game_over(void)
 {
 	// Detect if the game is over i.e. if a player has won.
-	if (beat >= TRACK_LENGTH*5)
+	if (beat_row >= track_length)
 	{
-		static uint8_t played_track[TRACK_LENGTH] = {0};
 		return 1;
 	}
 	return 0;
@@ -13,25 +13,98 @@
 #define GAME_H_
 
 #include <stdint.h>
+#include "songslot.h"
+#include "songlib.h"
+#include "pixel_colour.h"
 
-#define TRACK_LENGTH 129
+// Tracks that can be played. The songs in the song library (songlib.h)
+// come first, starting with the built in track, followed by the songs
+// uploaded into the song slots (songslot.h).
+#define BUILT_IN_TRACK 0
+#define NUM_TRACKS (NUM_LIBRARY_SONGS + NUM_SONG_SLOTS)
 
 // Declare score variaable as external
 extern uint16_t score;
 
+// Number of notes that left the display without being played this game
+extern uint16_t notes_missed;
+
+// Number of times the notes have been advanced this game
+extern uint32_t beat;
+
 // Initialise the game by resetting the grid and beat
 void initialise_game(void);
 
+// Returns non-zero if the given track can be played
+uint8_t track_available(uint8_t track);
+
+// Number of rows in the given track (0 if it isn't available)
+uint16_t track_rows(uint8_t track);
+
+// Tempo of the given track, in ms per row at normal speed
+uint16_t track_tempo(uint8_t track);
+
+// Get the index'th change of tempo in the given track (see songlib.h).
+// Returns zero if the track doesn't have that many.
+uint8_t track_tempo_change(uint8_t track, uint8_t index,
+		TempoChange* change);
+
+// Choose the track to play in the next game. The built in track is used if
+// the given track isn't available.
+void select_track(uint8_t track);
+
+// Returns the track chosen with select_track()
+uint8_t selected_track(void);
+
 // Award points
 void award_points(uint8_t col);
 
+// Only hit notes no more than the given number of columns from the middle
+// of the scoring area (up to half its width, the default, which is all of
+// it). Returns zero if the window is too wide.
+uint8_t set_judgement_window(uint8_t columns);
+uint8_t get_judgement_window(void);
+
+// Colour of the background of the given column of the display (see
+// playfield.h)
+PixelColour background_colour(uint8_t col);
+
+// Notes in the given column of the display that haven't been played. Bit
+// n is set if the note for button n is there (as for play_chord()).
+uint8_t notes_to_play(uint8_t col);
+
 // Play a note in the given lane
 void play_note(uint8_t lane);
 
-// Advance the notes one row down the display
+// Play several notes at once. Bit n of lanes is set to play lane n (as
+// for play_note()). The notes are judged together and drawn in one go.
+void play_chord(uint8_t lanes);
+
+// Play a chord as if it had been played the given number of steps later
+// (earlier if negative), judging the notes where they were (or will be)
+// then. This takes the player's offset off their presses (see
+// calibrate.h). steps must be no more than MAX_JUDGEMENT_STEPS either way.
+void play_chord_at(uint8_t lanes, int8_t steps);
+
+// Most steps a chord can be judged early or late by. Notes are kept for
+// this many steps after they leave the display (and only then counted as
+// missed) so a late chord can still hit them. At fast tempos a player's
+// offset can be more steps than this, in which case their presses are
+// judged this many steps early or late.
+#define MAX_JUDGEMENT_STEPS 2
+
+// Decode the next few rows of the track ahead of them being needed. This
+// is called by advance_note() but can be called whenever there's time to
+// spare so that advancing the notes doesn't have to wait for decoding.
+void prefetch_rows(void);
+
+// Advance the notes one column along the display
 void advance_note(void);
 
 // Returns 1 if the game is over, 0 otherwise.
 uint8_t is_game_over(void);
 
+// Returns the number of bytes of static RAM used by the game
+uint16_t game_ram_usage(void);
+
 #endif
@@ -2,6 +2,7 @@
  * ledmatrix.c
  *
  * Author: Peter Sutton
+ * Modified by Michael Blauberg
  *
  * See the LED matrix Reference for details of the SPI commands used.
  */
@@ -18,22 +19,150 @@
 #define CMD_SHIFT_DISPLAY	(0x04)
 #define CMD_CLEAR_SCREEN	(0x0F)
 
+// Panels after the first (which is on the SPI SS pin, B4) have their slave
+// select lines on port A, from this pin up
+#ifndef LEDMATRIX_SS_PIN
+#define LEDMATRIX_SS_PIN	4
+#endif
+
+#define ALL_PANELS	((1 << LEDMATRIX_NUM_PANELS) - 1)
+
+// SPI clock divider used unless changed with ledmatrix_set_spi_divider().
+// (This speed guarantees the SPI buffer will never overflow on the LED
+// matrix.)
+#define DEFAULT_SPI_DIVIDER	128
+
+// Panel showing the given column and row
+#define PANEL_AT(x, y)	((y) / PANEL_NUM_ROWS * LEDMATRIX_PANELS_WIDE \
+		+ (x) / PANEL_NUM_COLUMNS)
+
+// Panels that may be showing something (a bit for each). Nothing is known
+// about what is on them at reset.
+static uint8_t dirty_panels = ALL_PANELS;
+
+static uint8_t spi_divider;
+static uint32_t bytes_sent;
+
+#if LEDMATRIX_NUM_PANELS > 1
+// Panel whose slave select line is low. It is left selected between
+// commands so a run of commands to one panel costs no more than it would
+// with one panel.
+static uint8_t selected_panel;
+
+static void set_select_line(uint8_t panel, uint8_t high)
+{
+	if (panel == 0)
+	{
+		PORTB = high ? PORTB | (1 << PORTB4) : PORTB & ~(1 << PORTB4);
+	}
+	else
+	{
+		uint8_t pin = 1 << (LEDMATRIX_SS_PIN + panel - 1);
+		PORTA = high ? PORTA | pin : PORTA & ~pin;
+	}
+}
+#endif
+
+static void send_byte(uint8_t byte)
+{
+	bytes_sent++;
+	(void)spi_send_byte(byte);
+}
+
+// Start a command to the given panel
+static void send_command(uint8_t panel, uint8_t command)
+{
+#if LEDMATRIX_NUM_PANELS > 1
+	if (panel != selected_panel)
+	{
+		set_select_line(selected_panel, 1);
+		set_select_line(panel, 0);
+		selected_panel = panel;
+	}
+#endif
+	dirty_panels |= 1 << panel;
+	send_byte(command);
+}
+
+static uint8_t all_black(const PixelColour* colours, uint8_t count)
+{
+	while (count--)
+	{
+		if (*colours++ != COLOUR_BLACK)
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Returns non-zero if nothing needs to be sent to a panel to show the
+// given colours on it - i.e. it is clear and they are all black
+static uint8_t nothing_to_send(uint8_t panel, const PixelColour* colours,
+		uint8_t count)
+{
+	return !(dirty_panels & (1 << panel)) && all_black(colours, count);
+}
+
+static void send_shift(uint8_t direction)
+{
+	// A panel that has been cleared stays clear
+	for (uint8_t panel = 0; panel < LEDMATRIX_NUM_PANELS; panel++)
+	{
+		if (dirty_panels & (1 << panel))
+		{
+			send_command(panel, CMD_SHIFT_DISPLAY);
+			send_byte(direction);
+		}
+	}
+}
+
 void ledmatrix_setup(void)
 {
-	// Setup SPI - we divide the clock by 128.
-	// (This speed guarantees the SPI buffer will never overflow on
-	// the LED matrix.)
-	spi_setup_master(128);
+	// Setup SPI
+	spi_divider = DEFAULT_SPI_DIVIDER;
+	spi_setup_master(spi_divider);
+
+#if LEDMATRIX_NUM_PANELS > 1
+	// The other panels' slave select lines are outputs, high (so the
+	// first panel is the one selected)
+	uint8_t pins = ((1 << (LEDMATRIX_NUM_PANELS - 1)) - 1) << LEDMATRIX_SS_PIN;
+	PORTA |= pins;
+	DDRA |= pins;
+	selected_panel = 0;
+#endif
 }
 
 void ledmatrix_update_all(MatrixData data)
 {
-	(void)spi_send_byte(CMD_UPDATE_ALL);
-	for (uint8_t y = 0; y < MATRIX_NUM_ROWS; y++)
+	for (uint8_t panel = 0; panel < LEDMATRIX_NUM_PANELS; panel++)
 	{
-		for (uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++)
+		uint8_t left = panel % LEDMATRIX_PANELS_WIDE * PANEL_NUM_COLUMNS;
+		uint8_t bottom = panel / LEDMATRIX_PANELS_WIDE * PANEL_NUM_ROWS;
+
+		// A panel that is to be black is just cleared (if it isn't
+		// already)
+		uint8_t black = 1;
+		for (uint8_t x = 0; x < PANEL_NUM_COLUMNS && black; x++)
+		{
+			black = all_black(&data[left + x][bottom], PANEL_NUM_ROWS);
+		}
+		if (black)
+		{
+			if (dirty_panels & (1 << panel))
+			{
+				send_command(panel, CMD_CLEAR_SCREEN);
+				dirty_panels &= ~(1 << panel);
+			}
+			continue;
+		}
+		send_command(panel, CMD_UPDATE_ALL);
+		for (uint8_t y = 0; y < PANEL_NUM_ROWS; y++)
 		{
-			(void)spi_send_byte(data[x][y]);
+			for (uint8_t x = 0; x < PANEL_NUM_COLUMNS; x++)
+			{
+				send_byte(data[left + x][bottom + y]);
+			}
 		}
 	}
 }
@@ -45,9 +174,15 @@ void ledmatrix_update_pixel(uint8_t x, uint8_t y, PixelColour pixel)
 		// Position isn't valid - we ignore the request.
 		return;
 	}
-	(void)spi_send_byte(CMD_UPDATE_PIXEL);
-	(void)spi_send_byte(((y & 0x07) << 4) | (x & 0x0F));
-	(void)spi_send_byte(pixel);
+	uint8_t panel = PANEL_AT(x, y);
+	if (nothing_to_send(panel, &pixel, 1))
+	{
+		return;
+	}
+	send_command(panel, CMD_UPDATE_PIXEL);
+	send_byte(((y % PANEL_NUM_ROWS) << 4)
+			| (x % PANEL_NUM_COLUMNS));
+	send_byte(pixel);
 }
 
 void ledmatrix_update_row(uint8_t y, MatrixRow row)
@@ -57,11 +192,20 @@ void ledmatrix_update_row(uint8_t y, MatrixRow row)
 		// y value is too large - we ignore the request
 		return;
 	}
-	(void)spi_send_byte(CMD_UPDATE_ROW);
-	(void)spi_send_byte(y & 0x07);	// row number
-	for (uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++)
+	for (uint8_t left = 0; left < MATRIX_NUM_COLUMNS;
+			left += PANEL_NUM_COLUMNS)
 	{
-		(void)spi_send_byte(row[x]);
+		uint8_t panel = PANEL_AT(left, y);
+		if (nothing_to_send(panel, &row[left], PANEL_NUM_COLUMNS))
+		{
+			continue;
+		}
+		send_command(panel, CMD_UPDATE_ROW);
+		send_byte(y % PANEL_NUM_ROWS);	// row number
+		for (uint8_t x = 0; x < PANEL_NUM_COLUMNS; x++)
+		{
+			send_byte(row[left + x]);
+		}
 	}
 }
 
@@ -72,41 +216,54 @@ void ledmatrix_update_column(uint8_t x, MatrixColumn col)
 		// x value is too large - we ignore the request
 		return;
 	}
-	(void)spi_send_byte(CMD_UPDATE_COL);
-	(void)spi_send_byte(x & 0x0F); // column number
-	for (uint8_t y = 0; y < MATRIX_NUM_ROWS; y++)
+	for (uint8_t bottom = 0; bottom < MATRIX_NUM_ROWS;
+			bottom += PANEL_NUM_ROWS)
 	{
-		(void)spi_send_byte(col[y]);
+		uint8_t panel = PANEL_AT(x, bottom);
+		if (nothing_to_send(panel, &col[bottom], PANEL_NUM_ROWS))
+		{
+			continue;
+		}
+		send_command(panel, CMD_UPDATE_COL);
+		send_byte(x % PANEL_NUM_COLUMNS); // column number
+		for (uint8_t y = 0; y < PANEL_NUM_ROWS; y++)
+		{
+			send_byte(col[bottom + y]);
+		}
 	}
 }
 
 void ledmatrix_shift_display_left(void)
 {
-	(void)spi_send_byte(CMD_SHIFT_DISPLAY);
-	(void)spi_send_byte(0x02);
+	send_shift(0x02);
 }
 
 void ledmatrix_shift_display_right(void)
 {
-	(void)spi_send_byte(CMD_SHIFT_DISPLAY);
-	(void)spi_send_byte(0x01);
+	send_shift(0x01);
 }
 
 void ledmatrix_shift_display_up(void)
 {
-	(void)spi_send_byte(CMD_SHIFT_DISPLAY);
-	(void)spi_send_byte(0x08);
+	send_shift(0x08);
 }
 
 void ledmatrix_shift_display_down(void)
 {
-	(void)spi_send_byte(CMD_SHIFT_DISPLAY);
-	(void)spi_send_byte(0x04);
+	send_shift(0x04);
 }
 
 void ledmatrix_clear(void)
 {
-	(void)spi_send_byte(CMD_CLEAR_SCREEN);
+	// Only the panels that may be showing something need clearing
+	for (uint8_t panel = 0; panel < LEDMATRIX_NUM_PANELS; panel++)
+	{
+		if (dirty_panels & (1 << panel))
+		{
+			send_command(panel, CMD_CLEAR_SCREEN);
+		}
+	}
+	dirty_panels = 0;
 }
 
 void copy_matrix_column(MatrixColumn from, MatrixColumn to)
@@ -142,3 +299,39 @@ void set_matrix_row_to_colour(MatrixRow matrix_row, PixelColour colour)
 		matrix_row[column] = colour;
 	}
 }
+
+uint8_t ledmatrix_set_spi_divider(uint8_t divider)
+{
+	// Only powers of two from 2 to 128 can be used
+	if (divider < 2 || divider > 128 || (divider & (divider - 1)))
+	{
+		return 0;
+	}
+#if LEDMATRIX_NUM_PANELS > 1
+	// Setting up SPI selects the first panel
+	set_select_line(selected_panel, 1);
+	selected_panel = 0;
+#endif
+	spi_divider = divider;
+	spi_setup_master(spi_divider);
+	return 1;
+}
+
+uint8_t ledmatrix_spi_divider(void)
+{
+	return spi_divider;
+}
+
+uint32_t ledmatrix_bytes_sent(void)
+{
+	return bytes_sent;
+}
+
+uint16_t ledmatrix_ram_usage(void)
+{
+	return sizeof(dirty_panels) + sizeof(spi_divider) + sizeof(bytes_sent)
+#if LEDMATRIX_NUM_PANELS > 1
+			+ sizeof(selected_panel)
+#endif
+			;
+}
@@ -2,6 +2,7 @@
  * ledmatrix.h
  *
  * Author: Peter Sutton
+ * Modified by Michael Blauberg
  */
 
 #ifndef LEDMATRIX_H_
@@ -10,11 +11,30 @@
 #include <stdint.h>
 #include "pixel_colour.h"
 
-// The matrix has 16 columns (x ranges from 0 to 15, left to right) and
-// 8 rows (y ranges from 0 to 7, bottom to top) - as per the X,Y
+// Each matrix panel has 16 columns (x ranges from 0 to 15, left to right)
+// and 8 rows (y ranges from 0 to 7, bottom to top) - as per the X,Y
 // coordinates marked on the board.
-#define MATRIX_NUM_COLUMNS 16
-#define MATRIX_NUM_ROWS 8
+#define PANEL_NUM_COLUMNS 16
+#define PANEL_NUM_ROWS 8
+
+// The display can be made of several panels, side by side and/or one
+// above the other, each on its own slave select line (see ledmatrix.c).
+// They are drawn on as one display, with x and y counted across all of
+// them (panel 0 is at the bottom left, and they are numbered along each
+// row of panels). Set these with build flags for more than one panel.
+#ifndef LEDMATRIX_PANELS_WIDE
+#define LEDMATRIX_PANELS_WIDE 1
+#endif
+#ifndef LEDMATRIX_PANELS_HIGH
+#define LEDMATRIX_PANELS_HIGH 1
+#endif
+#define LEDMATRIX_NUM_PANELS (LEDMATRIX_PANELS_WIDE * LEDMATRIX_PANELS_HIGH)
+#if LEDMATRIX_NUM_PANELS > 4
+#error "At most 4 LED matrix panels are supported"
+#endif
+
+#define MATRIX_NUM_COLUMNS (PANEL_NUM_COLUMNS * LEDMATRIX_PANELS_WIDE)
+#define MATRIX_NUM_ROWS (PANEL_NUM_ROWS * LEDMATRIX_PANELS_HIGH)
 
 // Data types which can be used to store display information
 typedef PixelColour MatrixData[MATRIX_NUM_COLUMNS][MATRIX_NUM_ROWS];
@@ -30,6 +50,10 @@ void ledmatrix_setup(void);
 // For those functions which take an x or a y value, the value must be valid
 // or the request will be ignored. (i.e. x must be < MATRIX_NUM_COLUMNS
 // and y must be < MATRIX_NUM_ROWS)
+// Nothing is sent to a panel that has been cleared and is only being sent
+// black, so a display of several panels costs little more to update than
+// one if only part of it is in use. Shifting moves each panel separately -
+// the columns (or rows) where panels meet are not carried across.
 void ledmatrix_update_all(MatrixData data);
 void ledmatrix_update_pixel(uint8_t x, uint8_t y, PixelColour pixel);
 void ledmatrix_update_row(uint8_t y, MatrixRow row);
@@ -46,4 +70,17 @@ void copy_matrix_row(MatrixRow from, MatrixRow to);
 void set_matrix_column_to_colour(MatrixColumn matrix_column, PixelColour colour);
 void set_matrix_row_to_colour(MatrixRow matrix_row, PixelColour colour);
 
+// Change the SPI clock divider (a power of two from 2 to 128 - see
+// spi_setup_master()). The default is 128, the slowest, which is the only
+// one guaranteed not to overflow the LED matrix's buffer. Returns zero if
+// the divider can't be used.
+uint8_t ledmatrix_set_spi_divider(uint8_t divider);
+uint8_t ledmatrix_spi_divider(void);
+
+// Number of bytes sent to the LED matrix since reset
+uint32_t ledmatrix_bytes_sent(void);
+
+// Returns the number of bytes of static RAM used by this module
+uint16_t ledmatrix_ram_usage(void);
+
 #endif /* LEDMATRIX_H_ */
@@ -0,0 +1,624 @@
+/*
+ * link.c
+ *
+ * Author: Michael Blauberg
+ *
+ * Head to head play over USART1. See link.h.
+ */
+
+#include "link.h"
+#include <stdint.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/crc16.h>
+#include "timer0.h"
+
+#define SYSCLK 8000000L
+#define LINK_BAUD 38400L
+
+#define SYNC 0x7E
+#define ALL_BOARDS 0xFF
+
+#define FRAME_PING		'P'	// leader: t1
+#define FRAME_PONG		'Q'	// follower: t1, t2, t3
+#define FRAME_START		'S'	// leader: track, speed, start, one way delay
+#define FRAME_STATUS	'T'	// leader: beat, lag, poll, boards, scores
+#define FRAME_REPORT	'R'	// follower: beat, score, notes missed
+
+#define MAX_PAYLOAD		(6 + 2 * LINK_MAX_BOARDS)
+#define FRAME_OVERHEAD	5
+#define TX_BUFFER_SIZE	32
+
+// Time between pings on the start screen (ms), and how many measurements
+// are made before the best one is replaced regardless
+#define PING_INTERVAL	50
+#define PING_WINDOW		8
+
+// How many times each follower is sent the start of a game
+#define START_REPEATS	3
+
+// Followers only move their start time when they are this far out of step
+// (us), and by at most this much (ms) at a time
+#define SYNC_THRESHOLD	500
+#define MAX_ADJUSTMENT	4
+
+// States of the receive parser
+#define RX_IDLE		0
+#define RX_TYPE		1
+#define RX_BOARD	2
+#define RX_LENGTH	3
+#define RX_PAYLOAD	4
+#define RX_CRC		5
+
+static uint8_t board = LINK_OFF;
+static uint8_t boards;			// linked boards (a bit each)
+
+// Frame being received (see upload.c)
+static volatile uint8_t rx_state;
+static volatile uint8_t rx_crc;
+static volatile uint8_t rx_count;
+static volatile uint8_t frame_type;
+static volatile uint8_t frame_board;
+static volatile uint8_t frame_length;
+static volatile uint8_t frame_payload[MAX_PAYLOAD];
+static volatile uint32_t frame_time;	// us, when the SYNC arrived
+static volatile uint32_t rx_time;
+static volatile uint8_t frame_ready;
+
+// Bytes waiting to be sent
+static volatile uint8_t tx_buffer[TX_BUFFER_SIZE];
+static volatile uint8_t tx_insert_pos;
+static volatile uint8_t tx_count;
+
+// Leader: clock offset (follower's clock less the leader's, us) and the
+// round trip delay (us) of the best recent measurement for each follower
+static int32_t offset[LINK_MAX_BOARDS];
+static uint16_t delay[LINK_MAX_BOARDS];
+static uint8_t measurements[LINK_MAX_BOARDS];
+static uint8_t ping_board;
+static uint32_t last_ping_time;
+
+// Game being started. The leader sends the start to each follower a few
+// times; followers keep it until it's asked for.
+static uint8_t playing;
+static uint8_t start_track;
+static uint16_t start_speed;
+static uint32_t start_time;		// ms (this board's clock)
+static uint8_t starts_to_send;
+static uint8_t start_requested;
+
+// Scores of all the boards, and the board asked to report next
+static int16_t scores[LINK_MAX_BOARDS];
+static uint8_t scores_changed;
+static uint8_t poll_board;
+
+// Follower: this board's last step and the leader's last step (in this
+// board's clock, us), for keeping in step
+static uint16_t one_way;		// us
+static uint16_t own_beat;
+static uint32_t own_step_time;
+static uint16_t leader_beat;
+static uint32_t leader_step_time;
+static uint8_t leader_step_fresh;
+static int8_t adjustment;
+static uint16_t report[3];		// beat, score, notes missed
+static uint8_t report_due;
+
+static void put16(uint8_t* p, uint16_t value)
+{
+	p[0] = value;
+	p[1] = value >> 8;
+}
+
+static void put32(uint8_t* p, uint32_t value)
+{
+	put16(p, value);
+	put16(p + 2, value >> 16);
+}
+
+static uint16_t get16(const volatile uint8_t* p)
+{
+	return p[0] | ((uint16_t)p[1] << 8);
+}
+
+static uint32_t get32(const volatile uint8_t* p)
+{
+	return get16(p) | ((uint32_t)get16(p + 2) << 16);
+}
+
+void init_link(uint8_t board_number)
+{
+	// Stop everything while it's set up
+	UCSR1B = 0;
+	board = board_number < LINK_MAX_BOARDS ? board_number : LINK_OFF;
+	boards = 0;
+	playing = 0;
+	start_requested = 0;
+	starts_to_send = 0;
+	rx_state = RX_IDLE;
+	frame_ready = 0;
+	tx_count = 0;
+	memset(measurements, 0, sizeof(measurements));
+	memset(scores, 0, sizeof(scores));
+	if (board == LINK_OFF)
+	{
+		return;
+	}
+	boards = 1 << board;
+
+	UBRR1 = (((SYSCLK / (8 * LINK_BAUD)) + 1) / 2) - 1;
+	UCSR1B = (1 << RXEN1) | (1 << RXCIE1);
+	if (board == LINK_LEADER)
+	{
+		// The leader has the line to the followers to itself
+		UCSR1B |= (1 << TXEN1);
+	}
+	else
+	{
+		// The transmitter is only turned on to answer the leader. The
+		// rest of the time the pin is an input (with a pull up) so
+		// another follower can use the line.
+		DDRD &= ~(1 << DDD3);
+		PORTD |= (1 << PORTD3);
+	}
+}
+
+uint8_t link_board(void)
+{
+	return board;
+}
+
+uint8_t link_boards(void)
+{
+	return boards;
+}
+
+// Queue a frame to be sent. Returns zero (and sends nothing) if there isn't
+// room for it - it will be sent again later, or isn't needed.
+static uint8_t send_frame(uint8_t type, uint8_t to, const uint8_t* payload,
+		uint8_t length)
+{
+	if (tx_count + length + FRAME_OVERHEAD > TX_BUFFER_SIZE)
+	{
+		return 0;
+	}
+	uint8_t header[4] = {SYNC, type, to, length};
+	uint8_t crc = 0;
+	uint8_t interrupts_were_enabled = bit_is_set(SREG, SREG_I);
+	cli();
+	for (uint8_t i = 0; i < length + FRAME_OVERHEAD; i++)
+	{
+		uint8_t c;
+		if (i < sizeof(header))
+		{
+			c = header[i];
+		}
+		else if (i < sizeof(header) + length)
+		{
+			c = payload[i - sizeof(header)];
+		}
+		else
+		{
+			c = crc;
+		}
+		if (i > 0)
+		{
+			crc = _crc8_ccitt_update(crc, c);
+		}
+		tx_buffer[tx_insert_pos] = c;
+		tx_insert_pos = (tx_insert_pos + 1) % TX_BUFFER_SIZE;
+		tx_count++;
+	}
+	if (board != LINK_LEADER)
+	{
+		UCSR1B = (UCSR1B & ~(1 << TXCIE1)) | (1 << TXEN1);
+	}
+	UCSR1B |= (1 << UDRIE1);
+	if (interrupts_were_enabled)
+	{
+		sei();
+	}
+	return 1;
+}
+
+// Take a new measurement of a follower's clock from a ping and its answer
+static void measured(uint8_t from, uint32_t t1, uint32_t t2, uint32_t t3,
+		uint32_t t4)
+{
+	uint32_t round_trip = (t4 - t1) - (t3 - t2);
+	if (round_trip > UINT16_MAX)
+	{
+		return;
+	}
+	// The best measurement is the one that spent least time on the wire.
+	// It is replaced every so often in case the clocks have drifted.
+	if (measurements[from] == 0 || round_trip <= delay[from]
+			|| measurements[from] >= PING_WINDOW)
+	{
+		offset[from] = (int32_t)(t2 - t1) - (int32_t)(round_trip / 2);
+		delay[from] = round_trip;
+		measurements[from] = 1;
+	}
+	else
+	{
+		measurements[from]++;
+	}
+	boards |= 1 << from;
+}
+
+// Time (from get_current_time()) in this board's millisecond clock of the
+// given time in its microsecond clock, which must be near
+static uint32_t local_ms(uint32_t time_us)
+{
+	uint32_t now_ms, now_us;
+	do
+	{
+		now_ms = get_current_time();
+		now_us = get_current_time_us();
+	} while (now_ms != get_current_time());
+	int32_t difference = time_us - now_us;
+	return now_ms + (difference + (difference < 0 ? -500 : 500)) / 1000;
+}
+
+// Follower: if both this board and the leader have reported the same step,
+// work out how far out of step they are
+static void compare_steps(void)
+{
+	if (!leader_step_fresh || leader_beat != own_beat)
+	{
+		return;
+	}
+	leader_step_fresh = 0;
+	int32_t error = own_step_time - leader_step_time;
+	if (error > -SYNC_THRESHOLD && error < SYNC_THRESHOLD)
+	{
+		return;
+	}
+	// A step that is late means the start time is too late
+	int32_t ms = (error + (error < 0 ? -500 : 500)) / 1000;
+	if (ms > MAX_ADJUSTMENT)
+	{
+		ms = MAX_ADJUSTMENT;
+	}
+	if (ms < -MAX_ADJUSTMENT)
+	{
+		ms = -MAX_ADJUSTMENT;
+	}
+	adjustment -= ms;
+}
+
+static void handle_frame(void)
+{
+	uint8_t to = frame_board;
+	const volatile uint8_t* p = frame_payload;
+
+	if (board == LINK_LEADER)
+	{
+		if (to >= LINK_MAX_BOARDS)
+		{
+			return;
+		}
+		if (frame_type == FRAME_PONG && frame_length == 12)
+		{
+			measured(to, get32(p), get32(p + 4), get32(p + 8), frame_time);
+		}
+		else if (frame_type == FRAME_REPORT && frame_length == 6)
+		{
+			int16_t score = get16(p + 2);
+			if (score != scores[to])
+			{
+				scores[to] = score;
+				scores_changed = 1;
+			}
+			boards |= 1 << to;
+		}
+		return;
+	}
+
+	if (to != board && to != ALL_BOARDS)
+	{
+		return;
+	}
+	if (frame_type == FRAME_PING && frame_length == 4)
+	{
+		uint8_t pong[12];
+		put32(pong, get32(p));
+		put32(pong + 4, frame_time);
+		put32(pong + 8, get_current_time_us());
+		send_frame(FRAME_PONG, board, pong, sizeof(pong));
+	}
+	else if (frame_type == FRAME_START && frame_length == 9 && !playing)
+	{
+		start_track = p[0];
+		start_speed = get16(p + 1);
+		start_time = local_ms(get32(p + 3));
+		one_way = get16(p + 7);
+		playing = 1;
+		start_requested = 1;
+		leader_step_fresh = 0;
+		adjustment = 0;
+		report_due = 0;
+	}
+	else if (frame_type == FRAME_STATUS && frame_length == MAX_PAYLOAD
+			&& playing)
+	{
+		// When the leader's step was due, in this board's clock
+		leader_beat = get16(p);
+		leader_step_time = frame_time - one_way - get16(p + 2);
+		leader_step_fresh = 1;
+		compare_steps();
+
+		if (p[4] == board)
+		{
+			report_due = 1;
+		}
+		boards = p[5] | (1 << board);
+		for (uint8_t i = 0; i < LINK_MAX_BOARDS; i++)
+		{
+			int16_t score = get16(p + 6 + 2 * i);
+			if (i != board && score != scores[i])
+			{
+				scores[i] = score;
+				scores_changed = 1;
+			}
+		}
+	}
+}
+
+void link_poll(void)
+{
+	if (board == LINK_OFF)
+	{
+		return;
+	}
+	if (frame_ready)
+	{
+		handle_frame();
+		frame_ready = 0;
+	}
+
+	if (board != LINK_LEADER)
+	{
+		if (report_due)
+		{
+			uint8_t payload[6];
+			put16(payload, report[0]);
+			put16(payload + 2, report[1]);
+			put16(payload + 4, report[2]);
+			report_due = !send_frame(FRAME_REPORT, board, payload,
+					sizeof(payload));
+		}
+		return;
+	}
+
+	if (starts_to_send)
+	{
+		// Send the start to each follower in turn
+		uint8_t to = 1 + (starts_to_send - 1) % (LINK_MAX_BOARDS - 1);
+		if (!(boards & (1 << to)))
+		{
+			starts_to_send--;
+			return;
+		}
+		uint8_t payload[9];
+		payload[0] = start_track;
+		put16(payload + 1, start_speed);
+		put32(payload + 3, start_time * 1000 + offset[to]);
+		put16(payload + 7, delay[to] / 2);
+		if (send_frame(FRAME_START, to, payload, sizeof(payload)))
+		{
+			starts_to_send--;
+		}
+	}
+	else if (!playing && tx_count == 0
+			&& get_current_time() - last_ping_time >= PING_INTERVAL)
+	{
+		// Ping the next follower. (Nothing else is being sent, so the
+		// ping goes straight out.)
+		last_ping_time = get_current_time();
+		ping_board = ping_board % (LINK_MAX_BOARDS - 1) + 1;
+		uint8_t payload[4];
+		put32(payload, get_current_time_us());
+		send_frame(FRAME_PING, ping_board, payload, sizeof(payload));
+	}
+}
+
+uint32_t link_start(uint8_t track, uint16_t game_speed, uint16_t lead_ms)
+{
+	start_track = track;
+	start_speed = game_speed;
+	start_time = get_current_time() + lead_ms;
+	starts_to_send = START_REPEATS * (LINK_MAX_BOARDS - 1);
+	playing = 1;
+	poll_board = 0;
+	return start_time;
+}
+
+uint8_t link_start_requested(uint8_t* track, uint16_t* game_speed)
+{
+	if (!start_requested)
+	{
+		return 0;
+	}
+	start_requested = 0;
+	*track = start_track;
+	*game_speed = start_speed;
+	return 1;
+}
+
+uint32_t link_start_time(void)
+{
+	return start_time;
+}
+
+void link_step(uint32_t beat, uint32_t due_time, int16_t score,
+		uint16_t notes_missed)
+{
+	if (board == LINK_OFF || !playing)
+	{
+		return;
+	}
+	if (score != scores[board])
+	{
+		scores[board] = score;
+		scores_changed = 1;
+	}
+	if (board != LINK_LEADER)
+	{
+		own_beat = beat;
+		own_step_time = due_time * 1000;
+		compare_steps();
+		report[0] = beat;
+		report[1] = score;
+		report[2] = notes_missed;
+		return;
+	}
+
+	// Ask the followers to report in turn
+	do
+	{
+		poll_board = poll_board % (LINK_MAX_BOARDS - 1) + 1;
+	} while (!(boards & (1 << poll_board)) && boards != 1);
+
+	uint8_t payload[MAX_PAYLOAD];
+	put16(payload, beat);
+	payload[4] = poll_board;
+	payload[5] = boards;
+	for (uint8_t i = 0; i < LINK_MAX_BOARDS; i++)
+	{
+		put16(payload + 6 + 2 * i, scores[i]);
+	}
+	// How long ago the step was due. If a status is still being sent this
+	// one is dropped (so this is always right).
+	if (tx_count == 0)
+	{
+		uint32_t lag = get_current_time_us() - due_time * 1000;
+		put16(payload + 2, lag > UINT16_MAX ? UINT16_MAX : lag);
+		send_frame(FRAME_STATUS, ALL_BOARDS, payload, sizeof(payload));
+	}
+}
+
+int8_t link_take_adjustment(void)
+{
+	int8_t result = adjustment;
+	adjustment = 0;
+	return result;
+}
+
+int16_t link_score(uint8_t board_number)
+{
+	return board_number < LINK_MAX_BOARDS ? scores[board_number] : 0;
+}
+
+uint8_t link_scores_changed(void)
+{
+	uint8_t result = scores_changed;
+	scores_changed = 0;
+	return result;
+}
+
+void link_end(void)
+{
+	playing = 0;
+	starts_to_send = 0;
+	report_due = 0;
+}
+
+uint16_t link_ram_usage(void)
+{
+	return sizeof(board) + sizeof(boards) + sizeof(rx_state)
+			+ sizeof(rx_crc) + sizeof(rx_count) + sizeof(frame_type)
+			+ sizeof(frame_board) + sizeof(frame_length)
+			+ sizeof(frame_payload) + sizeof(frame_time) + sizeof(rx_time)
+			+ sizeof(frame_ready) + sizeof(tx_buffer) + sizeof(tx_insert_pos)
+			+ sizeof(tx_count) + sizeof(offset) + sizeof(delay)
+			+ sizeof(measurements) + sizeof(ping_board)
+			+ sizeof(last_ping_time) + sizeof(playing) + sizeof(start_track)
+			+ sizeof(start_speed) + sizeof(start_time)
+			+ sizeof(starts_to_send) + sizeof(start_requested)
+			+ sizeof(scores) + sizeof(scores_changed) + sizeof(poll_board)
+			+ sizeof(one_way) + sizeof(own_beat) + sizeof(own_step_time)
+			+ sizeof(leader_beat) + sizeof(leader_step_time)
+			+ sizeof(leader_step_fresh) + sizeof(adjustment)
+			+ sizeof(report) + sizeof(report_due);
+}
+
+ISR(USART1_RX_vect)
+{
+	uint8_t c = UDR1;
+	switch (rx_state)
+	{
+		case RX_IDLE:
+			// A frame that starts before the last one has been dealt with
+			// is dropped (rather than overwriting it as it's read)
+			if (c == SYNC && !frame_ready)
+			{
+				// Frames are timed from when their first byte arrives
+				rx_time = get_current_time_us();
+				rx_crc = 0;
+				rx_state = RX_TYPE;
+			}
+			return;
+		case RX_TYPE:
+			frame_type = c;
+			rx_state = RX_BOARD;
+			break;
+		case RX_BOARD:
+			frame_board = c;
+			rx_state = RX_LENGTH;
+			break;
+		case RX_LENGTH:
+			frame_length = c;
+			rx_count = 0;
+			if (c > MAX_PAYLOAD)
+			{
+				rx_state = RX_IDLE;
+				return;
+			}
+			rx_state = c ? RX_PAYLOAD : RX_CRC;
+			break;
+		case RX_PAYLOAD:
+			frame_payload[rx_count++] = c;
+			if (rx_count == frame_length)
+			{
+				rx_state = RX_CRC;
+			}
+			break;
+		case RX_CRC:
+			if (c == rx_crc)
+			{
+				frame_time = rx_time;
+				frame_ready = 1;
+			}
+			rx_state = RX_IDLE;
+			return;
+	}
+	rx_crc = _crc8_ccitt_update(rx_crc, c);
+}
+
+ISR(USART1_UDRE_vect)
+{
+	if (tx_count > 0)
+	{
+		uint8_t pos = (tx_insert_pos + TX_BUFFER_SIZE - tx_count)
+				% TX_BUFFER_SIZE;
+		tx_count--;
+		UDR1 = tx_buffer[pos];
+	}
+	else
+	{
+		UCSR1B &= ~(1 << UDRIE1);
+		if (board != LINK_LEADER)
+		{
+			// Let go of the line once the last byte has gone
+			UCSR1B |= (1 << TXCIE1);
+		}
+	}
+}
+
+ISR(USART1_TX_vect)
+{
+	// Turning the transmitter off makes the pin an input again
+	UCSR1B &= ~((1 << TXEN1) | (1 << TXCIE1));
+}
@@ -0,0 +1,96 @@
+/*
+ * link.h
+ *
+ * Author: Michael Blauberg
+ *
+ * Head to head play between several boards linked through USART1. One
+ * board leads and the others (up to LINK_MAX_BOARDS in all) follow. The
+ * leader's TXD1 goes to every follower's RXD1, and every follower's TXD1
+ * goes to the leader's RXD1. (With two boards this is just a crossed
+ * pair.) Followers share that line by only turning their transmitter on
+ * when the leader asks them for something, so they never talk at once.
+ *
+ * Frames are
+ *
+ *     SYNC(0x7E) type board length payload[length] crc
+ *
+ * where board is the board the frame is for (or from, for frames sent to
+ * the leader) and crc is the CRC-8 of everything from the type to the
+ * end of the payload. Frames that are damaged or arrive before the last
+ * one has been dealt with are dropped. Nothing is ever waited for, so a
+ * lost frame only means an update comes a little later:
+ *
+ *   - On the start screen the leader keeps pinging each follower. From the
+ *     times the ping and its answer were sent and received it works out
+ *     each follower's clock offset and the delay on the wire (the NTP way),
+ *     keeping the best of the recent measurements. Times are taken as the
+ *     first byte of each frame arrives so both directions are alike.
+ *   - When the leader starts a game it tells each follower the track, the
+ *     speed and the time to start, converted to that follower's clock. This
+ *     is sent a few times in case it's lost.
+ *   - After every step of the notes the leader sends a status frame with
+ *     the scores of all the boards, asking one follower to report its own
+ *     score. Followers also use it as a time signal: they know when the
+ *     leader's step was due, so they nudge their own start time to keep
+ *     their steps with the leader's, and the boards scroll in step to
+ *     within a millisecond however their clocks drift.
+ */
+
+#ifndef LINK_H_
+#define LINK_H_
+
+#include <stdint.h>
+
+#define LINK_MAX_BOARDS	4
+#define LINK_LEADER		0
+#define LINK_OFF		0xFF
+
+// Set up USART1 as the given board (LINK_LEADER, a follower from 1 to
+// LINK_MAX_BOARDS-1, or LINK_OFF to not use the link). May be called
+// again to change board.
+void init_link(uint8_t board);
+
+// This board's number (or LINK_OFF)
+uint8_t link_board(void);
+
+// Deal with any frame received and send any that are due. This should be
+// called often (from every main loop) and returns quickly when there is
+// nothing to do.
+void link_poll(void);
+
+// Boards known to be linked, a bit for each board (including this one)
+uint8_t link_boards(void);
+
+// Leader: start a game on every board lead_ms from now. Returns the
+// time (from get_current_time()) play starts.
+uint32_t link_start(uint8_t track, uint16_t game_speed, uint16_t lead_ms);
+
+// Follower: returns non-zero (once) when the leader has started a game, and
+// gives its track and speed
+uint8_t link_start_requested(uint8_t* track, uint16_t* game_speed);
+
+// Follower: time (from get_current_time()) the leader's game starts
+uint32_t link_start_time(void);
+
+// Called after every step of the notes while playing a linked game, with
+// the number of steps so far, the time (from get_current_time()) the step
+// was due and this board's score.
+void link_step(uint32_t beat, uint32_t due_time, int16_t score,
+		uint16_t notes_missed);
+
+// Follower: the number of ms its start time should be moved by to keep
+// in step with the leader (taken once)
+int8_t link_take_adjustment(void);
+
+// Score of a linked board, and whether any scores have changed since this
+// was last asked
+int16_t link_score(uint8_t board);
+uint8_t link_scores_changed(void);
+
+// The linked game is over
+void link_end(void);
+
+// Returns the number of bytes of static RAM used by this module
+uint16_t link_ram_usage(void);
+
+#endif /* LINK_H_ */
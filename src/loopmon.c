@@ -0,0 +1,190 @@
+/*
+ * loopmon.c
+ *
+ * Author: Michael Blauberg
+ *
+ * Game loop timing and watchdog. See loopmon.h.
+ */
+
+#include "loopmon.h"
+#include <stdio.h>
+#include <avr/io.h>
+#include <avr/wdt.h>
+#include <avr/pgmspace.h>
+#include "timer0.h"
+#include "terminalio.h"
+
+// The game loop must get round in this time or the board is reset
+#define WATCHDOG_TIMEOUT WDTO_500MS
+
+// Marks the statistics as having been written by this program (rather
+// than being whatever was in RAM when the board was turned on)
+#define STATS_MAGIC 0x4C6D
+
+typedef struct
+{
+	uint16_t magic;
+	uint8_t playing;	// a game was being monitored
+	uint16_t bins[LOOPMON_BINS];
+	uint32_t iterations;
+	uint32_t longest_us;
+	uint16_t late_steps;
+	uint16_t worst_lateness;
+} LoopStats;
+
+// Kept in .noinit so they survive a reset. The reset flags are saved by
+// save_reset_flags() before anything else runs.
+static LoopStats stats __attribute__((section(".noinit")));
+static uint8_t reset_flags __attribute__((section(".noinit")));
+
+// Whether the statistics were from before the last reset
+static uint8_t stats_kept;
+static uint32_t last_time_us;
+
+// After a watchdog reset the watchdog is left running (with its shortest
+// timeout), so it must be turned off straight after reset - before the
+// C start up code clears the .bss, which could take longer. This runs in
+// .init3, once the stack is set up.
+void save_reset_flags(void) __attribute__((naked, used, section(".init3")));
+void save_reset_flags(void)
+{
+	reset_flags = MCUSR;
+	MCUSR = 0;
+	wdt_disable();
+}
+
+static void clear_stats(void)
+{
+	stats.magic = STATS_MAGIC;
+	stats.playing = 0;
+	for (uint8_t i = 0; i < LOOPMON_BINS; i++)
+	{
+		stats.bins[i] = 0;
+	}
+	stats.iterations = 0;
+	stats.longest_us = 0;
+	stats.late_steps = 0;
+	stats.worst_lateness = 0;
+}
+
+void init_loopmon(void)
+{
+	stats_kept = stats.magic == STATS_MAGIC && !(reset_flags & (1 << PORF));
+	if (!stats_kept)
+	{
+		clear_stats();
+	}
+}
+
+void loopmon_start(void)
+{
+	clear_stats();
+	stats.playing = 1;
+	stats_kept = 0;
+	last_time_us = get_current_time_us();
+	wdt_enable(WATCHDOG_TIMEOUT);
+}
+
+void loopmon_stop(void)
+{
+	wdt_disable();
+	stats.playing = 0;
+}
+
+void loopmon_iteration(void)
+{
+	wdt_reset();
+	uint32_t now = get_current_time_us();
+	uint32_t time = now - last_time_us;
+	last_time_us = now;
+
+	uint8_t bin = LOOPMON_BINS - 1;
+	if (time <= UINT16_MAX)
+	{
+		uint16_t t = (uint16_t)time >> 4;
+		for (bin = 0; t && bin < LOOPMON_BINS - 1; bin++)
+		{
+			t >>= 1;
+		}
+	}
+	if (stats.bins[bin] == UINT16_MAX)
+	{
+		// Halve every count so they keep their proportions
+		for (uint8_t i = 0; i < LOOPMON_BINS; i++)
+		{
+			stats.bins[i] >>= 1;
+		}
+	}
+	stats.bins[bin]++;
+	stats.iterations++;
+	if (time > stats.longest_us)
+	{
+		stats.longest_us = time;
+	}
+}
+
+uint8_t loopmon_step(int32_t lateness)
+{
+	if (lateness > (int32_t)stats.worst_lateness)
+	{
+		stats.worst_lateness = lateness > UINT16_MAX ? UINT16_MAX : lateness;
+	}
+	if (lateness > LOOPMON_LATE_MS)
+	{
+		stats.late_steps++;
+		return 1;
+	}
+	return 0;
+}
+
+uint16_t loopmon_late_steps(void)
+{
+	return stats.late_steps;
+}
+
+uint16_t loopmon_worst_lateness(void)
+{
+	return stats.worst_lateness;
+}
+
+uint8_t loopmon_unexpected_reset(void)
+{
+	return stats_kept;
+}
+
+void loopmon_report(int8_t row)
+{
+	move_terminal_cursor(10, row++);
+	clear_to_end_of_line();
+	printf_P(PSTR("Last reset: %S%S"),
+			(reset_flags & (1 << PORF)) ? PSTR("power on")
+			: (reset_flags & (1 << WDRF)) ? PSTR("watchdog")
+			: (reset_flags & (1 << BORF)) ? PSTR("brown-out")
+			: (reset_flags & (1 << EXTRF)) ? PSTR("reset pin")
+			: (reset_flags & (1 << JTRF)) ? PSTR("JTAG")
+			: PSTR("unknown"),
+			stats_kept && stats.playing ? PSTR(" during a game") : PSTR(""));
+
+	// Each bin is shown with the shortest time (us) it counts
+	for (uint8_t bin = 0; bin < LOOPMON_BINS; bin++)
+	{
+		if (bin % (LOOPMON_BINS / 2) == 0)
+		{
+			move_terminal_cursor(10, row++);
+			clear_to_end_of_line();
+			printf_P(PSTR("Loop us"));
+		}
+		printf_P(PSTR(" %lu+:%u"), bin ? 8UL << bin : 0UL, stats.bins[bin]);
+	}
+	move_terminal_cursor(10, row);
+	clear_to_end_of_line();
+	printf_P(PSTR("%lu loops, longest %lu us, %u steps late, worst %u ms"),
+			stats.iterations, stats.longest_us, stats.late_steps,
+			stats.worst_lateness);
+}
+
+uint16_t loopmon_ram_usage(void)
+{
+	return sizeof(stats) + sizeof(reset_flags) + sizeof(stats_kept)
+			+ sizeof(last_time_us);
+}
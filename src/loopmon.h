@@ -0,0 +1,67 @@
+/*
+ * loopmon.h
+ *
+ * Author: Michael Blauberg
+ *
+ * Game loop monitor. While a game is played the time each iteration of
+ * the game loop takes is counted in a histogram with a bin for each power
+ * of two microseconds, along with the number of steps taken late and the
+ * worst lateness - so it can be seen how close the loop comes to missing
+ * its deadlines, and what holds it up when it does.
+ *
+ * The hardware watchdog is armed during play and reset every iteration,
+ * so a game loop that hangs (e.g. waiting on the serial port) resets the
+ * board rather than freezing it. The statistics are kept in .noinit RAM,
+ * which isn't cleared at reset, so after a reset the cause and the
+ * histogram of the game that was being played can be reported.
+ */
+
+#ifndef LOOPMON_H_
+#define LOOPMON_H_
+
+#include <stdint.h>
+
+// Bins of the histogram: bin 0 counts iterations shorter than 16us (the
+// clock has a resolution of 8us), bin n those from 2^(n+3) up to 2^(n+4)us
+// and the last those of 2^(LOOPMON_BINS+2)us (~65ms) or more
+#define LOOPMON_BINS 14
+
+// Steps taken more than this many ms after they were due count as late
+#define LOOPMON_LATE_MS 1
+
+// Find out why the board was last reset and check the statistics kept
+// from before. Called once at start up.
+void init_loopmon(void);
+
+// Start monitoring a game (clearing the statistics) and arm the watchdog
+void loopmon_start(void);
+
+// Stop monitoring and disarm the watchdog
+void loopmon_stop(void);
+
+// Called at the start of every iteration of the game loop. This times the
+// iteration before and resets the watchdog. Takes roughly 150 clock
+// cycles (~20us).
+void loopmon_iteration(void);
+
+// Called when a step is taken, with how late it was (ms). Returns
+// non-zero if it was late.
+uint8_t loopmon_step(int32_t lateness);
+
+// Number of steps taken late and the latest (ms) in the last game
+uint16_t loopmon_late_steps(void);
+uint16_t loopmon_worst_lateness(void);
+
+// Returns non-zero if the last reset was by the watchdog, a brown-out or
+// the reset pin (rather than the board being turned on) and there are
+// statistics from before it to report
+uint8_t loopmon_unexpected_reset(void);
+
+// Print the cause of the last reset and the statistics of the last game
+// on the terminal, starting at the given row (4 rows)
+void loopmon_report(int8_t row);
+
+// Returns the number of bytes of static RAM used by this module
+uint16_t loopmon_ram_usage(void);
+
+#endif /* LOOPMON_H_ */
@@ -0,0 +1,88 @@
+/*
+ * playfield.h
+ *
+ * Author: Michael Blauberg
+ *
+ * Shape of the playfield on the LED matrix. Notes come on at the left of
+ * the display (column 0) and scroll right, one column a step, through the
+ * scoring area and off the end. Each lane is a band of rows, with lane 0
+ * at the bottom.
+ *
+ * Everything here can be set with build flags (-DPLAYFIELD_...=n in
+ * platformio.ini) - the defaults are the original game on one 16x8
+ * panel. A longer display (see ledmatrix.h) shows more of the song coming.
+ */
+
+#ifndef PLAYFIELD_H_
+#define PLAYFIELD_H_
+
+#include <stdint.h>
+#include "ledmatrix.h"
+
+// Number of lanes, and how many rows of the display each lane takes. There
+// can be at most four lanes - there are four buttons, and songs and
+// recordings have four lanes.
+#ifndef PLAYFIELD_NUM_LANES
+#define PLAYFIELD_NUM_LANES		4
+#endif
+#ifndef PLAYFIELD_LANE_WIDTH
+#define PLAYFIELD_LANE_WIDTH	(MATRIX_NUM_ROWS / PLAYFIELD_NUM_LANES)
+#endif
+
+// Columns between one row of the track and the next, which is also the
+// number of steps each row takes to move on to where the last one was
+#ifndef PLAYFIELD_ROW_SPACING
+#define PLAYFIELD_ROW_SPACING	5
+#endif
+
+// First column and width of the scoring area. Notes are worth more points
+// the nearer they are to its middle when they're played. (It is at the end
+// of the display unless set otherwise.)
+#ifndef PLAYFIELD_SCORING_WIDTH
+#define PLAYFIELD_SCORING_WIDTH	5
+#endif
+#ifndef PLAYFIELD_SCORING_START
+#define PLAYFIELD_SCORING_START	(MATRIX_NUM_COLUMNS - PLAYFIELD_SCORING_WIDTH)
+#endif
+#define PLAYFIELD_SCORING_END \
+		(PLAYFIELD_SCORING_START + PLAYFIELD_SCORING_WIDTH - 1)
+#define PLAYFIELD_SCORING_MIDDLE \
+		(PLAYFIELD_SCORING_START + PLAYFIELD_SCORING_WIDTH / 2)
+
+// Number of rows of the track on the display at once (the first row of a
+// song starts in the last column)
+#define PLAYFIELD_VISIBLE_ROWS \
+		((MATRIX_NUM_COLUMNS - 1) / PLAYFIELD_ROW_SPACING + 1)
+
+// Number of steps from the start of a game until row r of the track is in
+// the middle of the scoring area (negative if it starts past the middle)
+#define PLAYFIELD_STEPS_TO_MIDDLE(r) ((int32_t)(r) * PLAYFIELD_ROW_SPACING \
+		+ PLAYFIELD_SCORING_MIDDLE - (MATRIX_NUM_COLUMNS - 1))
+
+// A bit for each column of the display (see game.c)
+#if MATRIX_NUM_COLUMNS <= 16
+typedef uint16_t PlayfieldBits;
+#elif MATRIX_NUM_COLUMNS <= 32
+typedef uint32_t PlayfieldBits;
+#elif MATRIX_NUM_COLUMNS <= 64
+typedef uint64_t PlayfieldBits;
+#else
+#error "The playfield can be at most 64 columns long"
+#endif
+
+#if PLAYFIELD_NUM_LANES < 1 || PLAYFIELD_NUM_LANES > 4
+#error "The playfield must have from 1 to 4 lanes"
+#endif
+#if PLAYFIELD_LANE_WIDTH < 1 \
+		|| PLAYFIELD_NUM_LANES * PLAYFIELD_LANE_WIDTH > MATRIX_NUM_ROWS
+#error "The lanes don't fit on the display"
+#endif
+#if PLAYFIELD_SCORING_WIDTH < 1 || PLAYFIELD_SCORING_START < 0 \
+		|| PLAYFIELD_SCORING_END >= MATRIX_NUM_COLUMNS
+#error "The scoring area must be on the display"
+#endif
+#if PLAYFIELD_SCORING_WIDTH > PLAYFIELD_ROW_SPACING
+#error "Only one row of the track can be in the scoring area at a time"
+#endif
+
+#endif /* PLAYFIELD_H_ */
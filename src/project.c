@@ -23,9 +23,24 @@
 #include "buttons.h"
 #include "serialio.h"
 #include "terminalio.h"
+#include "stackmon.h"
+#include "replay.h"
+#include "eestore.h"
+#include "upload.h"
+#include "anim.h"
+#include "simmarker.h"
 #include "timer0.h"
 #include "timer1.h"
+#include "tempo.h"
 #include "timer2.h"
+#include "link.h"
+#include "frameserver.h"
+#include "flightrec.h"
+#include "shell.h"
+#include "playfield.h"
+#include "loopmon.h"
+#include "autoplay.h"
+#include "calibrate.h"
 
 // Function prototypes - these are defined below (after main()) in the order
 // given here
@@ -36,7 +51,28 @@ void play_game(void);
 void handle_game_over(void);
 
 uint16_t game_speed;
+// Speed chosen on the start screen. This is the time (in ms) each row takes
+// in a song whose tempo is a row a second: 1000 is normal speed, 500 fast
+// and 250 extreme.
+static uint16_t speed_setting;
 bool manual_mode = false;
+bool replay_mode = false;
+// Time (from get_current_time()) at which play started
+static uint32_t game_start_time;
+// Whether this game is being played with other boards (see link.h)
+static bool linked_game = false;
+// Whether a game is being played (rather than a screen being shown)
+static bool in_game = false;
+// Input offset (1/16ms - see calibrate.h) this game's presses are judged with
+static int16_t input_offset;
+
+// How much is printed on the terminal (set with the verbose command - see
+// shell.h). When quiet the score isn't updated during the game (so the
+// serial port never holds it up); when chatty every late step is shown.
+#define VERBOSITY_QUIET		0
+#define VERBOSITY_NORMAL	1
+#define VERBOSITY_CHATTY	2
+static uint8_t verbosity = VERBOSITY_NORMAL;
 
 /////////////////////////////// main //////////////////////////////////
 int main(void)
@@ -67,12 +103,359 @@ void initialise_hardware(void)
 	init_timer1();
 	init_timer2();
 	
+	// Find out why the board was reset
+	init_loopmon();
+
+	// Load the saved settings and any recorded game from EEPROM
+	init_eestore();
+	replay_init();
+
+	// Link to other boards as the board chosen last time (if any)
+	uint8_t board_setting = eestore_read(EESTORE_KEY_BOARD, 0);
+	init_link(board_setting ? board_setting - 1 : LINK_OFF);
+	
 	// Turn on global interrupts
 	sei();
 }
 
+// Work out the game speed (ms per row) for the selected track's tempo at
+// the chosen speed
+static void update_game_speed(void)
+{
+	game_speed = (uint32_t)track_tempo(selected_track()) * speed_setting
+			/ 1000;
+}
+
+// Show the current game speed
+static void show_game_speed(void)
+{
+	move_terminal_cursor(10,16);
+	switch (speed_setting)
+	{
+		case 1000:
+			printf_P(PSTR("Game Speed: Normal Speed  "));
+			break;
+		case 500:
+			printf_P(PSTR("Game Speed: Fast Speed    "));
+			break;
+		case 250:
+			printf_P(PSTR("Game Speed: Extreme Speed "));
+			break;
+		default:
+			printf_P(PSTR("Game Speed: %u%% tempo     "),
+					(uint16_t)(100000UL / speed_setting));
+			break;
+	}
+}
+
+// Show whether the last recorded game will be replayed
+static void show_replay_mode(void)
+{
+	move_terminal_cursor(10,18);
+	if (replay_mode)
+	{
+		printf_P(PSTR("Replay: On (%u events) "), replay_num_inputs());
+	}
+	else
+	{
+		printf_P(PSTR("Replay: Off             "));
+	}
+}
+
+// Show the track that will be played, or the progress of an upload
+static void show_track(void)
+{
+	move_terminal_cursor(10,17);
+	if (upload_active())
+	{
+		printf_P(PSTR("Track: Uploading slot %u (%u%%)   "),
+				upload_slot() + 1, upload_percent());
+	}
+	else if (selected_track() < NUM_LIBRARY_SONGS)
+	{
+		printf_P(PSTR("Track: %-24S"), songlib_name(selected_track()));
+	}
+	else
+	{
+		printf_P(PSTR("Track: Slot %u (%u rows)        "),
+				selected_track() - NUM_LIBRARY_SONGS + 1,
+				track_rows(selected_track()));
+	}
+}
+
+// Show which board this is when linked to other boards
+static void show_link(void)
+{
+	move_terminal_cursor(10,19);
+	uint8_t board = link_board();
+	if (board == LINK_OFF)
+	{
+		printf_P(PSTR("Link: Off                  "));
+	}
+	else if (board == LINK_LEADER)
+	{
+		uint8_t boards = 0;
+		for (uint8_t i = 0; i < LINK_MAX_BOARDS; i++)
+		{
+			boards += (link_boards() >> i) & 1;
+		}
+		printf_P(PSTR("Link: Leader (%u boards)    "), boards);
+	}
+	else
+	{
+		printf_P(PSTR("Link: Board %u (following)  "), board + 1);
+	}
+}
+
+// Save a setting, saying so on the terminal if it couldn't be
+static void save_setting(uint8_t key, uint16_t value)
+{
+	if (!eestore_write_wait(key, value))
+	{
+		move_terminal_cursor(10,23);
+		printf_P(PSTR("Settings couldn't be saved"));
+	}
+}
+
+// Link to other boards as the next board number (or not at all)
+static void next_link_board(void)
+{
+	uint8_t board_setting = link_board() == LINK_OFF ? 0 : link_board() + 1;
+	board_setting = (board_setting + 1) % (LINK_MAX_BOARDS + 1);
+	init_link(board_setting ? board_setting - 1 : LINK_OFF);
+	save_setting(EESTORE_KEY_BOARD, board_setting);
+}
+
+// If the leader has started a linked game, play it on its track at its
+// speed. Returns non-zero if it has.
+static bool take_link_start(void)
+{
+	uint8_t track;
+	uint16_t speed;
+	if (!link_start_requested(&track, &speed))
+	{
+		return false;
+	}
+	select_track(track);
+	game_speed = speed;
+	replay_mode = false;
+	linked_game = true;
+	return true;
+}
+
+// Draw frames streamed from a host on the LED matrix until it has
+// finished, showing how fast they are arriving (see frameserver.h)
+static void serve_frames(void)
+{
+	anim_stop();
+	uint16_t fps_shown = UINT16_MAX;
+	while (frameserver_active())
+	{
+		frameserver_poll();
+		if (frameserver_fps() != fps_shown)
+		{
+			fps_shown = frameserver_fps();
+			move_terminal_cursor(10,21);
+			printf_P(PSTR("Display server: %u frames, %u fps   "),
+					frameserver_frames(), fps_shown);
+		}
+	}
+	move_terminal_cursor(10,21);
+	clear_to_end_of_line();
+}
+
+// Set the tempo (as a percentage of the song's own) from the shell. In a
+// game the steps from the next one on are at the new tempo. (A game whose
+// tempo has been changed won't replay the same, so replays and linked
+// games can't be changed, and the recording of any other game is dropped.)
+static void set_tempo(uint16_t percent)
+{
+	if (percent < 25 || percent > 400)
+	{
+		printf_P(PSTR("tempo must be 25 to 400%%"));
+		return;
+	}
+	if (in_game && (replay_mode || linked_game))
+	{
+		printf_P(PSTR("can't change the tempo of this game"));
+		return;
+	}
+	speed_setting = 100000UL / percent;
+	// (Settings can't be waited for during a game.)
+	uint8_t saved = in_game
+			? eestore_write(EESTORE_KEY_GAME_SPEED, speed_setting)
+			: eestore_write_wait(EESTORE_KEY_GAME_SPEED, speed_setting);
+	update_game_speed();
+	if (in_game)
+	{
+		tempo_set_speed(game_speed);
+		replay_record_discard();
+	}
+	else
+	{
+		show_game_speed();
+		move_terminal_cursor(10, SHELL_ROW + 1);
+	}
+	printf_P(PSTR("tempo %u%% (%u ms per row)"), percent, game_speed);
+	if (!saved)
+	{
+		printf_P(PSTR(" - not saved"));
+	}
+}
+
+// Show the autoplay mode on the shell's answer row
+static void show_autoplay(void)
+{
+	switch (autoplay_mode())
+	{
+		case AUTOPLAY_OFF:
+			printf_P(PSTR("autoplay off"));
+			break;
+		case AUTOPLAY_PERFECT:
+			printf_P(PSTR("autoplay perfect"));
+			break;
+		case AUTOPLAY_SLOPPY:
+			printf_P(PSTR("autoplay sloppy, up to %u ms out"),
+					autoplay_spread());
+			break;
+		case AUTOPLAY_RANDOM:
+			printf_P(PSTR("autoplay random"));
+			break;
+	}
+}
+
+// Carry out a command typed into the shell (see shell.h)
+static void run_command(ShellCommand* command)
+{
+	uint16_t value = command->args[0];
+	bool set = command->num_args > 0;
+	move_terminal_cursor(10, SHELL_ROW + 1);
+	clear_to_end_of_line();
+	switch (command->command)
+	{
+		case SHELL_HELP:
+			printf_P(PSTR("tempo [%%] spi [divider] window [columns] "
+					"verbose [0-2] stats loops auto [0-3] [ms] ram"));
+			break;
+		case SHELL_TEMPO:
+			if (set)
+			{
+				set_tempo(value);
+			}
+			else
+			{
+				printf_P(PSTR("tempo %u%% (%u ms per row)"),
+						(uint16_t)(100000UL / speed_setting), game_speed);
+			}
+			break;
+		case SHELL_SPI:
+			if (set && (value > UINT8_MAX || !ledmatrix_set_spi_divider(value)))
+			{
+				printf_P(PSTR("divider must be 2, 4, 8 ... 128"));
+				break;
+			}
+			printf_P(PSTR("spi divider %u"), ledmatrix_spi_divider());
+			break;
+		case SHELL_WINDOW:
+			if (set && (value > UINT8_MAX || !set_judgement_window(value)))
+			{
+				printf_P(PSTR("window must be 0 to %u"),
+						PLAYFIELD_SCORING_WIDTH / 2);
+				break;
+			}
+			printf_P(PSTR("judgement window %u columns"),
+					get_judgement_window());
+			break;
+		case SHELL_VERBOSE:
+			if (set)
+			{
+				if (value > VERBOSITY_CHATTY)
+				{
+					printf_P(PSTR("verbosity must be 0 to 2"));
+					break;
+				}
+				verbosity = value;
+			}
+			printf_P(PSTR("verbosity %u"), verbosity);
+			break;
+		case SHELL_LOOPS:
+			loopmon_report(SHELL_ROW + 1);
+			break;
+		case SHELL_AUTO:
+			// (Only the arguments given are filled in.)
+			if (set && (value > UINT8_MAX || (command->num_args > 1
+					&& command->args[1] > UINT8_MAX)
+					|| !autoplay_set(value, command->num_args > 1
+					? command->args[1] : AUTOPLAY_DEFAULT_SPREAD)))
+			{
+				printf_P(PSTR("autoplay must be 0 to 3, up to 255 ms"));
+				break;
+			}
+			show_autoplay();
+			break;
+		case SHELL_RAM:
+			stackmon_report(SHELL_ROW + 1);
+			break;
+		case SHELL_STATS:
+			printf_P(PSTR("beats %lu, late %u, spi bytes %lu, "
+					"tx dropped %u, rx lost %u"), beat, loopmon_late_steps(),
+					ledmatrix_bytes_sent(), serial_output_dropped(),
+					serial_input_lost());
+			break;
+		case SHELL_UNKNOWN:
+			printf_P(PSTR("unknown command - try help"));
+			break;
+		default:
+			printf_P(PSTR("bad value"));
+			break;
+	}
+}
+
+// Read a character from the serial port, unless it is part of a command
+// being typed into the shell. Returns -1 if there's nothing to act on.
+// Commands are carried out once they have been typed.
+static char read_serial_key(void)
+{
+	char serial_input = -1;
+	if (serial_input_available())
+	{
+		serial_input = fgetc(stdin);
+		if (shell_take_char(serial_input))
+		{
+			serial_input = -1;
+		}
+	}
+	ShellCommand command;
+	if (shell_command(&command))
+	{
+		run_command(&command);
+	}
+	return serial_input;
+}
+
+// Upload progress shown when no upload is in progress
+#define UPLOAD_NOT_SHOWN 0xFF
+
+// Choose the next track that can be played
+static void next_track(void)
+{
+	uint8_t track = selected_track();
+	do
+	{
+		track = (track + 1) % NUM_TRACKS;
+	} while (!track_available(track));
+	select_track(track);
+	save_setting(EESTORE_KEY_TRACK, track);
+}
+
 void start_screen(void)
 {
+	// A follower told to start from the game over screen goes straight on
+	if (linked_game)
+	{
+		return;
+	}
+
 	// Clear terminal screen and output a message
 	clear_terminal();
 	show_cursor();
@@ -105,32 +488,46 @@ void start_screen(void)
 	// to be pushed or a serial input of 's'
 	show_start_screen();
 
-	uint32_t last_screen_update, current_time;
-	last_screen_update = get_current_time();
-	
-	game_speed = 1000;
-	// Set normal game speed
-	move_terminal_cursor(10,16);
-	printf_P(PSTR("Game Speed: Normal Speed"));
+	// Use the game speed saved last time (normal speed if none)
+	speed_setting = eestore_read(EESTORE_KEY_GAME_SPEED, 1000);
+	show_game_speed();
 
+	// Best score so far
+	move_terminal_cursor(10,15);
+	printf_P(PSTR("High Score: %d"),
+			(int16_t)eestore_read(EESTORE_KEY_HIGH_SCORE, 0));
 
-	// Selected track
-	move_terminal_cursor(10,17);
-	printf_P(PSTR("Track: "));
 
-	uint8_t frame_number = 0;
+	// Selected track (the built in track if none has been chosen, or the
+	// chosen one has gone)
+	select_track(eestore_read(EESTORE_KEY_TRACK, BUILT_IN_TRACK));
+	update_game_speed();
+	show_track();
+	uint8_t upload_shown = UPLOAD_NOT_SHOWN;
+
+	// Replay mode
+	show_replay_mode();
+
+	// Link to other boards
+	show_link();
+	uint8_t boards_shown = link_boards();
+
+	// If the board was reset unexpectedly (e.g. by the watchdog because
+	// the game hung) say so, with what happened in the game before
+	if (loopmon_unexpected_reset())
+	{
+		loopmon_report(24);
+	}
+
 	// Wait until a button is pressed, or 's' is pressed on the terminal
 	while(1)
 	{
 		// First check for if a 's' is pressed
 		// There are two steps to this
-		// 1) collect any serial input (if available)
+		// 1) collect any serial input (if available, and not part of a
+		//    command)
 		// 2) check if the input is equal to the character 's'
-		char serial_input = -1;
-		if (serial_input_available())
-		{
-			serial_input = fgetc(stdin);
-		}
+		char serial_input = read_serial_key();
 		// If the serial input is 's', then exit the start screen
 		if (serial_input == 's' || serial_input == 'S')
 		{
@@ -143,34 +540,126 @@ void start_screen(void)
 			break;
 		}
 
+		// Followers start when the leader does
+		link_poll();
+		if (take_link_start())
+		{
+			break;
+		}
+		if (link_boards() != boards_shown)
+		{
+			boards_shown = link_boards();
+			show_link();
+		}
+		if (serial_input == 'b' || serial_input == 'B')
+		{
+			next_link_board();
+			boards_shown = link_boards();
+			show_link();
+		}
+
 		// Check for speed change from serial input
 		if (serial_input == '1')
 		{
-			game_speed = 1000;
-			move_terminal_cursor(10,16);
-			printf_P(PSTR("Game Speed: Normal Speed  "));
+			speed_setting = 1000;
+			save_setting(EESTORE_KEY_GAME_SPEED, speed_setting);
+			update_game_speed();
+			show_game_speed();
 		}
 		if (serial_input == '2')
 		{
-			game_speed = 500;
-			move_terminal_cursor(10,16);
-			printf_P(PSTR("Game Speed: Fast Speed    "));
+			speed_setting = 500;
+			save_setting(EESTORE_KEY_GAME_SPEED, speed_setting);
+			update_game_speed();
+			show_game_speed();
 		}
 		if (serial_input == '3')
 		{
-			game_speed = 250;
-			move_terminal_cursor(10,16);
-			printf_P(PSTR("Game Speed: Extreme Speed "));
+			speed_setting = 250;
+			save_setting(EESTORE_KEY_GAME_SPEED, speed_setting);
+			update_game_speed();
+			show_game_speed();
 		}
 
-		// every 200 ms, update the animation
-		current_time = get_current_time();
-		if (current_time - last_screen_update > game_speed/5)
+		// Choose the track to play
+		if (serial_input == 't' || serial_input == 'T')
 		{
-			update_start_screen(frame_number);
-			frame_number = (frame_number + 1) % 32;
-			last_screen_update = current_time;
+			next_track();
+			update_game_speed();
+			show_track();
+		}
+
+		// Deal with any song being uploaded, showing how far it has got
+		upload_poll();
+		if (upload_completed() || upload_abandoned())
+		{
+			// The new song (or a half written one) may replace the
+			// selected one
+			select_track(selected_track());
+			update_game_speed();
+		}
+		uint8_t progress = upload_active() ? upload_percent()
+				: UPLOAD_NOT_SHOWN;
+		if (progress != upload_shown)
+		{
+			upload_shown = progress;
+			show_track();
 		}
+
+		// A host streaming frames to the LED matrix takes it over until
+		// it has finished
+		frameserver_poll();
+		if (frameserver_active())
+		{
+			serve_frames();
+			show_start_screen();
+		}
+
+		// Calibrate the player's input offset with a metronome
+		if (serial_input == 'c' || serial_input == 'C')
+		{
+			anim_stop();
+			calibrate_run(22);
+			show_start_screen();
+		}
+
+		// Toggle replaying the last recorded game
+		if ((serial_input == 'p' || serial_input == 'P') && replay_available())
+		{
+			replay_mode = !replay_mode;
+			show_replay_mode();
+		}
+
+		// Report stack and static RAM usage
+		if (serial_input == 'r' || serial_input == 'R')
+		{
+			stackmon_report(20);
+		}
+
+		// every 200 ms (at normal speed), update the animation
+		anim_update(game_speed/5);
+	}
+	anim_stop();
+
+	// Uploads are only dealt with here, so one that was abandoned would
+	// otherwise swallow the serial keys for the whole game
+	upload_abort();
+	if (upload_abandoned())
+	{
+		// It may have left the selected song half written
+		select_track(selected_track());
+		update_game_speed();
+	}
+
+	// The leader starts the same game on every linked board once the
+	// countdown is over (with a little time to spare for the message to
+	// get there). Linked games aren't replays.
+	if (!linked_game && link_board() == LINK_LEADER
+			&& link_boards() != (1 << LINK_LEADER))
+	{
+		link_start(selected_track(), game_speed, game_speed*2 + 200);
+		replay_mode = false;
+		linked_game = true;
 	}
 }
 
@@ -193,6 +682,14 @@ void new_game(void)
 			last_screen_update = current_time;
 			timer++;
 		}
+		link_poll();
+	}
+
+	// A replay must run at the speed and on the track it was recorded at
+	if (replay_mode)
+	{
+		game_speed = replay_game_speed();
+		select_track(replay_track());
 	}
 
 	// Initialise the game and display
@@ -204,109 +701,439 @@ void new_game(void)
 	clear_serial_input_buffer();
 }
 
+// Advance the notes one step and let the simulation harness know. In a
+// linked game the other boards are told, and this board's steps are kept
+// in step with the leader's.
+static void advance_beat(void)
+{
+	uint32_t due_time = game_start_time + tempo_next_step();
+	advance_note();
+	tempo_step_taken();
+	if (!replay_mode)
+	{
+		autoplay_step(tempo_next_step(), tempo_step_ms());
+	}
+	SIM_MARK(SIM_EVENT_BEAT, beat);
+	if (linked_game)
+	{
+		link_step(beat, due_time, score, notes_missed);
+		game_start_time += link_take_adjustment();
+	}
+}
+
+// Show the scores of all the linked boards
+static void show_link_scores(void)
+{
+	move_terminal_cursor(10,8);
+	printf_P(PSTR("Boards:"));
+	for (uint8_t i = 0; i < LINK_MAX_BOARDS; i++)
+	{
+		if (link_boards() & (1 << i))
+		{
+			printf_P(PSTR(" %u:%-4d"), i + 1, link_score(i));
+		}
+	}
+}
+
+// Have timer 1 post the next step when it's due (unless the steps are
+// being taken by hand, or by a replay's virtual clock)
+static void schedule_step(void)
+{
+	if (!manual_mode && !replay_mode)
+	{
+		timer1_set_step_time(game_start_time + tempo_next_step());
+	}
+}
+
+// Game time an input handled at current_time is timed at. The steps are
+// taken when timer 1 posts them, which can be a moment either side of the
+// millisecond tick they're due on. The input is timed as being between the
+// last step taken and the next one so a replay handles it at the same point.
+static uint32_t input_time(uint32_t current_time)
+{
+	uint32_t next_step = tempo_next_step();
+	if (current_time >= next_step)
+	{
+		current_time = next_step - 1;
+	}
+	if (current_time + tempo_step_ms() < next_step)
+	{
+		current_time = next_step - tempo_step_ms();
+	}
+	return current_time;
+}
+
+// Steps (negative if earlier) from the current one to the one a press made
+// at the given game time is judged in, once the player's input offset is
+// taken off. Worked out in fixed point, as the offset is, and kept within
+// MAX_JUDGEMENT_STEPS (see game.h).
+static int8_t judgement_steps(uint32_t current_time)
+{
+	if (input_offset == 0 || manual_mode)
+	{
+		return 0;
+	}
+	int32_t step = (int32_t)tempo_step_ms() << CALIBRATE_FRACTION_BITS;
+	int32_t since_step = ((int32_t)(input_time(current_time)
+			+ tempo_step_ms() - tempo_next_step()) << CALIBRATE_FRACTION_BITS)
+			- input_offset;
+	int8_t steps = 0;
+	while (since_step < 0 && steps > -MAX_JUDGEMENT_STEPS)
+	{
+		since_step += step;
+		steps--;
+	}
+	while (since_step >= step && steps < MAX_JUDGEMENT_STEPS)
+	{
+		since_step -= step;
+		steps++;
+	}
+	return steps;
+}
+
+// Act on an input (see replay.h) handled at the given game time. Live
+// inputs are recorded so the game can be replayed later. Lane inputs are
+// only added to *lanes here - the caller plays them together as a chord
+// once all the inputs that arrived at this time have been collected.
+static void handle_input(int8_t input, uint32_t current_time, uint8_t* lanes)
+{
+	if (!replay_mode)
+	{
+		if (!manual_mode)
+		{
+			current_time = input_time(current_time);
+		}
+		replay_record_input(input, current_time);
+	}
+	switch (input)
+	{
+		case INPUT_LANE0:
+		case INPUT_LANE1:
+		case INPUT_LANE2:
+		case INPUT_LANE3:
+			*lanes |= 1 << input;
+			break;
+		case INPUT_MANUAL_TOGGLE:
+			manual_mode = !manual_mode;
+			if (manual_mode)
+			{
+				timer1_cancel_step();
+			}
+			else
+			{
+				// Automatic steps carry on from when the next one would
+				// have been, or straight away if that time has passed
+				if (tempo_next_step() < current_time)
+				{
+					tempo_restart(current_time);
+				}
+				schedule_step();
+			}
+			move_terminal_cursor(10,4);
+			if (manual_mode)
+			{
+				// If manual mode is on, update the display
+				printf_P(PSTR("MANUAL MODE ACTIVE"));
+			}
+			else
+			{
+				// If manual mode is off, update the display
+				printf_P(PSTR("                   "));
+			}
+			break;
+		case INPUT_STEP:
+			// In manual mode the notes can be advanced no faster than
+			// they would be normally
+			if (manual_mode && current_time >= tempo_next_step())
+			{
+				advance_beat();
+				tempo_restart(current_time + tempo_step_ms());
+			}
+			break;
+	}
+}
+
+// Input (see replay.h) for each serial input character during a game.
+// Characters not listed (and anything past the end of the table) are
+// ignored.
+static const int8_t keymap[128] PROGMEM = {
+	[0 ... 127] = NO_INPUT,
+	// Lanes from the lowest note (right lane) to the highest (left lane)
+	['f'] = INPUT_LANE0, ['F'] = INPUT_LANE0,
+	['d'] = INPUT_LANE1, ['D'] = INPUT_LANE1,
+	['s'] = INPUT_LANE2, ['S'] = INPUT_LANE2,
+	['a'] = INPUT_LANE3, ['A'] = INPUT_LANE3,
+	['m'] = INPUT_MANUAL_TOGGLE, ['M'] = INPUT_MANUAL_TOGGLE,
+	['n'] = INPUT_STEP, ['N'] = INPUT_STEP,
+};
+
+// Convert a serial input character to an input (see replay.h)
+static int8_t serial_to_input(uint8_t serial_input)
+{
+	if (serial_input >= sizeof(keymap))
+	{
+		return NO_INPUT;
+	}
+	int8_t input = pgm_read_byte(&keymap[serial_input]);
+	if (input == INPUT_STEP && !manual_mode)
+	{
+		// Stepping only means something in manual mode
+		return NO_INPUT;
+	}
+	return input;
+}
+
+// Handle every input waiting to be dealt with - all the queued button
+// pushes and all the characters in the serial receive buffer - so that a
+// burst of input is never spread over several iterations of the game
+// loop (or lost when the queues overflow). The lanes played are merged and
+// judged as a single chord.
+static void handle_pending_inputs(uint32_t current_time)
+{
+	uint8_t lanes = 0;
+	int8_t btn;
+	int8_t input;
+	while ((btn = button_pushed()) != NO_BUTTON_PUSHED)
+	{
+		// Button n plays the note in lane n
+		handle_input(btn, current_time, &lanes);
+	}
+	// Autoplay's presses go the same way as the buttons'
+	while ((input = autoplay_next_input(current_time)) != NO_INPUT)
+	{
+		handle_input(input, current_time, &lanes);
+	}
+	while (serial_input_available())
+	{
+		char serial_input = fgetc(stdin);
+		if (shell_take_char(serial_input))
+		{
+			continue;
+		}
+		input = serial_to_input(serial_input);
+		if (input != NO_INPUT)
+		{
+			handle_input(input, current_time, &lanes);
+		}
+	}
+	if (lanes)
+	{
+		play_chord_at(lanes, judgement_steps(current_time));
+	}
+	ShellCommand command;
+	if (shell_command(&command))
+	{
+		run_command(&command);
+	}
+}
+
 void play_game(void)
 {
 	
-	uint32_t last_advance_time, current_time;
-	uint8_t btn; // The button pushed
+	uint32_t current_time;
 	
-	last_advance_time = get_current_time();
+	// Every game starts in normal mode (so that a replay starts from
+	// the same state as the recording)
+	manual_mode = false;
+	if (replay_mode)
+	{
+		replay_start();
+		input_offset = replay_input_offset();
+	}
+	else
+	{
+		input_offset = calibrate_offset();
+		replay_record_start(game_speed, selected_track(), input_offset);
+	}
+	tempo_start(selected_track(), game_speed);
+	in_game = true;
+	game_start_time = get_current_time();
+	if (linked_game)
+	{
+		// Every board starts at the time the leader chose. (If this board
+		// is late the notes catch up.)
+		game_start_time = link_start_time();
+		while (get_current_time() < game_start_time)
+		{
+			link_poll();
+		}
+	}
+	schedule_step();
+	flightrec_start(selected_track());
+	loopmon_start();
+	autoplay_start();
+	SIM_MARK(SIM_EVENT_GAME_START, 0);
 	
 	// We play the game until it's over
 	while (!is_game_over())
 	{
+		// Time the loop (and keep the watchdog from resetting the board)
+		loopmon_iteration();
+
 		// Update score on terminal
-		move_terminal_cursor(10,6);
-		printf_P(PSTR("Game Score: %3d"), score);
+		if (verbosity != VERBOSITY_QUIET)
+		{
+			move_terminal_cursor(10,6);
+			printf_P(PSTR("Game Score: %3d"), score);
+		}
 
+		// Decode the upcoming rows of the track while we have time
+		prefetch_rows();
 
-		// Check for button push
-		btn = button_pushed();
+		// Write the recording of this game to EEPROM as we go
+		replay_poll();
 
-		// Check for serial input
-		char serial_input = -1;
-		if (serial_input_available())
+		// Keep in touch with the other boards
+		if (linked_game)
 		{
-			serial_input = fgetc(stdin);
+			link_poll();
+			if (link_scores_changed())
+			{
+				show_link_scores();
+			}
 		}
 
-		// Play note based on input
-		if (btn == BUTTON0_PUSHED || serial_input == 'f' || serial_input == 'F')
-		{
-			// If button 0 or 'f'/'F' play the lowest note (right lane)
-			play_note(0);
-		}
-		if (btn == BUTTON1_PUSHED || serial_input == 'd' || serial_input == 'D')
+		// Game time is measured from the start of play. When replaying
+		// we use a virtual clock instead so that every recorded input is
+		// handled at exactly the same game time as it was recorded.
+		current_time = get_current_time() - game_start_time;
+		if (replay_mode)
 		{
-			// If button 1 or 'd'/'D' play the second lowest note (second from right lane)
-			play_note(1);
+			current_time = replay_clock(current_time,
+					manual_mode ? UINT32_MAX : tempo_next_step());
 		}
-		if (btn == BUTTON2_PUSHED || serial_input == 's' || serial_input == 'S')
-		{
-			// If button 2 or 's'/'S' play the second highest note (second from left lane)
-			play_note(2);
-		}
-		if (btn == BUTTON3_PUSHED || serial_input == 'a' || serial_input == 'A')
+
+		// Advance the notes when each step is due (see tempo.h). When
+		// playing, timer 1 posts the step at its time and it is taken
+		// here - if this loop has fallen behind the notes catch up
+		// rather than the rest of the song drifting. A replay steps when
+		// the virtual clock reaches each step's time.
+		while (!manual_mode && !is_game_over() && (replay_mode
+				? current_time >= tempo_next_step() : timer1_take_step()))
 		{
-			// If button 3 or 'a'/'A' play the highest note (left lane)
-			play_note(3);
+			if (!replay_mode)
+			{
+				int32_t lateness = get_current_time() - game_start_time
+						- tempo_next_step();
+				if (loopmon_step(lateness))
+				{
+					uint8_t late_ms = lateness > UINT8_MAX ? UINT8_MAX
+							: lateness;
+					flightrec_log(FLIGHT_LATE, late_ms);
+					SIM_MARK(SIM_EVENT_LATE_STEP, late_ms);
+					if (verbosity == VERBOSITY_CHATTY)
+					{
+						move_terminal_cursor(10, SHELL_ROW + 2);
+						printf_P(PSTR("Beat %lu was %ld ms late   "),
+								beat + 1, lateness);
+					}
+				}
+			}
+			advance_beat();
+			schedule_step();
 		}
 
-		// Check for serial manual mode input
-		if (serial_input == 'm' || serial_input == 'M')
+		if (replay_mode)
 		{
-			// If 'm'/'M' is pressed, toggle manual mode
-			manual_mode = !manual_mode;
-			if (manual_mode)
+			// Feed in the recorded inputs that are now due. Those
+			// recorded together are played together, as they were live.
+			uint8_t lanes = 0;
+			int8_t input;
+			while ((input = replay_next_input(current_time)) != NO_INPUT)
 			{
-				// If manual mode is on, update the display
-				move_terminal_cursor(10,4);
-				printf_P(PSTR("MANUAL MODE ACTIVE"));
+				handle_input(input, current_time, &lanes);
 			}
-			else
+			if (lanes)
 			{
-				// If manual mode is off, update the display
-				move_terminal_cursor(10,4);
-				printf_P(PSTR("                   "));
+				play_chord_at(lanes, judgement_steps(current_time));
 			}
+			continue;
 		}
-		
-		current_time = get_current_time();
-		if (current_time >= last_advance_time + game_speed/5 && 
-		(!manual_mode || (manual_mode && (serial_input == 'n' || serial_input == 'N'))))
-		{
-			// 200ms (0.2 second) has passed since the last time we advance the
-			// notes here, so update the advance the notes
-			advance_note();
-			
-			// Update the most recent time the notes were advance
-			last_advance_time = current_time;
-		}
+
+		handle_pending_inputs(current_time);
 	}
 	// We get here if the game is over.
+	timer1_cancel_step();
+	flightrec_stop();
+	loopmon_stop();
+	in_game = false;
+	if (linked_game)
+	{
+		link_end();
+	}
+	replay_record_finish();
 }
 
 void handle_game_over(void)
 {
+	SIM_MARK(SIM_EVENT_GAME_OVER, 0);
 	move_terminal_cursor(10,14);
-	printf_P(PSTR("GAME OVER"));
+	printf_P(PSTR("GAME OVER (%u notes missed)"), notes_missed);
+
+	// Let the player know if the game loop couldn't keep up with the
+	// steps timer 1 posted
+	if (loopmon_late_steps())
+	{
+		move_terminal_cursor(10,13);
+		printf_P(PSTR("(The notes were up to %u ms late)"),
+				loopmon_worst_lateness());
+	}
+
+	// Save a new high score (in the background). Replays don't count.
+	int16_t high_score = eestore_read(EESTORE_KEY_HIGH_SCORE, 0);
+	if (!replay_mode && (int16_t)score > high_score)
+	{
+		printf_P(PSTR(" - NEW HIGH SCORE!"));
+		if (!eestore_write_wait(EESTORE_KEY_HIGH_SCORE, score))
+		{
+			printf_P(PSTR(" (couldn't be saved)"));
+		}
+	}
 	move_terminal_cursor(10,15);
 	printf_P(PSTR("Press a button or 's'/'S' to start a new game"));
+	move_terminal_cursor(10,16);
+	printf_P(PSTR("'d' dumps the recording of this game"));
+	if (!replay_available())
+	{
+		move_terminal_cursor(10,17);
+		printf_P(PSTR("(This game can't be replayed)"));
+	}
+	move_terminal_cursor(10,18);
+	printf_P(PSTR("'f' dumps the flight recorder"));
+
+	// If the notes stuttered, show what was going on at the time
+	if (loopmon_late_steps() && verbosity != VERBOSITY_QUIET)
+	{
+		flightrec_dump();
+	}
 	
-	// Do nothing until a button or 's'/'S' is pushed.
+	// Do nothing until a button or 's'/'S' is pushed (or, for a linked
+	// board, the leader starts another game)
+	linked_game = false;
 	while(1)
 	{
-		// Check for serial input
-		char serial_input = -1;
-		if (serial_input_available())
+		link_poll();
+		if (take_link_start())
 		{
-			serial_input = fgetc(stdin);
+			break;
 		}
+
+		// Check for serial input (that isn't part of a command)
+		char serial_input = read_serial_key();
 		// If the serial input is 's', then exit the end screen
 		if (serial_input == 's' || serial_input == 'S')
 		{
 			break;
 		}
+		// Dump the recording over serial
+		if (serial_input == 'd' || serial_input == 'D')
+		{
+			replay_dump();
+		}
+		if (serial_input == 'f' || serial_input == 'F')
+		{
+			flightrec_dump();
+		}
 		// Next check for any button presses
 		int8_t btn = button_pushed();
 		if (btn != NO_BUTTON_PUSHED)
@@ -0,0 +1,387 @@
+/*
+ * replay.c
+ *
+ * Author: Michael Blauberg
+ *
+ * Deterministic input recording and replay. See replay.h.
+ *
+ * Each event is stored in a 16 bit word. A chord (the notes played at one
+ * game time) has the top bit set, the lanes played in the next 4 bits and
+ * the number of milliseconds since the previous event in the bottom 11
+ * bits. Any other input has its type in the top 3 bits and the number of
+ * milliseconds since the previous event in the bottom 13 bits. Gaps
+ * longer than an event can hold (about 2 seconds before a chord) are
+ * split up with wait words that carry no input.
+ *
+ * A whole game doesn't fit in RAM (a stress chart has 200 chords), so the
+ * events are queued in RAM and written to EEPROM as the game is played, a
+ * byte at a time whenever the EEPROM is free. The header is only marked
+ * valid once the game is over and all of its events have been written.
+ */
+
+#include "replay.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include "eestore.h"
+
+// Enough for the longest shipped song (a stress chart, 200 chords) played
+// perfectly, with some to spare for split chords and wait words
+#define REPLAY_MAX_EVENTS 240
+
+// Number of events that can be waiting to be written to EEPROM. (Each
+// takes about 7ms to write, so this covers a burst of quick chords.)
+#define QUEUE_SIZE 32
+
+#define EVENT_CHORD			0x8000
+#define CHORD_LANES_SHIFT	11
+#define CHORD_LANES_MASK	0x0F
+#define CHORD_DELTA_MASK	0x07FF
+#define EVENT_TYPE_SHIFT	13
+#define EVENT_DELTA_MASK	0x1FFF
+#define EVENT_MANUAL_TOGGLE	0
+#define EVENT_STEP			1
+#define EVENT_WAIT			3
+
+// Marks a recording in EEPROM as holding valid data. (Changed whenever
+// the layout of the recording, or the way the game acts on the recorded
+// inputs, changes.)
+#define RECORDING_VALID 0xAA
+
+typedef struct
+{
+	uint8_t valid;
+	uint16_t game_speed;
+	uint8_t track;
+	int16_t input_offset;
+	uint8_t num_events;
+} RecordingHeader;
+
+// RAM copy of the header of the recording in EEPROM (or being recorded)
+static RecordingHeader header;
+static RecordingHeader saved_header EEMEM;
+static uint16_t saved_events[REPLAY_MAX_EVENTS] EEMEM;
+
+// Set while a game is being recorded, and if it had more events than
+// could be kept
+static uint8_t recording;
+static uint8_t truncated;
+
+// Events waiting to be written to EEPROM (the oldest at queue_remove_pos)
+// and the byte of the oldest one to write next
+static uint16_t queue[QUEUE_SIZE];
+static uint8_t queue_remove_pos;
+static uint8_t events_in_queue;
+static uint8_t byte_pos;
+
+// Lanes of the chord being recorded (not yet added as an event) and the
+// game time it was played at
+static uint8_t chord_lanes;
+static uint32_t chord_time;
+
+// Game time of the last event recorded (or decoded when replaying)
+static uint32_t last_time;
+
+// Replay position, the next input to be replayed and when it is due, and
+// the lanes of its chord still to be replayed after it
+static uint8_t next_event;
+static int8_t pending_input;
+static uint8_t pending_lanes;
+static uint32_t pending_time;
+static uint32_t virtual_time;
+
+void replay_init(void)
+{
+	eeprom_read_block(&header, &saved_header, sizeof(header));
+	if (header.valid != RECORDING_VALID
+			|| header.num_events > REPLAY_MAX_EVENTS)
+	{
+		header.valid = 0;
+		header.num_events = 0;
+	}
+}
+
+// Read a recorded event from EEPROM. Interrupts are held off so that
+// eestore's interrupt handler can't start a write part way through.
+static uint16_t read_event(uint8_t i)
+{
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t event = eeprom_read_word(&saved_events[i]);
+	SREG = sreg;
+	return event;
+}
+
+void replay_record_start(uint16_t game_speed, uint8_t track,
+		int16_t input_offset)
+{
+	header.valid = 0;
+	header.game_speed = game_speed;
+	header.track = track;
+	header.input_offset = input_offset;
+	header.num_events = 0;
+	recording = 1;
+	truncated = 0;
+	queue_remove_pos = 0;
+	events_in_queue = 0;
+	byte_pos = 0;
+	chord_lanes = 0;
+	last_time = 0;
+
+	// The saved recording is overwritten as this game is played, so stop
+	// it being replayed (even if the board is reset part way through)
+	eestore_lock();
+	eeprom_update_byte(&saved_header.valid, 0);
+	eestore_unlock();
+}
+
+static uint8_t add_event(uint16_t event)
+{
+	if (truncated || header.num_events >= REPLAY_MAX_EVENTS
+			|| events_in_queue >= QUEUE_SIZE)
+	{
+		truncated = 1;
+		return 0;
+	}
+	queue[(queue_remove_pos + events_in_queue) % QUEUE_SIZE] = event;
+	events_in_queue++;
+	header.num_events++;
+	return 1;
+}
+
+// Add an event (with no delta yet) for an input at the given game time,
+// splitting up a gap longer than max_delta with wait events
+static void add_timed_event(uint16_t event, uint16_t max_delta,
+		uint32_t game_time)
+{
+	uint32_t delta = game_time - last_time;
+	while (delta > max_delta)
+	{
+		uint16_t wait = delta > EVENT_DELTA_MASK ? EVENT_DELTA_MASK : delta;
+		if (!add_event(((uint16_t)EVENT_WAIT << EVENT_TYPE_SHIFT) | wait))
+		{
+			return;
+		}
+		delta -= wait;
+		last_time += wait;
+	}
+	if (add_event(event | delta))
+	{
+		last_time = game_time;
+	}
+}
+
+// Add the chord being recorded (if there is one) as an event
+static void add_chord(void)
+{
+	if (chord_lanes)
+	{
+		add_timed_event(EVENT_CHORD
+				| ((uint16_t)chord_lanes << CHORD_LANES_SHIFT),
+				CHORD_DELTA_MASK, chord_time);
+		chord_lanes = 0;
+	}
+}
+
+void replay_record_input(uint8_t input, uint32_t game_time)
+{
+	if (!recording)
+	{
+		return;
+	}
+	if (input <= INPUT_LANE3)
+	{
+		// Notes played at the same time go in the same chord
+		if (chord_lanes && game_time != chord_time)
+		{
+			add_chord();
+		}
+		chord_lanes |= 1 << input;
+		chord_time = game_time;
+		return;
+	}
+	add_chord();
+	add_timed_event((uint16_t)(input == INPUT_STEP
+			? EVENT_STEP : EVENT_MANUAL_TOGGLE) << EVENT_TYPE_SHIFT,
+			EVENT_DELTA_MASK, game_time);
+}
+
+void replay_poll(void)
+{
+	// Settings waiting to be saved by eestore go first. (Its interrupt
+	// handler only uses the EEPROM while it has records queued.)
+	if (events_in_queue == 0 || eestore_busy() || !eeprom_is_ready())
+	{
+		return;
+	}
+	uint16_t event = queue[queue_remove_pos];
+	uint8_t* address = (uint8_t*)&saved_events[header.num_events
+			- events_in_queue] + byte_pos;
+	eeprom_update_byte(address, byte_pos ? event >> 8 : event & 0xFF);
+	if (++byte_pos == sizeof(event))
+	{
+		byte_pos = 0;
+		queue_remove_pos = (queue_remove_pos + 1) % QUEUE_SIZE;
+		events_in_queue--;
+	}
+}
+
+void replay_record_finish(void)
+{
+	if (!recording)
+	{
+		return;
+	}
+	add_chord();
+	recording = 0;
+	while (events_in_queue)
+	{
+		replay_poll();
+	}
+	if (!truncated)
+	{
+		// A truncated recording would replay to a different score
+		header.valid = RECORDING_VALID;
+		eestore_lock();
+		eeprom_update_block(&header, &saved_header, sizeof(header));
+		eestore_unlock();
+	}
+}
+
+void replay_record_discard(void)
+{
+	recording = 0;
+	events_in_queue = 0;
+	chord_lanes = 0;
+	header.valid = 0;
+	header.num_events = 0;
+}
+
+uint8_t replay_available(void)
+{
+	return header.valid == RECORDING_VALID;
+}
+
+uint16_t replay_game_speed(void)
+{
+	return header.game_speed;
+}
+
+uint8_t replay_track(void)
+{
+	return header.track;
+}
+
+int16_t replay_input_offset(void)
+{
+	return header.input_offset;
+}
+
+uint8_t replay_num_inputs(void)
+{
+	return header.num_events;
+}
+
+// Move on to the next input to be replayed: the next lane of the chord
+// being replayed, or else the next event (skipping over any wait words)
+static void decode_next_input(void)
+{
+	while (!pending_lanes)
+	{
+		if (next_event >= header.num_events)
+		{
+			pending_input = NO_INPUT;
+			pending_time = UINT32_MAX;
+			return;
+		}
+		uint16_t event = read_event(next_event++);
+		if (event & EVENT_CHORD)
+		{
+			last_time += event & CHORD_DELTA_MASK;
+			pending_lanes = (event >> CHORD_LANES_SHIFT) & CHORD_LANES_MASK;
+			continue;
+		}
+		uint8_t type = event >> EVENT_TYPE_SHIFT;
+		last_time += event & EVENT_DELTA_MASK;
+		if (type != EVENT_WAIT)
+		{
+			pending_input = type == EVENT_STEP
+					? INPUT_STEP : INPUT_MANUAL_TOGGLE;
+			pending_time = last_time;
+			return;
+		}
+	}
+	pending_input = INPUT_LANE0;
+	while (!(pending_lanes & (1 << pending_input)))
+	{
+		pending_input++;
+	}
+	pending_lanes &= ~(1 << pending_input);
+	pending_time = last_time;
+}
+
+void replay_start(void)
+{
+	next_event = 0;
+	last_time = 0;
+	virtual_time = 0;
+	pending_lanes = 0;
+	decode_next_input();
+}
+
+uint32_t replay_clock(uint32_t real_time, uint32_t next_deadline)
+{
+	uint32_t target = real_time;
+	if (next_deadline < target)
+	{
+		target = next_deadline;
+	}
+	if (pending_time < target)
+	{
+		target = pending_time;
+	}
+	if (target > virtual_time)
+	{
+		virtual_time = target;
+	}
+	return virtual_time;
+}
+
+int8_t replay_next_input(uint32_t game_time)
+{
+	if (pending_input == NO_INPUT || pending_time > game_time)
+	{
+		return NO_INPUT;
+	}
+	int8_t input = pending_input;
+	decode_next_input();
+	return input;
+}
+
+void replay_dump(void)
+{
+	printf_P(PSTR("\nRecording: speed %u, track %u, offset %d/16 ms, %u words%S\n"),
+			header.game_speed, header.track, header.input_offset,
+			header.num_events,
+			truncated ? PSTR(" (truncated)") : PSTR(""));
+	for (uint8_t i = 0; i < header.num_events; i++)
+	{
+		printf_P(PSTR("%04X%c"), read_event(i),
+				(i % 8 == 7) ? '\n' : ' ');
+	}
+	printf_P(PSTR("\n"));
+}
+
+uint16_t replay_ram_usage(void)
+{
+	return sizeof(header) + sizeof(recording) + sizeof(truncated)
+			+ sizeof(queue) + sizeof(queue_remove_pos)
+			+ sizeof(events_in_queue) + sizeof(byte_pos)
+			+ sizeof(chord_lanes) + sizeof(chord_time) + sizeof(last_time)
+			+ sizeof(next_event) + sizeof(pending_input)
+			+ sizeof(pending_lanes) + sizeof(pending_time)
+			+ sizeof(virtual_time);
+}
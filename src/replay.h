@@ -0,0 +1,98 @@
+/*
+ * replay.h
+ *
+ * Author: Michael Blauberg
+ *
+ * Deterministic input recording and replay. Every input the game acts on
+ * (notes played from the buttons or serial port, manual mode toggles and
+ * manual steps) is recorded along with the game time (milliseconds since
+ * play started) at which it was handled. The recording is written to
+ * EEPROM as the game is played (replacing the previous one, which can't
+ * be replayed once the new game has started) and can be dumped over the
+ * serial port.
+ *
+ * When replaying, the game runs against a virtual clock that only moves
+ * forward to the next recorded input or beat deadline, so every input is
+ * handled at exactly the same point in the song as when it was recorded.
+ * Notes recorded at the same game time are played together as a chord,
+ * just as they were when they were recorded.
+ */
+
+#ifndef REPLAY_H_
+#define REPLAY_H_
+
+#include <stdint.h>
+
+// Inputs that can be recorded
+#define INPUT_LANE0				0	// play a note in lanes 0 to 3
+#define INPUT_LANE1				1
+#define INPUT_LANE2				2
+#define INPUT_LANE3				3
+#define INPUT_MANUAL_TOGGLE		4	// turn manual mode on or off
+#define INPUT_STEP				5	// advance the notes in manual mode
+#define NO_INPUT				(-1)
+
+// Load any recording saved in EEPROM. Called once at start up.
+void replay_init(void);
+
+// Start recording a new game played at the given speed on the given track,
+// with presses judged with the given offset (see calibrate.h). (The
+// previous recording is discarded.)
+void replay_record_start(uint16_t game_speed, uint8_t track,
+		int16_t input_offset);
+
+// Record an input handled at the given game time. Times must not go
+// backwards. If the recording is full (or the inputs come faster than
+// the EEPROM can be written) the input is dropped and the recording is
+// marked as truncated (and can no longer be replayed).
+void replay_record_input(uint8_t input, uint32_t game_time);
+
+// Write the next byte of the recording to EEPROM if the EEPROM is free.
+// Called from the game loop while a game is being recorded.
+void replay_poll(void);
+
+// The game being recorded is over. Wait for the rest of the recording to
+// be written (up to a quarter of a second) and, if it isn't truncated,
+// mark it as one that can be replayed.
+void replay_record_finish(void);
+
+// The game being recorded can't be replayed the same (e.g. its tempo has
+// been changed), so drop its recording.
+void replay_record_discard(void);
+
+// Returns non-zero if there is a recording that can be replayed.
+uint8_t replay_available(void);
+
+// Game speed the current recording was made at.
+uint16_t replay_game_speed(void);
+
+// Track the current recording was made on.
+uint8_t replay_track(void);
+
+// Input offset the current recording was judged with.
+int16_t replay_input_offset(void);
+
+// Number of events (a chord counts as one) in the current recording.
+uint8_t replay_num_inputs(void);
+
+// Start replaying the current recording from the beginning.
+void replay_start(void);
+
+// Work out the virtual game time for this iteration of the game loop.
+// real_time is the time since play started and next_deadline is the game
+// time of the next beat (or UINT32_MAX if there is none). The virtual time
+// never passes the next recorded input or deadline, so they are each
+// handled at exactly their own time.
+uint32_t replay_clock(uint32_t real_time, uint32_t next_deadline);
+
+// Return the next recorded input due at (or before) the given game time,
+// or NO_INPUT if none are due.
+int8_t replay_next_input(uint32_t game_time);
+
+// Print the current recording to the serial port in hex.
+void replay_dump(void);
+
+// Returns the number of bytes of static RAM used by this module
+uint16_t replay_ram_usage(void);
+
+#endif /* REPLAY_H_ */
@@ -25,6 +25,9 @@
 #include <stdint.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include "upload.h"
+#include "frameserver.h"
+#include "flightrec.h"
 
 /* System clock rate in Hz. (L at the end indicates this is a long constant) */
 #define SYSCLK 8000000L
@@ -55,6 +58,12 @@ volatile uint8_t input_insert_pos;
 volatile uint8_t bytes_in_input_buffer;
 volatile uint8_t input_overrun;
 
+/* Counts of characters that have been thrown away - output that didn't
+ * fit in the buffer and input that was lost
+ */
+static volatile uint16_t output_dropped;
+static volatile uint16_t input_lost;
+
 /* Variable to keep track of whether incoming characters are to be echoed
  * back or not.
  */
@@ -83,6 +92,8 @@ void init_serial_stdio(long baudrate, int8_t echo)
 	input_insert_pos = 0;
 	bytes_in_input_buffer = 0;
 	input_overrun = 0;
+	output_dropped = 0;
+	input_lost = 0;
 	
 	/*
 	 * Record whether we're going to echo characters or not
@@ -131,6 +142,40 @@ void clear_serial_input_buffer(void)
 	bytes_in_input_buffer = 0;
 }
 
+uint16_t serialio_ram_usage(void)
+{
+	return sizeof(out_buffer) + sizeof(out_insert_pos)
+			+ sizeof(bytes_in_out_buffer) + sizeof(input_buffer)
+			+ sizeof(input_insert_pos) + sizeof(bytes_in_input_buffer)
+			+ sizeof(input_overrun) + sizeof(output_dropped)
+			+ sizeof(input_lost) + sizeof(do_echo) + sizeof(myStream);
+}
+
+/* Read a count that the interrupt handlers update with interrupts off (so
+ * it isn't changed part way through)
+ */
+static uint16_t read_count(volatile uint16_t* count)
+{
+	uint8_t interrupts_enabled = bit_is_set(SREG, SREG_I);
+	cli();
+	uint16_t value = *count;
+	if (interrupts_enabled)
+	{
+		sei();
+	}
+	return value;
+}
+
+uint16_t serial_output_dropped(void)
+{
+	return read_count(&output_dropped);
+}
+
+uint16_t serial_input_lost(void)
+{
+	return read_count(&input_lost);
+}
+
 static int uart_put_char(char c, FILE* stream)
 {
 	uint8_t interrupts_enabled;
@@ -153,10 +198,15 @@ static int uart_put_char(char c, FILE* stream)
 	 * ISR which extracts bytes from the buffer.
 	*/
 	interrupts_enabled = bit_is_set(SREG, SREG_I);
+	if (interrupts_enabled && bytes_in_out_buffer >= OUTPUT_BUFFER_SIZE)
+	{
+		flightrec_log(FLIGHT_UART_STALL, 0);
+	}
 	while (bytes_in_out_buffer >= OUTPUT_BUFFER_SIZE)
 	{
 		if (!interrupts_enabled)
 		{
+			output_dropped++;
 			return 1;
 		}		
 		/* else do nothing */
@@ -279,9 +329,25 @@ ISR(USART0_UDRE_vect)
 
 ISR(USART0_RX_vect) 
 {
-	/* Read the character - we ignore the possibility of overrun. */
+	/* Read the character. An overrun (a character arriving before the
+	 * one before was read) is only noted in the flight recorder.
+	 */
 	char c;
+	if (UCSR0A & (1 << DOR0))
+	{
+		input_lost++;
+		flightrec_log(FLIGHT_RX_OVERRUN, 0);
+	}
 	c = UDR0;
+	
+	/* Song upload frames and display server packets are dealt with
+	 * separately (see upload.h and frameserver.h) and never reach the
+	 * input buffer.
+	 */
+	if (upload_rx_byte(c) || frameserver_rx_byte(c))
+	{
+		return;
+	}
 		
 	if (do_echo && bytes_in_out_buffer < OUTPUT_BUFFER_SIZE)
 	{
@@ -292,6 +358,10 @@ ISR(USART0_RX_vect)
 		 */
 		uart_put_char(c, 0);
 	}
+	else if (do_echo)
+	{
+		output_dropped++;
+	}
 	
 	/* 
 	 * Check if we have space in our buffer. If not, set the overrun
@@ -302,6 +372,8 @@ ISR(USART0_RX_vect)
 	if (bytes_in_input_buffer >= INPUT_BUFFER_SIZE)
 	{
 		input_overrun = 1;
+		input_lost++;
+		flightrec_log(FLIGHT_RX_OVERRUN, 0);
 	} else
 	{
 		/* If the character is a carriage return, turn it into a
@@ -36,5 +36,18 @@ int8_t serial_input_available(void);
  */
 void clear_serial_input_buffer(void);
 
+/* Return the number of characters thrown away since the serial port was
+ * set up: output that didn't fit in the buffer when it couldn't wait, and
+ * input that arrived when there was no room for it (or before the
+ * previous character was read).
+ */
+uint16_t serial_output_dropped(void);
+uint16_t serial_input_lost(void);
+
+/* Return the number of bytes of static RAM used by this module (mostly the
+ * input and output buffers).
+ */
+uint16_t serialio_ram_usage(void);
+
 
 #endif /* SERIALIO_H_ */
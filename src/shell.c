@@ -0,0 +1,180 @@
+/*
+ * shell.c
+ *
+ * Author: Michael Blauberg
+ *
+ * Serial command shell. See shell.h.
+ */
+
+#include "shell.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+#include "terminalio.h"
+
+#define PROMPT		':'
+#define BACKSPACE	'\b'
+#define DELETE		0x7F
+#define ESCAPE		0x1B
+
+#define MAX_LINE 20
+#define NOT_TYPING 0xFF
+
+// The line being typed (without the prompt), or NOT_TYPING
+static char line[MAX_LINE + 1];
+static uint8_t line_length = NOT_TYPING;
+static uint8_t line_complete;
+
+// Command words, in the order of the command numbers (see shell.h)
+static const char help_word[] PROGMEM = "help";
+static const char tempo_word[] PROGMEM = "tempo";
+static const char spi_word[] PROGMEM = "spi";
+static const char window_word[] PROGMEM = "window";
+static const char verbose_word[] PROGMEM = "verbose";
+static const char stats_word[] PROGMEM = "stats";
+static const char loops_word[] PROGMEM = "loops";
+static const char auto_word[] PROGMEM = "auto";
+static const char ram_word[] PROGMEM = "ram";
+
+static PGM_P const command_words[] PROGMEM = {
+	help_word, tempo_word, spi_word, window_word, verbose_word, stats_word,
+	loops_word, auto_word, ram_word
+};
+#define NUM_COMMANDS (sizeof(command_words) / sizeof(command_words[0]))
+
+static void show_line(void)
+{
+	move_terminal_cursor(10, SHELL_ROW);
+	clear_to_end_of_line();
+	if (line_length != NOT_TYPING)
+	{
+		printf_P(PSTR("%c%s"), PROMPT, line);
+	}
+}
+
+uint8_t shell_take_char(char c)
+{
+	if (line_complete)
+	{
+		// The last command hasn't been carried out yet
+		return 0;
+	}
+	if (line_length == NOT_TYPING)
+	{
+		if (c != PROMPT)
+		{
+			return 0;
+		}
+		line_length = 0;
+		line[0] = '\0';
+		show_line();
+		return 1;
+	}
+
+	if (c == '\r' || c == '\n')
+	{
+		line_complete = 1;
+	}
+	else if (c == ESCAPE)
+	{
+		line_length = NOT_TYPING;
+		show_line();
+	}
+	else if (c == BACKSPACE || c == DELETE)
+	{
+		if (line_length)
+		{
+			line[--line_length] = '\0';
+			show_line();
+		}
+	}
+	else if (c >= ' ' && line_length < MAX_LINE)
+	{
+		line[line_length++] = c;
+		line[line_length] = '\0';
+		putchar(c);
+	}
+	return 1;
+}
+
+// Read a number from *text (skipping spaces before it). Returns zero if
+// there isn't one or it's too big.
+static uint8_t read_number(char** text, uint16_t* number)
+{
+	char* c = *text;
+	while (*c == ' ')
+	{
+		c++;
+	}
+	if (*c < '0' || *c > '9')
+	{
+		return 0;
+	}
+	uint32_t value = 0;
+	while (*c >= '0' && *c <= '9')
+	{
+		value = value * 10 + *c++ - '0';
+		if (value > UINT16_MAX)
+		{
+			return 0;
+		}
+	}
+	*number = value;
+	*text = c;
+	return 1;
+}
+
+uint8_t shell_command(ShellCommand* command)
+{
+	if (!line_complete)
+	{
+		return 0;
+	}
+
+	// The command word
+	char* text = line;
+	while (*text == ' ')
+	{
+		text++;
+	}
+	uint8_t word_length = strcspn(text, " ");
+	command->command = SHELL_UNKNOWN;
+	for (uint8_t i = 0; i < NUM_COMMANDS; i++)
+	{
+		PGM_P word = (PGM_P)pgm_read_word(&command_words[i]);
+		if (word_length == strlen_P(word)
+				&& strncasecmp_P(text, word, word_length) == 0)
+		{
+			command->command = i;
+			break;
+		}
+	}
+	text += word_length;
+
+	// The numbers after it
+	command->num_args = 0;
+	while (*text)
+	{
+		if (command->num_args == SHELL_MAX_ARGS
+				|| !read_number(&text, &command->args[command->num_args]))
+		{
+			// Trailing spaces are fine
+			if (text[strspn(text, " ")] != '\0')
+			{
+				command->command = SHELL_BAD_ARGS;
+			}
+			break;
+		}
+		command->num_args++;
+	}
+
+	line_complete = 0;
+	line_length = NOT_TYPING;
+	return 1;
+}
+
+uint16_t shell_ram_usage(void)
+{
+	return sizeof(line) + sizeof(line_length) + sizeof(line_complete);
+}
@@ -0,0 +1,81 @@
+/*
+ * shell.h
+ *
+ * Author: Michael Blauberg
+ *
+ * Command shell on the serial port, for tuning the game while it runs. A
+ * command is typed as a line starting with ':' (which no single key
+ * command uses), e.g.
+ *
+ *     :tempo 150
+ *     :spi 64
+ *     :stats
+ *
+ * Characters are taken one at a time as the game reads them, so reading a
+ * command never holds anything up, and the keys typed are shown on the
+ * terminal on row SHELL_ROW. Backspace deletes and escape abandons the
+ * line. Once return is pressed the line is split into a command word and
+ * up to SHELL_MAX_ARGS numbers, and the command is handed back to be
+ * carried out (see shell_command()). The game answers on the row after.
+ *
+ * Commands (a command given without a value shows the current one):
+ *     help              list the commands
+ *     tempo [percent]   tempo as a percentage of the song's own (100 is
+ *                       normal speed, 200 fast, 400 extreme)
+ *     spi [divider]     LED matrix SPI clock divider (2 to 128)
+ *     window [columns]  how far from the middle of the scoring area a
+ *                       note can be hit
+ *     verbose [level]   0 (quiet) to 2 (chatty)
+ *     stats             show the counters
+ *     loops             show the game loop times of the last game and why
+ *                       the board was last reset (see loopmon.h)
+ *     auto [mode] [ms]  autoplay: 0 off, 1 perfect, 2 sloppy (up to ms
+ *                       early or late) or 3 random (see autoplay.h)
+ *     ram               show the stack high water mark and the static RAM
+ *                       of each subsystem against its budget (see
+ *                       stackmon.h)
+ */
+
+#ifndef SHELL_H_
+#define SHELL_H_
+
+#include <stdint.h>
+
+// Terminal row commands are typed on (answers go on the row after)
+#define SHELL_ROW 22
+
+#define SHELL_MAX_ARGS 2
+
+// Commands
+#define SHELL_HELP		0
+#define SHELL_TEMPO		1
+#define SHELL_SPI		2
+#define SHELL_WINDOW	3
+#define SHELL_VERBOSE	4
+#define SHELL_STATS		5
+#define SHELL_LOOPS		6
+#define SHELL_AUTO		7
+#define SHELL_RAM		8
+#define SHELL_UNKNOWN	0xFE	// the command word wasn't recognised
+#define SHELL_BAD_ARGS	0xFF	// the numbers given couldn't be read
+
+typedef struct
+{
+	uint8_t command;
+	uint8_t num_args;
+	uint16_t args[SHELL_MAX_ARGS];
+} ShellCommand;
+
+// Offer a character read from the serial port to the shell. Returns
+// non-zero if it was part of a command (in which case it must not be
+// treated as a key press).
+uint8_t shell_take_char(char c);
+
+// If a command has been completed, fills in *command and returns
+// non-zero. Each command is returned once.
+uint8_t shell_command(ShellCommand* command);
+
+// Returns the number of bytes of static RAM used by this module
+uint16_t shell_ram_usage(void);
+
+#endif /* SHELL_H_ */
@@ -0,0 +1,38 @@
+/*
+ * simmarker.h
+ *
+ * Author: Michael Blauberg
+ *
+ * Markers for the simulation harnesses in tools/simharness. When the
+ * firmware is built with SIM_HARNESS defined (see the simharness
+ * environment in platformio.ini) each marker writes its payload to GPIOR1
+ * and then the event code to GPIOR0. The harness watches for writes to
+ * GPIOR0 so it knows exactly where the game is up to. In normal builds
+ * the markers compile to nothing.
+ *
+ * This header is also included by the harness itself (without
+ * SIM_HARNESS defined) so the event codes are shared.
+ */
+
+#ifndef SIMMARKER_H_
+#define SIMMARKER_H_
+
+// Marker event codes (written to GPIOR0)
+#define SIM_EVENT_GAME_START	(0x01)	// play_game() has started (beat 0)
+#define SIM_EVENT_BEAT			(0x02)	// notes advanced, payload = beat (low byte)
+#define SIM_EVENT_GAME_OVER		(0x03)	// handle_game_over() has been entered
+#define SIM_EVENT_LATE_STEP		(0x04)	// a step was late, payload = ms (max 255)
+
+// Data space addresses of the registers used (for the harness)
+#define SIM_MARKER_EVENT_ADDR	(0x3E)	// GPIOR0
+#define SIM_MARKER_PAYLOAD_ADDR	(0x4A)	// GPIOR1
+
+#ifdef SIM_HARNESS
+#include <avr/io.h>
+#define SIM_MARK(event, payload) \
+		do { GPIOR1 = (uint8_t)(payload); GPIOR0 = (event); } while (0)
+#else
+#define SIM_MARK(event, payload) ((void)0)
+#endif
+
+#endif /* SIMMARKER_H_ */
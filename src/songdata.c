@@ -0,0 +1,89 @@
+/*
+ * songdata.c
+ *
+ * Generated by tools/chart_compiler.py from the charts in songs/ - don't edit.
+ */
+
+#include "songlib.h"
+#include <avr/pgmspace.h>
+
+// builtin.chart: 129 rows in 79 bytes
+static const uint8_t song_0[] PROGMEM = {
+	0x42, 0x82, 0x08, 0x40, 0x02, 0x04, 0x02, 0x04,
+	0x40, 0x00, 0x08, 0x42, 0xC4, 0x08, 0x00, 0x04,
+	0x40, 0x00, 0x02, 0x40, 0x00, 0x01, 0x45, 0x00,
+	0x02, 0x40, 0x00, 0x04, 0x40, 0x00, 0x08, 0x40,
+	0x00, 0x04, 0x40, 0xC4, 0x0C, 0x00, 0x04, 0x41,
+	0xC4, 0x11, 0xCA, 0x1C, 0x43, 0xC7, 0x2C, 0x01,
+	0x02, 0x08, 0x41, 0x01, 0x02, 0x01, 0xC4, 0x1C,
+	0xC4, 0x27, 0x00, 0x02, 0x42, 0xC4, 0x26, 0x00,
+	0x04, 0x41, 0xC4, 0x2B, 0x00, 0x04, 0x41, 0xC4,
+	0x30, 0x00, 0x04, 0x41, 0xC8, 0x3B, 0x40,
+};
+static const char name_0[] PROGMEM = "Built-in";
+
+// staircase.chart: 104 rows in 51 bytes
+static const uint8_t song_1[] PROGMEM = {
+	0x43, 0x02, 0x01, 0x02, 0x04, 0x81, 0x08, 0x02,
+	0x04, 0x02, 0x01, 0x41, 0x02, 0x01, 0x02, 0x04,
+	0x82, 0x08, 0x41, 0xD1, 0x12, 0xD1, 0x14, 0xD1,
+	0x16, 0x00, 0x01, 0x40, 0x00, 0x02, 0x40, 0x00,
+	0x04, 0x40, 0x00, 0x08, 0x40, 0xC7, 0x0C, 0x00,
+	0x09, 0x40, 0x00, 0x06, 0x40, 0x00, 0x09, 0x40,
+	0x00, 0x06, 0x44,
+};
+static const char name_1[] PROGMEM = "Staircase";
+
+// gallop.chart: 173 rows in 51 bytes
+static const uint8_t song_2[] PROGMEM = {
+	0x43, 0x00, 0x01, 0x40, 0x81, 0x01, 0x40, 0x81,
+	0x01, 0x40, 0x00, 0x02, 0x40, 0x81, 0x02, 0x40,
+	0x81, 0x02, 0x40, 0x00, 0x04, 0x40, 0x81, 0x04,
+	0x40, 0x81, 0x04, 0x40, 0x00, 0x08, 0x40, 0x81,
+	0x08, 0x40, 0x81, 0x08, 0x40, 0xDF, 0x24, 0xDF,
+	0x26, 0xDF, 0x28, 0xDF, 0x2A, 0x00, 0x0F, 0x42,
+	0xC3, 0x03, 0x40,
+};
+static const char name_2[] PROGMEM = "Gallop";
+
+// chords.chart: 109 rows in 48 bytes
+static const uint8_t song_3[] PROGMEM = {
+	0x43, 0x00, 0x03, 0x40, 0x00, 0x0C, 0x40, 0x00,
+	0x05, 0x40, 0x00, 0x0A, 0x40, 0x81, 0x03, 0x81,
+	0x0C, 0x00, 0x06, 0x40, 0x00, 0x09, 0x40, 0x04,
+	0x01, 0x02, 0x04, 0x08, 0x0C, 0x40, 0x00, 0x03,
+	0x40, 0xD7, 0x20, 0xD7, 0x22, 0xD7, 0x24, 0x00,
+	0x0F, 0x40, 0x00, 0x0F, 0x40, 0x00, 0x0F, 0x43,
+};
+static const char name_3[] PROGMEM = "Chords";
+static const TempoChange tempo_3[] PROGMEM = {
+	{44, 800},
+	{68, 667},
+};
+
+// stress_lanes.chart: 200 rows in 8 bytes
+static const uint8_t song_4[] PROGMEM = {
+	0xBF, 0x0F, 0xFF, 0x02, 0xFF, 0x04, 0xC7, 0x06,
+};
+static const char name_4[] PROGMEM = "Stress Lanes";
+
+// stress_chords.chart: 200 rows in 49 bytes
+static const uint8_t song_5[] PROGMEM = {
+	0x09, 0x05, 0x0A, 0x05, 0x0A, 0x05, 0x0A, 0x05,
+	0x0A, 0x05, 0x0A, 0xC9, 0x0B, 0xC9, 0x0D, 0xC9,
+	0x0F, 0xC9, 0x11, 0xC9, 0x13, 0xC9, 0x15, 0xC9,
+	0x17, 0xC9, 0x19, 0xC9, 0x1B, 0xC9, 0x1D, 0xC9,
+	0x1F, 0xC9, 0x21, 0xC9, 0x23, 0xC9, 0x25, 0xC9,
+	0x27, 0xC9, 0x29, 0xC9, 0x2B, 0xC9, 0x2D, 0xC9,
+	0x2F,
+};
+static const char name_5[] PROGMEM = "Stress Chords";
+
+const SongInfo song_library[NUM_LIBRARY_SONGS] PROGMEM = {
+	{name_0, song_0, 129, 1000, NULL, 0},
+	{name_1, song_1, 104, 1000, NULL, 0},
+	{name_2, song_2, 173, 1000, NULL, 0},
+	{name_3, song_3, 109, 1000, tempo_3, 2},
+	{name_4, song_4, 200, 25, NULL, 0},
+	{name_5, song_5, 200, 25, NULL, 0},
+};
@@ -0,0 +1,12 @@
+/*
+ * songdata.h
+ *
+ * Generated by tools/chart_compiler.py from the charts in songs/ - don't edit.
+ */
+
+#ifndef SONGDATA_H_
+#define SONGDATA_H_
+
+#define NUM_LIBRARY_SONGS 6
+
+#endif /* SONGDATA_H_ */
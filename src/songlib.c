@@ -0,0 +1,120 @@
+/*
+ * songlib.c
+ *
+ * Author: Michael Blauberg
+ *
+ * Decoder for the songs in the song library. See songlib.h.
+ */
+
+#include "songlib.h"
+#include <stdint.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+
+#define TOKEN_MASK		0xC0
+#define COUNT_MASK		0x3F
+#define TOKEN_LITERAL	0x00
+#define TOKEN_REST		0x40
+#define TOKEN_RUN		0x80
+#define TOKEN_REPEAT	0xC0
+
+PGM_P songlib_name(uint8_t song)
+{
+	return (PGM_P)pgm_read_word(&song_library[song].name);
+}
+
+uint16_t songlib_rows(uint8_t song)
+{
+	return pgm_read_word(&song_library[song].rows);
+}
+
+uint16_t songlib_tempo(uint8_t song)
+{
+	return pgm_read_word(&song_library[song].row_ms);
+}
+
+uint8_t songlib_tempo_change(uint8_t song, uint8_t index,
+		TempoChange* change)
+{
+	if (index >= pgm_read_byte(&song_library[song].num_tempo_changes))
+	{
+		return 0;
+	}
+	const TempoChange* changes = (const TempoChange*)pgm_read_word(
+			&song_library[song].tempo_changes);
+	memcpy_P(change, &changes[index], sizeof(TempoChange));
+	return 1;
+}
+
+void songstream_open(SongStream* stream, uint8_t song)
+{
+	// (PROGMEM data is placed at the start of flash, so the library is
+	// always within reach of an ordinary pointer)
+	stream->next = (flash_address_t)pgm_read_word(&song_library[song].data);
+	stream->resume = 0;
+	stream->run = 0;
+	stream->repeat = 0;
+	stream->raw = 0;
+}
+
+void songstream_open_raw(SongStream* stream, flash_address_t address)
+{
+	stream->next = address;
+	stream->raw = 1;
+}
+
+// Read the token at the start of the stream
+static void start_token(SongStream* stream)
+{
+	uint8_t byte = flash_read_byte(stream->next++);
+	stream->token = byte & TOKEN_MASK;
+	stream->run = (byte & COUNT_MASK) + 1;
+	if (stream->token == TOKEN_RUN)
+	{
+		stream->value = flash_read_byte(stream->next++);
+	}
+}
+
+uint8_t songstream_next(SongStream* stream)
+{
+	if (stream->raw)
+	{
+		return flash_read_byte(stream->next++);
+	}
+	if (stream->resume && stream->repeat == 0)
+	{
+		// End of a repeat - carry on after it (part way through a token
+		// if that's where the repeat ended)
+		stream->next = stream->resume;
+		stream->resume = 0;
+		stream->run = 0;
+	}
+	if (stream->run == 0)
+	{
+		start_token(stream);
+		if (stream->token == TOKEN_REPEAT)
+		{
+			// Go back and decode the earlier rows again
+			flash_address_t token_address = stream->next - 1;
+			stream->repeat = stream->run;
+			stream->resume = stream->next + 1;
+			stream->next = token_address - flash_read_byte(stream->next);
+			start_token(stream);
+		}
+	}
+
+	stream->run--;
+	if (stream->resume)
+	{
+		stream->repeat--;
+	}
+	switch (stream->token)
+	{
+		case TOKEN_LITERAL:
+			return flash_read_byte(stream->next++);
+		case TOKEN_RUN:
+			return stream->value;
+		default:
+			return 0;
+	}
+}
@@ -0,0 +1,94 @@
+/*
+ * songlib.h
+ *
+ * Author: Michael Blauberg
+ *
+ * Library of songs kept compressed in flash. Each row of a song is a byte
+ * with a bit for each lane holding a note (as in game.c). A song is stored
+ * as a stream of tokens, each starting with a byte whose top two bits say
+ * what it is and whose low six bits are a count n (meaning n+1 rows):
+ *
+ *     00nnnnnn r0 r1 ... - n+1 rows given literally
+ *     01nnnnnn           - n+1 rests (empty rows)
+ *     10nnnnnn r         - n+1 copies of row r
+ *     11nnnnnn d         - repeat the next n+1 rows decoded from the token
+ *                          d bytes before this one (which must not run
+ *                          into another repeat)
+ *
+ * Songs are decoded a row at a time as they are played, so the whole
+ * song is never unpacked into RAM.
+ *
+ * A song has a tempo (the time each row takes at normal speed) and may
+ * change tempo at given rows - see tempo.h for how these are used.
+ *
+ * The songs themselves (songdata.c) are generated from the charts in songs/
+ * by tools/chart_compiler.py before each build.
+ */
+
+#ifndef SONGLIB_H_
+#define SONGLIB_H_
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "flash.h"
+#include "songdata.h"
+
+// A change of tempo part way through a song
+typedef struct
+{
+	uint16_t row;			// the first row at the new tempo
+	uint16_t row_ms;		// milliseconds per row at normal speed
+} TempoChange;
+
+// A song in the library
+typedef struct
+{
+	PGM_P name;
+	const uint8_t* data;	// the encoded rows
+	uint16_t rows;
+	uint16_t row_ms;		// milliseconds per row at normal speed
+	const TempoChange* tempo_changes;	// in order of row (in flash)
+	uint8_t num_tempo_changes;
+} SongInfo;
+
+extern const SongInfo song_library[NUM_LIBRARY_SONGS] PROGMEM;
+
+// State of a song being decoded
+typedef struct
+{
+	flash_address_t next;	// address of the next byte of the stream
+	flash_address_t resume;	// where to carry on after a repeat (0 if none)
+	uint8_t token;		// the token being decoded
+	uint8_t run;		// rows of the token still to come
+	uint8_t value;		// the row repeated by a 10 token
+	uint8_t repeat;		// rows of a repeat still to come
+	uint8_t raw;		// non-zero if the rows aren't encoded
+} SongStream;
+
+// Name of a song in the library (in flash)
+PGM_P songlib_name(uint8_t song);
+
+// Number of rows in a song in the library. Songs can be up to 65535 rows
+// long - only a few rows are decoded at a time however long the song is.
+uint16_t songlib_rows(uint8_t song);
+
+// Tempo of a song in the library, in milliseconds per row at normal speed
+uint16_t songlib_tempo(uint8_t song);
+
+// Get the index'th change of tempo in a song in the library. Returns zero
+// if the song doesn't have that many.
+uint8_t songlib_tempo_change(uint8_t song, uint8_t index,
+		TempoChange* change);
+
+// Start decoding a song in the library
+void songstream_open(SongStream* stream, uint8_t song);
+
+// Start reading a song which is just rows (one byte each) at the given
+// flash address, e.g. an uploaded song (see songslot.h)
+void songstream_open_raw(SongStream* stream, flash_address_t address);
+
+// Return the next row of the song. Must not be called for more rows than
+// the song has.
+uint8_t songstream_next(SongStream* stream);
+
+#endif /* SONGLIB_H_ */
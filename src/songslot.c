@@ -0,0 +1,104 @@
+/*
+ * songslot.c
+ *
+ * Author: Michael Blauberg
+ *
+ * Song slots in flash. See songslot.h.
+ */
+
+#include "songslot.h"
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/boot.h>
+#include "eestore.h"
+
+#define SONG_MAGIC_0 0x53	// 'S'
+#define SONG_MAGIC_1 0x47	// 'G'
+
+// The slots themselves. These start out erased (0xFF) and are rewritten
+// a page at a time. Aligning to a page means every slot starts a page.
+static const uint8_t song_slots[NUM_SONG_SLOTS][SONG_SLOT_SIZE] PROGMEM
+		__attribute__((aligned(SPM_PAGESIZE))) = {
+	[0 ... NUM_SONG_SLOTS - 1] = {[0 ... SONG_SLOT_SIZE - 1] = 0xFF}
+};
+
+uint8_t songslot_valid(uint8_t slot)
+{
+	return slot < NUM_SONG_SLOTS
+			&& flash_read_byte(songslot_address(slot)) == SONG_MAGIC_0
+			&& flash_read_byte(songslot_address(slot) + 1) == SONG_MAGIC_1
+			&& songslot_length(slot) <= SONG_MAX_LENGTH;
+}
+
+uint16_t songslot_length(uint8_t slot)
+{
+	if (slot >= NUM_SONG_SLOTS
+			|| flash_read_byte(songslot_address(slot)) != SONG_MAGIC_0)
+	{
+		return 0;
+	}
+	return flash_read_word(songslot_address(slot) + 2);
+}
+
+flash_address_t songslot_data_address(uint8_t slot)
+{
+	return songslot_address(slot) + SONG_HEADER_SIZE;
+}
+
+flash_address_t songslot_address(uint8_t slot)
+{
+	return FLASH_ADDRESS(song_slots) + (flash_address_t)slot * SONG_SLOT_SIZE;
+}
+
+void songslot_make_header(uint8_t* header, uint16_t length)
+{
+	header[0] = SONG_MAGIC_0;
+	header[1] = SONG_MAGIC_1;
+	header[2] = length & 0xFF;
+	header[3] = length >> 8;
+}
+
+// The SPM instruction only works from the boot loader section, so this
+// is placed there (the linker is told where with the build flags). It
+// must not call anything outside that section - everything it uses is
+// inline. Interrupts are off throughout because the interrupt vectors and
+// handlers are in the application section, which can't be read while it
+// is being written.
+BOOTLOADER_SECTION __attribute__((noinline))
+static void write_flash_page(flash_address_t address,
+		const uint8_t* data)
+{
+	uint8_t sreg = SREG;
+	cli();
+
+	boot_page_erase(address);
+	boot_spm_busy_wait();
+	for (uint16_t i = 0; i < SPM_PAGESIZE; i += 2)
+	{
+		uint16_t word = data[i] | ((uint16_t)data[i + 1] << 8);
+		boot_page_fill(address + i, word);
+	}
+	boot_page_write(address);
+	boot_spm_busy_wait();
+
+	// Allow the application section to be read again
+	boot_rww_enable();
+	SREG = sreg;
+}
+
+void songslot_write_page(flash_address_t address, const uint8_t* data)
+{
+	flash_address_t start = songslot_address(0);
+	if (address < start || address >= start + sizeof(song_slots)
+			|| (address % SPM_PAGESIZE) != 0)
+	{
+		// Not the start of a page in a song slot - never write it
+		return;
+	}
+	// A flash write can't start while the EEPROM is being written
+	eestore_lock();
+	write_flash_page(address, data);
+	eestore_unlock();
+}
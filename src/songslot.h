@@ -0,0 +1,47 @@
+/*
+ * songslot.h
+ *
+ * Author: Michael Blauberg
+ *
+ * Song slots in flash. A region of program memory is reserved for songs
+ * uploaded over the serial port (see upload.h) so they survive a reset.
+ * Each slot starts with a small header (a magic number and the length of
+ * the song data) which is only written once the whole song has arrived,
+ * so a slot with a partial upload is never played.
+ *
+ * Flash is written a page (SPM_PAGESIZE bytes) at a time by code in the
+ * boot loader section - see the build flags in platformio.ini.
+ */
+
+#ifndef SONGSLOT_H_
+#define SONGSLOT_H_
+
+#include <stdint.h>
+#include "flash.h"
+
+#define NUM_SONG_SLOTS		3
+#define SONG_SLOT_SIZE		2048
+#define SONG_HEADER_SIZE	4
+#define SONG_MAX_LENGTH		(SONG_SLOT_SIZE - SONG_HEADER_SIZE)
+
+// Returns non-zero if the slot holds a complete song
+uint8_t songslot_valid(uint8_t slot);
+
+// Length of the song data in the slot (0 if the slot isn't valid)
+uint16_t songslot_length(uint8_t slot);
+
+// Flash address of the song data in the slot
+flash_address_t songslot_data_address(uint8_t slot);
+
+// Flash address of the start of the slot (always the start of a page)
+flash_address_t songslot_address(uint8_t slot);
+
+// Build the header for a song of the given length
+void songslot_make_header(uint8_t* header, uint16_t length);
+
+// Erase and write one page of flash (SPM_PAGESIZE bytes from data). The
+// address must be the start of a page within a song slot. Interrupts are
+// turned off for the ~9ms this takes.
+void songslot_write_page(flash_address_t address, const uint8_t* data);
+
+#endif /* SONGSLOT_H_ */
@@ -0,0 +1,181 @@
+/*
+ * stackmon.c
+ *
+ * Author: Michael Blauberg
+ *
+ * Stack painting and static RAM budget reporting. See stackmon.h.
+ */
+
+#include "stackmon.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include "serialio.h"
+#include "buttons.h"
+#include "timer0.h"
+#include "timer1.h"
+#include "tempo.h"
+#include "game.h"
+#include "anim.h"
+#include "replay.h"
+#include "eestore.h"
+#include "upload.h"
+#include "link.h"
+#include "ledmatrix.h"
+#include "frameserver.h"
+#include "flightrec.h"
+#include "shell.h"
+#include "loopmon.h"
+#include "autoplay.h"
+#include "terminalio.h"
+
+// Value painted into unused RAM at reset. Anything other than this value
+// means the stack has been there.
+#define STACK_CANARY 0xC5
+
+// Symbols provided by the linker. _end is the first byte after all
+// static data (.data, .bss and .noinit) and __stack is the top of RAM
+// (where the stack starts).
+extern uint8_t __data_start;
+extern uint8_t _end;
+extern uint8_t __stack;
+
+// Paint the free RAM with the canary value. This is placed in the .init1
+// section so that it runs straight after reset, before the stack pointer
+// has been set up and before any C code has run. It must therefore be
+// written in assembly and must not use the stack (or r1, which is not
+// zeroed until .init2).
+void stackmon_paint(void) __attribute__((naked, used, section(".init1")));
+void stackmon_paint(void)
+{
+	__asm volatile (
+		"	ldi r30, lo8(_end)\n"
+		"	ldi r31, hi8(_end)\n"
+		"	ldi r24, %0\n"
+		"	ldi r25, hi8(__stack)\n"
+		"	rjmp 2f\n"
+		"1:	st Z+, r24\n"
+		"2:	cpi r30, lo8(__stack)\n"
+		"	cpc r31, r25\n"
+		"	brlo 1b\n"
+		"	breq 1b\n"
+		:
+		: "i" (STACK_CANARY)
+	);
+}
+
+// Static RAM budgets for each subsystem. Each subsystem reports how many
+// bytes of static RAM it owns; anything over its budget is flagged in
+// the report.
+//
+// The budgets come from a plan for the 2048 bytes of RAM (in the default
+// build, with one panel):
+//
+//     subsystems (the table below)   1408
+//     other static data                64   libc, stdio, project.c
+//     stack                           576   deepest seen (see :ram and the
+//                                           simulation harnesses) must fit
+//
+// Each budget is what the subsystem is designed to hold - the serial
+// buffers, 32 replay events waiting for the EEPROM, 48 flight records, a
+// flash page for uploads, two frame packets and so on - so any growth shows up as OVER. A bigger
+// budget has to be taken from another subsystem or the stack, and the
+// plan above changed to match.
+typedef struct
+{
+	const char* name;
+	uint16_t (*usage)(void);
+	uint16_t budget;
+} RamBudget;
+
+static const char serialio_name[] PROGMEM = "serialio";
+static const char buttons_name[] PROGMEM = "buttons";
+static const char timer0_name[] PROGMEM = "timer0";
+static const char timer1_name[] PROGMEM = "timer1";
+static const char game_name[] PROGMEM = "game";
+static const char tempo_name[] PROGMEM = "tempo";
+static const char anim_name[] PROGMEM = "anim";
+static const char replay_name[] PROGMEM = "replay";
+static const char eestore_name[] PROGMEM = "eestore";
+static const char upload_name[] PROGMEM = "upload";
+static const char link_name[] PROGMEM = "link";
+static const char ledmatrix_name[] PROGMEM = "ledmatrix";
+static const char frameserver_name[] PROGMEM = "framesrv";
+static const char flightrec_name[] PROGMEM = "flightrec";
+static const char shell_name[] PROGMEM = "shell";
+static const char loopmon_name[] PROGMEM = "loopmon";
+static const char autoplay_name[] PROGMEM = "autoplay";
+
+static const RamBudget ram_budgets[] PROGMEM = {
+	{serialio_name, serialio_ram_usage, 296},
+	{buttons_name, buttons_ram_usage, 8},
+	{timer0_name, timer0_ram_usage, 4},
+	{timer1_name, timer1_ram_usage, 8},
+	{game_name, game_ram_usage, 76},
+	{tempo_name, tempo_ram_usage, 28},
+	{anim_name, anim_ram_usage, 12},
+	{replay_name, replay_ram_usage, 100},
+	{eestore_name, eestore_ram_usage, 72},
+	{upload_name, upload_ram_usage, 184},
+	{link_name, link_ram_usage, 144},
+	{ledmatrix_name, ledmatrix_ram_usage, 8},
+	{frameserver_name, frameserver_ram_usage, 124},
+	{flightrec_name, flightrec_ram_usage, 244},
+	{shell_name, shell_ram_usage, 24},
+	{loopmon_name, loopmon_ram_usage, 52},
+	{autoplay_name, autoplay_ram_usage, 24},
+};
+#define NUM_RAM_BUDGETS (sizeof(ram_budgets) / sizeof(ram_budgets[0]))
+
+uint16_t stackmon_unused_bytes(void)
+{
+	// The stack grows down from __stack towards _end, so count the canary
+	// bytes that are still intact from the bottom of the free region.
+	const uint8_t* p = &_end;
+	uint16_t count = 0;
+	while (p <= &__stack && *p == STACK_CANARY)
+	{
+		p++;
+		count++;
+	}
+	return count;
+}
+
+uint16_t stackmon_stack_high_water(void)
+{
+	uint16_t free_region = (uint16_t)(&__stack - &_end) + 1;
+	return free_region - stackmon_unused_bytes();
+}
+
+uint16_t stackmon_static_bytes(void)
+{
+	return (uint16_t)(&_end - &__data_start);
+}
+
+void stackmon_report(int8_t row)
+{
+	uint16_t total_static = stackmon_static_bytes();
+	uint16_t attributed = 0;
+
+	move_terminal_cursor(10, row++);
+	printf_P(PSTR("RAM: %u static, %u stack peak, %u never used"),
+			total_static, stackmon_stack_high_water(),
+			stackmon_unused_bytes());
+	for (uint8_t i = 0; i < NUM_RAM_BUDGETS; i++)
+	{
+		const char* name = (const char*)pgm_read_word(&ram_budgets[i].name);
+		uint16_t (*usage)(void) =
+				(uint16_t (*)(void))pgm_read_word(&ram_budgets[i].usage);
+		uint16_t budget = pgm_read_word(&ram_budgets[i].budget);
+		uint16_t used = usage();
+		attributed += used;
+
+		move_terminal_cursor(10, row++);
+		printf_P(PSTR("  %-10S %4u / %4u %S"), name, used, budget,
+				used > budget ? PSTR("OVER") : PSTR("ok  "));
+	}
+	// Whatever isn't owned by a subsystem (libc, stdio, project.c globals)
+	move_terminal_cursor(10, row);
+	printf_P(PSTR("  %-10S %4u"), PSTR("other"), total_static - attributed);
+}
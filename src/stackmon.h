@@ -0,0 +1,43 @@
+/*
+ * stackmon.h
+ *
+ * Author: Michael Blauberg
+ *
+ * Stack and static RAM monitoring. At reset (before main() runs) the
+ * free RAM between the end of .bss and the top of the stack is painted
+ * with a known canary byte. The stack grows down into this region, so
+ * the number of canary bytes still intact at the bottom tells us how
+ * close the stack has ever come to colliding with our static data.
+ *
+ * Each subsystem reports the number of bytes of static RAM it owns and
+ * these are checked against a per-subsystem budget (see stackmon.c) so
+ * that RAM-for-speed trades can be kept under control.
+ */
+
+#ifndef STACKMON_H_
+#define STACKMON_H_
+
+#include <stdint.h>
+
+/* Number of bytes between the end of static data and the deepest point
+ * the stack has reached since reset. (i.e. RAM that has never been used.)
+ * This scans the painted region so takes a little time - don't call it
+ * from within the time critical parts of the game loop.
+ */
+uint16_t stackmon_unused_bytes(void);
+
+/* Deepest stack usage (in bytes) seen since reset.
+ */
+uint16_t stackmon_stack_high_water(void);
+
+/* Total static RAM (.data and .bss) used by the program.
+ */
+uint16_t stackmon_static_bytes(void);
+
+/* Print the stack high water mark and the per-subsystem static RAM
+ * budget report to the serial terminal, starting at the given terminal
+ * row.
+ */
+void stackmon_report(int8_t row);
+
+#endif /* STACKMON_H_ */
@@ -0,0 +1,144 @@
+/*
+ * tempo.c
+ *
+ * Author: Michael Blauberg
+ *
+ * Fixed point timing of the steps of the notes. See tempo.h.
+ */
+
+#include "tempo.h"
+#include <stdint.h>
+#include "game.h"
+#include "playfield.h"
+
+#define STEPS_PER_ROW	PLAYFIELD_ROW_SPACING
+#define FRACTION_BITS	8
+
+// Track being timed and the game speed it's played at
+static uint8_t track;
+static uint16_t base_row_ms;
+static uint16_t speed;
+
+static uint16_t row_ms;			// current tempo (at normal speed)
+static uint32_t next_step_ms;	// whole milliseconds of the next step's time
+static uint8_t next_step_fraction;	// and the fraction left over
+static uint32_t step_length;	// fixed point, for the next step
+static uint32_t steps;			// taken so far
+static uint32_t change_step;	// when the next tempo change takes effect
+static uint16_t change_row_ms;
+static uint8_t next_change;		// index of the one after
+
+// Length of a step at the given tempo (ms per row at normal speed)
+static uint32_t length_at(uint16_t row_ms)
+{
+	// Time a row takes at the game speed. This is at most a few times
+	// row_ms (the game speed is never much slower than normal), so it fits
+	// when shifted.
+	uint32_t scaled = (uint32_t)row_ms * speed;
+	uint32_t row_length = (scaled / base_row_ms) << FRACTION_BITS
+			| ((scaled % base_row_ms) << FRACTION_BITS) / base_row_ms;
+	return row_length / STEPS_PER_ROW;
+}
+
+// Look up the next change of tempo
+static void find_next_change(void)
+{
+	TempoChange change;
+	if (track_tempo_change(track, next_change, &change))
+	{
+		// Steps after the one that puts the row in the middle of the
+		// scoring area are at its tempo (from the first step if it starts
+		// past the middle)
+		int32_t middle = PLAYFIELD_STEPS_TO_MIDDLE(change.row);
+		change_step = middle < 1 ? 1 : middle + 1;
+		change_row_ms = change.row_ms;
+		next_change++;
+	}
+	else
+	{
+		change_step = UINT32_MAX;
+	}
+}
+
+// Switch to the tempo of any changes that take effect from the step after
+// the given one. (Several changes can take effect at the same step, in
+// which case the last one wins.) Returns non-zero if the tempo changed.
+static uint8_t take_changes(uint32_t step)
+{
+	uint8_t changed = 0;
+	while (step + 1 >= change_step)
+	{
+		row_ms = change_row_ms;
+		find_next_change();
+		changed = 1;
+	}
+	return changed;
+}
+
+// Move the next step's time on by the length of a step. (The whole
+// milliseconds are kept apart from the fraction so the time doesn't
+// overflow in a long game.)
+static void add_step_length(void)
+{
+	uint16_t fraction = next_step_fraction + (uint8_t)step_length;
+	next_step_ms += (step_length >> FRACTION_BITS) + (fraction >> FRACTION_BITS);
+	next_step_fraction = fraction;
+}
+
+void tempo_start(uint8_t track_to_time, uint16_t game_speed)
+{
+	track = track_to_time;
+	base_row_ms = track_tempo(track);
+	speed = game_speed;
+	next_change = 0;
+	find_next_change();
+
+	steps = 0;
+	row_ms = base_row_ms;
+	take_changes(steps);
+	step_length = length_at(row_ms);
+	next_step_ms = 0;
+	next_step_fraction = 0;
+	add_step_length();
+}
+
+uint32_t tempo_next_step(void)
+{
+	return next_step_ms;
+}
+
+uint16_t tempo_step_ms(void)
+{
+	return step_length >> FRACTION_BITS;
+}
+
+void tempo_step_taken(void)
+{
+	steps++;
+	if (take_changes(steps))
+	{
+		step_length = length_at(row_ms);
+	}
+	add_step_length();
+}
+
+void tempo_restart(uint32_t time)
+{
+	next_step_ms = time;
+	next_step_fraction = 0;
+}
+
+void tempo_set_speed(uint16_t game_speed)
+{
+	speed = game_speed;
+	step_length = length_at(row_ms);
+}
+
+uint16_t tempo_ram_usage(void)
+{
+	return sizeof(track) + sizeof(base_row_ms) + sizeof(speed)
+			+ sizeof(row_ms) + sizeof(next_step_ms)
+			+ sizeof(next_step_fraction) + sizeof(step_length) + sizeof(steps)
+			+ sizeof(change_step) + sizeof(change_row_ms)
+			+ sizeof(next_change);
+}
@@ -0,0 +1,51 @@
+/*
+ * tempo.h
+ *
+ * Author: Michael Blauberg
+ *
+ * Timing of the steps the notes take along the display. Each row of the
+ * track takes five steps, and the time a row takes is the track's tempo
+ * (see songlib.h) scaled by the game speed. A track can change tempo at
+ * given rows. The change takes effect once that row has reached the
+ * middle of the scoring area, so every note crosses the scoring area at
+ * the tempo given for it.
+ *
+ * Step times are kept in fixed point (1/256ms) so steps that aren't a
+ * whole number of milliseconds long don't drift. The length of a step is
+ * only worked out (with a division) when the tempo changes - moving on to
+ * the next step is just an addition.
+ *
+ * Times are game times - milliseconds since play started.
+ */
+
+#ifndef TEMPO_H_
+#define TEMPO_H_
+
+#include <stdint.h>
+
+// Start timing the steps of the given track at the given game speed (the
+// time in ms each row takes at the track's own tempo). The first step is
+// due one step after play starts.
+void tempo_start(uint8_t track, uint16_t game_speed);
+
+// Time the next step is due
+uint32_t tempo_next_step(void);
+
+// Length of the next step, in whole milliseconds
+uint16_t tempo_step_ms(void);
+
+// Move on to the next step. This must be called for every step taken.
+void tempo_step_taken(void);
+
+// Make the next step due at the given time instead (e.g. in manual mode).
+// Later steps follow on from it at the tempo.
+void tempo_restart(uint32_t time);
+
+// Change the game speed part way through. The next step is still due when
+// it was - the steps after it are at the new speed.
+void tempo_set_speed(uint16_t game_speed);
+
+// Returns the number of bytes of static RAM used by this module
+uint16_t tempo_ram_usage(void);
+
+#endif /* TEMPO_H_ */
@@ -75,6 +75,46 @@ uint32_t get_current_time(void)
 	return return_value;
 }
 
+uint32_t get_current_time_us(void)
+{
+	uint8_t sreg = SREG;
+	cli();
+	uint32_t ms = clock_ticks_ms;
+	uint8_t count = TCNT0;
+	if (TIFR0 & (1 << OCF0A))
+	{
+		/* The counter has wrapped around but the interrupt hasn't run
+		 * yet (interrupts are off) so the count is from the next
+		 * millisecond. Read it again in case it wrapped after we
+		 * read it.
+		 */
+		ms++;
+		count = TCNT0;
+	}
+	SREG = sreg;
+	/* Each count of the timer is 64 clock cycles, i.e. 8us */
+	return ms * 1000 + (uint16_t)count * 8;
+}
+
+uint16_t get_fast_ticks(void)
+{
+	/* The interrupt could fire part way through reading the two bytes.
+	 * It can't fire twice in the few cycles it takes to read them again
+	 * though, so once two reads agree the value is good.
+	 */
+	uint16_t ticks;
+	do
+	{
+		ticks = (uint16_t)clock_ticks_ms;
+	} while (ticks != (uint16_t)clock_ticks_ms);
+	return ticks;
+}
+
+uint16_t timer0_ram_usage(void)
+{
+	return sizeof(clock_ticks_ms);
+}
+
 ISR(TIMER0_COMPA_vect)
 {
 	/* Increment our clock tick count */
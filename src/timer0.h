@@ -30,4 +30,34 @@ void init_timer0(void);
  */
 uint32_t get_current_time(void);
 
+/* Return the time in microseconds since the timer was initialised. This
+ * combines the millisecond count with the timer's own counter so has a
+ * resolution of 8us (one timer count at 8MHz/64). It wraps around every
+ * ~71 minutes so differences should be taken modulo 2^32.
+ * Cost: interrupts are off for ~20 clock cycles; the whole call (including
+ * a 32 bit multiply) takes roughly 70 cycles (~9us).
+ */
+uint32_t get_current_time_us(void);
+
+/* Return the bottom 16 bits of the millisecond count. This doesn't turn
+ * interrupts off (the value is read until two reads agree) and is meant
+ * for frequent deadline checks - see fast_ticks_reached(). It wraps around
+ * every ~65 seconds.
+ * Cost: roughly 15 clock cycles (~2us).
+ */
+uint16_t get_fast_ticks(void);
+
+/* Return non-zero if the fast tick count now has reached (or passed)
+ * deadline. This is correct across wrap around as long as the deadline is
+ * less than ~32 seconds away from now.
+ */
+static inline uint8_t fast_ticks_reached(uint16_t now, uint16_t deadline)
+{
+	return (int16_t)(now - deadline) >= 0;
+}
+
+/* Return the number of bytes of static RAM used by this module.
+ */
+uint16_t timer0_ram_usage(void);
+
 #endif /* TIMER0_H_ */
@@ -2,13 +2,26 @@
  * timer1.c
  *
  * Author: Peter Sutton
+ * Modified by Michael Blauberg
  *
- * timer 1 skeleton
+ * Timer 1 posts each step of the notes to the main loop. See timer1.h.
  */
 
 #include "timer1.h"
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include "timer0.h"
+
+/* The timer counts at 8MHz/64, i.e. 125 counts a millisecond. The longest
+ * time the 16 bit counter can cover between interrupts is therefore 524ms.
+ * A step further away than that takes more than one interrupt.
+ */
+#define COUNTS_PER_MS		125
+#define MAX_INTERVAL_MS		524
+
+static volatile uint32_t ms_to_step;	/* from the last interrupt */
+static volatile uint16_t interval_ms;	/* until the next interrupt */
+static volatile uint8_t step_posted;
 
 /* Set up timer 1
  */
@@ -16,3 +29,127 @@ void init_timer1(void)
 {
 	TCNT1 = 0;
 }
+
+/* Stop the timer (with interrupts off)
+ */
+static void stop_timer(void)
+{
+	TCCR1B = 0;
+	TIMSK1 &= ~(1 << OCIE1A);
+}
+
+/* Set the compare value for the time until the step (or as far towards
+ * it as the timer can go).
+ */
+static void set_interval(void)
+{
+	interval_ms = ms_to_step < MAX_INTERVAL_MS ? ms_to_step : MAX_INTERVAL_MS;
+	OCR1A = interval_ms * COUNTS_PER_MS - 1;
+}
+
+void timer1_set_step_time(uint32_t step_time)
+{
+	uint8_t interrupts_were_enabled = bit_is_set(SREG, SREG_I);
+	cli();
+
+	/* Stop the timer while it's set up */
+	stop_timer();
+
+	/* Start the timer counting from the same point as timer 0 so that
+	 * its compare matches line up with the millisecond ticks. Timer 0
+	 * might have reached its compare value with its interrupt not yet
+	 * run (interrupts are off) in which case the millisecond count is
+	 * one behind.
+	 *
+	 * Writing TCNT1 blocks a compare match on the next count, so it
+	 * mustn't be started at the compare value (124 for a 1ms interval)
+	 * or the match would be missed and the step come 524ms late. When
+	 * timer 0 is on its last count of the millisecond we count from its
+	 * next tick instead, starting timer 1 one short of zero so it wraps
+	 * round to zero along with timer 0.
+	 */
+	uint8_t count = TCNT0;
+	uint32_t now = get_current_time();
+	if (count == OCR0A)
+	{
+		TCNT1 = 0xFFFF;
+		now++;
+	}
+	else
+	{
+		TCNT1 = count;
+		if (TIFR0 & (1 << OCF0A))
+		{
+			now++;
+		}
+	}
+
+	if ((int32_t)(step_time - now) <= 0)
+	{
+		step_posted = 1;
+	}
+	else
+	{
+		ms_to_step = step_time - now;
+		set_interval();
+
+		/* Clear timer on compare match (CTC mode), divide the clock by
+		 * 64 and interrupt on compare match
+		 */
+		TIFR1 = (1 << OCF1A);
+		TIMSK1 |= (1 << OCIE1A);
+		TCCR1B = (1 << WGM12) | (1 << CS11) | (1 << CS10);
+	}
+
+	if (interrupts_were_enabled)
+	{
+		sei();
+	}
+}
+
+void timer1_cancel_step(void)
+{
+	uint8_t interrupts_were_enabled = bit_is_set(SREG, SREG_I);
+	cli();
+	stop_timer();
+	step_posted = 0;
+	if (interrupts_were_enabled)
+	{
+		sei();
+	}
+}
+
+uint8_t timer1_take_step(void)
+{
+	/* The interrupt is off once the step is posted, so nothing else can
+	 * change step_posted
+	 */
+	if (!step_posted)
+	{
+		return 0;
+	}
+	step_posted = 0;
+	return 1;
+}
+
+uint16_t timer1_ram_usage(void)
+{
+	return sizeof(ms_to_step) + sizeof(interval_ms) + sizeof(step_posted);
+}
+
+ISR(TIMER1_COMPA_vect)
+{
+	/* The counter has already gone back to zero so there's plenty of
+	 * time to change the compare value before it's reached again
+	 */
+	ms_to_step -= interval_ms;
+	if (ms_to_step == 0)
+	{
+		step_posted = 1;
+		stop_timer();
+	}
+	else
+	{
+		set_interval();
+	}
+}
@@ -2,8 +2,19 @@
  * timer1.h
  *
  * Author: Peter Sutton
+ * Modified by Michael Blauberg
  *
- * timer 1 skeleton
+ * Timer 1 times the steps of the notes along the display. The main loop
+ * says when the next step is due (see tempo.h) and an output compare
+ * interrupt posts the step at exactly that time. The main loop then does
+ * the (slow) work of moving and drawing the notes and sets the time of
+ * the following step. The interrupt handler does nothing else, so steps
+ * are late by the interrupt latency rather than by however long the main
+ * loop happens to take, and there is never more than one step waiting.
+ *
+ * Timer 1 uses the same prescaler as timer 0 so the steps stay locked to
+ * the millisecond clock (see timer0.h) - a step due at a given time is
+ * posted at exactly the moment the millisecond count reaches that time.
  */
 
 #ifndef TIMER1_H_
@@ -15,5 +26,24 @@
  */
 void init_timer1(void);
 
+/* Post a step when the time (from get_current_time()) reaches step_time,
+ * or straight away if it already has. This replaces any step that hasn't
+ * been posted yet.
+ */
+void timer1_set_step_time(uint32_t step_time);
+
+/* Stop timing steps. A step that has been posted but not taken is thrown
+ * away.
+ */
+void timer1_cancel_step(void);
+
+/* Take the step posted by the interrupt handler. Returns non-zero if there
+ * was one to take (which should then be carried out).
+ */
+uint8_t timer1_take_step(void);
+
+/* Return the number of bytes of static RAM used by this module.
+ */
+uint16_t timer1_ram_usage(void);
 
 #endif /* TIMER1_H_ */
@@ -0,0 +1,312 @@
+/*
+ * upload.c
+ *
+ * Author: Michael Blauberg
+ *
+ * Streaming song upload over the serial port. See upload.h.
+ */
+
+#include "upload.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/crc16.h>
+#include "songslot.h"
+#include "timer0.h"
+
+#define SOH 0x01
+#define ACK 0x06
+#define NAK 0x15
+
+#define CMD_BEGIN	'B'
+#define CMD_DATA	'D'
+#define CMD_END		'E'
+
+// An upload is abandoned if no frame arrives for this long (ms)
+#define UPLOAD_TIMEOUT 3000
+
+// States of the receive parser
+#define RX_IDLE		0
+#define RX_COMMAND	1
+#define RX_SEQUENCE	2
+#define RX_LENGTH	3
+#define RX_PAYLOAD	4
+#define RX_CRC		5
+
+// Frame being received. These are written by the receive interrupt
+// handler until frame_ready (or frame_error) is set, after which they are
+// left alone until upload_poll() has dealt with the frame.
+static volatile uint8_t rx_state;
+static volatile uint8_t rx_crc;
+static volatile uint8_t rx_count;
+static volatile uint8_t frame_command;
+static volatile uint8_t frame_sequence;
+static volatile uint8_t frame_length;
+static volatile uint8_t frame_payload[UPLOAD_MAX_PAYLOAD];
+static volatile uint8_t frame_ready;
+static volatile uint8_t frame_error;
+
+// Upload in progress
+static volatile uint8_t active;
+static uint8_t slot;
+static uint8_t next_sequence;
+static uint16_t song_length;
+static uint16_t received;
+static flash_address_t page_address;
+static uint8_t page_pos;
+static uint8_t page_buffer[SPM_PAGESIZE];
+static uint16_t last_frame_time;
+static uint8_t completed;
+static uint8_t abandoned;
+
+uint8_t upload_rx_byte(uint8_t c)
+{
+	switch (rx_state)
+	{
+		case RX_IDLE:
+			if (c == SOH && !frame_ready && !frame_error)
+			{
+				rx_crc = 0;
+				rx_state = RX_COMMAND;
+				return 1;
+			}
+			// Stray bytes are thrown away (not treated as key presses)
+			// while an upload is in progress
+			return active;
+		case RX_COMMAND:
+			frame_command = c;
+			rx_state = RX_SEQUENCE;
+			break;
+		case RX_SEQUENCE:
+			frame_sequence = c;
+			rx_state = RX_LENGTH;
+			break;
+		case RX_LENGTH:
+			frame_length = c;
+			rx_count = 0;
+			if (c > UPLOAD_MAX_PAYLOAD)
+			{
+				frame_error = 1;
+				rx_state = RX_IDLE;
+				return 1;
+			}
+			rx_state = c ? RX_PAYLOAD : RX_CRC;
+			break;
+		case RX_PAYLOAD:
+			frame_payload[rx_count++] = c;
+			if (rx_count == frame_length)
+			{
+				rx_state = RX_CRC;
+			}
+			break;
+		case RX_CRC:
+			if (c == rx_crc)
+			{
+				frame_ready = 1;
+			}
+			else
+			{
+				frame_error = 1;
+			}
+			rx_state = RX_IDLE;
+			return 1;
+	}
+	rx_crc = _crc8_ccitt_update(rx_crc, c);
+	return 1;
+}
+
+static void answer(uint8_t response, uint8_t sequence)
+{
+	printf_P(PSTR("%c%02X"), response, sequence);
+}
+
+// Write out the page buffer and move on to the next page
+static void flush_page(void)
+{
+	memset(&page_buffer[page_pos], 0xFF, SPM_PAGESIZE - page_pos);
+	songslot_write_page(page_address, page_buffer);
+	page_address += SPM_PAGESIZE;
+	page_pos = 0;
+}
+
+static uint8_t begin(void)
+{
+	uint16_t length = frame_payload[1] | ((uint16_t)frame_payload[2] << 8);
+	if (frame_length != 3 || frame_payload[0] >= NUM_SONG_SLOTS
+			|| length > SONG_MAX_LENGTH)
+	{
+		return NAK;
+	}
+	slot = frame_payload[0];
+	song_length = length;
+	received = 0;
+	page_address = songslot_address(slot);
+
+	// The header is left erased until the end so the slot doesn't look
+	// valid until the whole song has arrived
+	memset(page_buffer, 0xFF, SONG_HEADER_SIZE);
+	page_pos = SONG_HEADER_SIZE;
+	return ACK;
+}
+
+static uint8_t data(void)
+{
+	if (received + frame_length > song_length)
+	{
+		return NAK;
+	}
+	for (uint8_t i = 0; i < frame_length; i++)
+	{
+		page_buffer[page_pos++] = frame_payload[i];
+		if (page_pos == SPM_PAGESIZE)
+		{
+			flush_page();
+		}
+	}
+	received += frame_length;
+	return ACK;
+}
+
+static uint8_t end(void)
+{
+	if (received != song_length)
+	{
+		return NAK;
+	}
+	if (page_pos)
+	{
+		flush_page();
+	}
+
+	// Now write the header into the first page to make the song valid
+	flash_address_t first_page = songslot_address(slot);
+	for (uint16_t i = 0; i < SPM_PAGESIZE; i++)
+	{
+		page_buffer[i] = flash_read_byte(first_page + i);
+	}
+	songslot_make_header(page_buffer, song_length);
+	songslot_write_page(first_page, page_buffer);
+	completed = 1;
+	return ACK;
+}
+
+void upload_poll(void)
+{
+	if (frame_error)
+	{
+		// Corrupt frame - ask for it again
+		answer(NAK, frame_sequence);
+		frame_error = 0;
+		return;
+	}
+	if (!frame_ready)
+	{
+		if (active && (uint16_t)(get_fast_ticks() - last_frame_time)
+				> UPLOAD_TIMEOUT)
+		{
+			// The sender has gone away - give up on this upload
+			active = 0;
+			abandoned = 1;
+		}
+		return;
+	}
+
+	uint8_t response = NAK;
+	if (frame_command == CMD_BEGIN)
+	{
+		response = begin();
+		active = (response == ACK);
+		next_sequence = frame_sequence + 1;
+	}
+	else if (active && frame_sequence == (uint8_t)(next_sequence - 1))
+	{
+		// We've already dealt with this frame but our answer must have
+		// been lost. Answer it again.
+		response = ACK;
+	}
+	else if (active && frame_sequence == next_sequence)
+	{
+		if (frame_command == CMD_DATA)
+		{
+			response = data();
+		}
+		else if (frame_command == CMD_END)
+		{
+			response = end();
+			active = (response != ACK);
+		}
+		if (response == ACK)
+		{
+			next_sequence++;
+		}
+	}
+	last_frame_time = get_fast_ticks();
+	answer(response, frame_sequence);
+
+	// Ready for the next frame
+	frame_ready = 0;
+}
+
+void upload_abort(void)
+{
+	// The sender is told nothing - its next frame will be NAKed
+	uint8_t sreg = SREG;
+	cli();
+	if (active)
+	{
+		abandoned = 1;
+	}
+	active = 0;
+	rx_state = RX_IDLE;
+	frame_ready = 0;
+	frame_error = 0;
+	SREG = sreg;
+}
+
+uint8_t upload_active(void)
+{
+	return active;
+}
+
+uint8_t upload_slot(void)
+{
+	return slot;
+}
+
+uint8_t upload_percent(void)
+{
+	if (song_length == 0)
+	{
+		return 100;
+	}
+	return (uint32_t)received * 100 / song_length;
+}
+
+uint8_t upload_completed(void)
+{
+	uint8_t result = completed;
+	completed = 0;
+	return result;
+}
+
+uint8_t upload_abandoned(void)
+{
+	uint8_t result = abandoned;
+	abandoned = 0;
+	return result;
+}
+
+uint16_t upload_ram_usage(void)
+{
+	return sizeof(rx_state) + sizeof(rx_crc) + sizeof(rx_count)
+			+ sizeof(frame_command) + sizeof(frame_sequence)
+			+ sizeof(frame_length) + sizeof(frame_payload)
+			+ sizeof(frame_ready) + sizeof(frame_error) + sizeof(active)
+			+ sizeof(slot) + sizeof(next_sequence) + sizeof(song_length)
+			+ sizeof(received) + sizeof(page_address) + sizeof(page_pos)
+			+ sizeof(page_buffer) + sizeof(last_frame_time)
+			+ sizeof(completed) + sizeof(abandoned);
+}
@@ -0,0 +1,71 @@
+/*
+ * upload.h
+ *
+ * Author: Michael Blauberg
+ *
+ * Streaming song upload over the serial port into the flash song slots
+ * (see songslot.h). The song is sent as a series of small frames:
+ *
+ *     SOH(0x01) command sequence length payload[length] crc
+ *
+ * where crc is the CRC-8 (polynomial 0x07, initial value 0) of everything
+ * from the command to the end of the payload. Commands are:
+ *     'B' begin - payload is the slot number and the song length (2 bytes,
+ *                 low byte first)
+ *     'D' data  - payload is the next (up to UPLOAD_MAX_PAYLOAD) bytes of
+ *                 the song
+ *     'E' end   - no payload. The song is only marked valid once this has
+ *                 been received and all the data has arrived.
+ *
+ * Frames are parsed a byte at a time as they arrive (from the serial
+ * receive interrupt) and only one frame is held in RAM. Each frame is
+ * answered with ACK (0x06) or NAK (0x15) followed by the frame's sequence
+ * number as two hex digits. The sender must wait for the answer before
+ * sending the next frame - this is the flow control, and means nothing
+ * arrives while a flash page is being written (when interrupts are off).
+ * A frame that is NAKed (or not answered) should be sent again.
+ *
+ * See tools/upload_song.py for the sending side.
+ */
+
+#ifndef UPLOAD_H_
+#define UPLOAD_H_
+
+#include <stdint.h>
+
+#define UPLOAD_MAX_PAYLOAD 32
+
+// Called by the serial receive interrupt handler for every byte received.
+// Returns non-zero if the byte was part of an upload (in which case it
+// must not be treated as normal input).
+uint8_t upload_rx_byte(uint8_t c);
+
+// Deal with any frame that has been received - write flash pages and send
+// the answer. This should be called often (e.g. from the start screen's
+// main loop) and returns quickly when there is nothing to do.
+void upload_poll(void);
+
+// Give up on any upload in progress (and any frame part received), so
+// serial input is treated as normal input again. Called when a game
+// starts, as uploads are only dealt with on the start screen.
+void upload_abort(void);
+
+// Returns non-zero while an upload is in progress.
+uint8_t upload_active(void);
+
+// Slot being uploaded and the percentage received so far.
+uint8_t upload_slot(void);
+uint8_t upload_percent(void);
+
+// Returns non-zero (once) when an upload has finished successfully.
+uint8_t upload_completed(void);
+
+// Returns non-zero (once) when an upload has been given up part way
+// through (timed out or aborted). The slot it was writing may be left
+// half written, so it no longer holds a valid song.
+uint8_t upload_abandoned(void);
+
+// Returns the number of bytes of static RAM used by this module
+uint16_t upload_ram_usage(void);
+
+#endif /* UPLOAD_H_ */
@@ -0,0 +1,158 @@
+#!/usr/bin/env python3
+"""Compile LED matrix animations for the AVR Hero animation player.
+
+    anim_compiler.py [-o OUTPUT_DIR] ANIMATION...
+
+Each animation file (NAME.anim) becomes a table anim_NAME in animdata.c,
+declared in animdata.h, in OUTPUT_DIR (src by default). The files are only
+rewritten if they change, so this can run before every build (see
+tools/pio_generate.py).
+
+An animation file is a series of frames, each a line "frame" (anything
+after it is ignored) followed by 8 lines of 16 characters - the rows of
+the matrix, top row first. The characters give the colours:
+
+    . black   R red   G green   O orange
+    Y yellow  h half yellow     q quarter yellow
+
+'#' starts a comment. The animation loops back to its first frame after the
+last. See src/anim.h for the packed format.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+COLUMNS = 16
+ROWS = 8
+COLOURS = {".": 0x00, "R": 0x0F, "G": 0xF0, "O": 0x3C,
+           "Y": 0xFF, "h": 0x55, "q": 0x11}
+FULL_COLUMN = 0xFF
+# SPI bytes to send a pixel and a whole column to the matrix
+PIXEL_COST = 3
+COLUMN_COST = 2 + ROWS
+
+
+class AnimationError(Exception):
+    pass
+
+
+def parse(path):
+    """Return the frames of an animation, each a list of columns of
+    colours (bottom row first, as the matrix numbers them)"""
+    frames = []
+    lines = []
+    with open(path) as f:
+        for number, line in enumerate(f, 1):
+            line = line.split("#")[0].strip()
+            if not line:
+                continue
+            if line.startswith("frame"):
+                lines = []
+                frames.append(lines)
+                continue
+            if not frames or len(lines) == ROWS:
+                raise AnimationError("%s:%d: row outside a frame"
+                                     % (path, number))
+            if len(line) != COLUMNS or any(c not in COLOURS for c in line):
+                raise AnimationError("%s:%d: rows must be %d colours"
+                                     % (path, number, COLUMNS))
+            lines.append(line)
+    if not frames or any(len(rows) != ROWS for rows in frames):
+        raise AnimationError("%s: frames must have %d rows" % (path, ROWS))
+    if len(frames) > 255:
+        raise AnimationError("%s: too many frames" % path)
+    return [[[COLOURS[rows[ROWS - 1 - y][x]] for y in range(ROWS)]
+             for x in range(COLUMNS)] for rows in frames]
+
+
+def changes(before, after):
+    """Encode the change from one frame to the next: a count followed by
+    (x, mask, colours) for each changed column. A mask of 0xFF means the
+    whole column is sent at once, otherwise the pixels in the mask are
+    sent one by one - whichever is fewer bytes for the matrix."""
+    count = 0
+    entries = []
+    for x in range(COLUMNS):
+        mask = sum(1 << y for y in range(ROWS)
+                   if before[x][y] != after[x][y])
+        if not mask:
+            continue
+        if bin(mask).count("1") * PIXEL_COST >= COLUMN_COST:
+            mask = FULL_COLUMN
+        count += 1
+        entries += [x, mask] + [after[x][y] for y in range(ROWS)
+                                if mask & (1 << y)]
+    return [count] + entries
+
+
+def encode(frames):
+    """Pack an animation: the number of frames, the first frame drawn on a
+    clear display, then the change into each frame from the one before it
+    (the first from the last, so the animation loops)"""
+    blank = [[0] * ROWS for _ in range(COLUMNS)]
+    data = [len(frames)] + changes(blank, frames[0])
+    for i, frame in enumerate(frames):
+        data += changes(frames[i - 1], frame)
+    return data
+
+
+def c_bytes(data):
+    return "\n".join("\t" + " ".join("0x%02X," % b for b in data[i:i + 8])
+                     for i in range(0, len(data), 8))
+
+
+def generate(paths):
+    banner = ("/*\n * %s\n *\n * Generated by tools/anim_compiler.py from "
+              "the animations in animations/ - don't edit.\n */\n")
+    source = banner % "animdata.c" + '\n#include "animdata.h"\n'
+    header = banner % "animdata.h" + ("\n#ifndef ANIMDATA_H_\n"
+                                      "#define ANIMDATA_H_\n\n"
+                                      "#include <stdint.h>\n"
+                                      "#include <avr/pgmspace.h>\n\n")
+    for path in paths:
+        name = os.path.splitext(os.path.basename(path))[0]
+        if not re.match(r"[A-Za-z_][A-Za-z0-9_]*$", name):
+            raise AnimationError("%s: name must be a C identifier" % path)
+        frames = parse(path)
+        data = encode(frames)
+        source += ("\n// %s: %d frames in %d bytes\n"
+                   "const uint8_t anim_%s[] PROGMEM = {\n%s\n};\n"
+                   % (os.path.basename(path), len(frames), len(data), name,
+                      c_bytes(data)))
+        header += "extern const uint8_t anim_%s[] PROGMEM;\n" % name
+    header += "\n#endif /* ANIMDATA_H_ */\n"
+    return source, header
+
+
+def write_if_changed(path, contents):
+    try:
+        with open(path) as f:
+            if f.read() == contents:
+                return
+    except FileNotFoundError:
+        pass
+    with open(path, "w") as f:
+        f.write(contents)
+    print("anim_compiler: wrote %s" % path)
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(
+        description="Compile LED matrix animations for AVR Hero")
+    parser.add_argument("-o", "--output", default=os.path.join(
+        os.path.dirname(os.path.abspath(__file__)), "..", "src"),
+        help="directory to write animdata.c and animdata.h to")
+    parser.add_argument("animations", nargs="+", help="animation files")
+    args = parser.parse_args(argv)
+    try:
+        source, header = generate(args.animations)
+    except (AnimationError, OSError) as e:
+        sys.exit("anim_compiler: %s" % e)
+    write_if_changed(os.path.join(args.output, "animdata.c"), source)
+    write_if_changed(os.path.join(args.output, "animdata.h"), header)
+
+
+if __name__ == "__main__":
+    main()
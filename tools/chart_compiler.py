@@ -0,0 +1,285 @@
+#!/usr/bin/env python3
+"""Compile song charts into the AVR Hero song library.
+
+    chart_compiler.py [-o OUTPUT_DIR] CHART...
+
+Each chart becomes one song of the library, in the order given, and the
+packed tables are written to songdata.c and songdata.h in OUTPUT_DIR
+(src by default). The files are only rewritten if they change, so this can
+run before every build (see tools/pio_generate.py).
+
+A chart is a text file. It starts with settings, one per line:
+
+    name: Staircase      name shown on the start screen
+    bpm: 60              tempo in beats per minute
+    rows-per-beat: 1     rows of the track in each beat
+    midi: song.mid       take the notes from a MIDI file (optional)
+    lanes: 60 62 64 65   MIDI notes played in each lane (with midi:)
+
+If there is no MIDI file the notes follow, one row per line. Each row has a
+character for each lane (the lanes played with a, s, d and f) which is 'x'
+for a note or '.' for none, optionally followed by "*N" to repeat the row N
+times. '#' starts a comment, and '|' can be used to mark bars. A "bpm:"
+line among the notes changes the tempo from the next row on.
+
+Notes from a MIDI file are put on the nearest row. The tempo is taken from
+the file's tempo changes (120 bpm if there are none), unless bpm: is given.
+
+The notes are packed into token streams (see src/songlib.h) and each
+song's tempo, and each change of tempo, is worked out as milliseconds per
+row here, so the firmware never has to.
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from encode_song import encode, decode  # noqa: E402
+
+NUM_LANES = 4
+DEFAULT_LANE_NOTES = [60, 61, 62, 63]
+MAX_ROWS = 0xFFFF
+MAX_TEMPO_CHANGES = 0xFF
+
+
+class ChartError(Exception):
+    pass
+
+
+def read_varlen(data, pos):
+    value = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value = (value << 7) | (byte & 0x7F)
+        if not byte & 0x80:
+            return value, pos
+
+
+def read_midi(path):
+    """Return (ticks per quarter note, [(tick, microseconds per quarter
+    note), ...] for every tempo change, [(tick, note), ...] for every note
+    started) for a standard MIDI file"""
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:4] != b"MThd":
+        raise ChartError("%s is not a MIDI file" % path)
+    header_length, _, num_tracks, division = struct.unpack(">IHHH", data[4:14])
+    if division & 0x8000:
+        raise ChartError("%s: SMPTE time isn't supported" % path)
+    pos = 8 + header_length
+    tempos = []
+    notes = []
+    for _ in range(num_tracks):
+        if data[pos:pos + 4] != b"MTrk":
+            raise ChartError("%s: bad track" % path)
+        (length,) = struct.unpack(">I", data[pos + 4:pos + 8])
+        pos += 8
+        end = pos + length
+        tick = 0
+        status = 0
+        while pos < end:
+            delta, pos = read_varlen(data, pos)
+            tick += delta
+            if data[pos] & 0x80:
+                status = data[pos]
+                pos += 1
+            if status == 0xFF:
+                kind = data[pos]
+                length, pos = read_varlen(data, pos + 1)
+                if kind == 0x51:
+                    tempos.append(
+                        (tick, int.from_bytes(data[pos:pos + 3], "big")))
+                pos += length
+            elif status in (0xF0, 0xF7):
+                length, pos = read_varlen(data, pos)
+                pos += length
+            else:
+                kind = status & 0xF0
+                size = 1 if kind in (0xC0, 0xD0) else 2
+                args = data[pos:pos + size]
+                pos += size
+                if kind == 0x90 and args[1] > 0:
+                    notes.append((tick, args[0]))
+        pos = end
+    return division, sorted(tempos) or [(0, 500000)], sorted(notes)
+
+
+def midi_rows(path, lane_notes, rows_per_beat):
+    """Put the notes of a MIDI file on rows. Returns (rows, [(row,
+    microseconds per quarter note), ...])"""
+    division, tempos, notes = read_midi(path)
+    rows = []
+    for tick, note in notes:
+        if note not in lane_notes:
+            continue
+        row = (tick * rows_per_beat + division // 2) // division
+        if row >= MAX_ROWS:
+            raise ChartError("%s is too long" % path)
+        rows += [0] * (row + 1 - len(rows))
+        rows[row] |= 1 << lane_notes.index(note)
+    return rows, [((tick * rows_per_beat + division // 2) // division, tempo)
+                  for tick, tempo in tempos]
+
+
+def row_time(path, bpm, rows_per_beat):
+    """Milliseconds per row at the given tempo"""
+    row_ms = round(60000 / (bpm * rows_per_beat))
+    if not 1 <= row_ms <= 0xFFFF:
+        raise ChartError("%s: tempo out of range" % path)
+    return row_ms
+
+
+def tempo_changes(path, row_ms, bpms, rows_per_beat, num_rows):
+    """Turn [(row, bpm), ...] into the changes of tempo from row_ms,
+    [(row, milliseconds per row), ...]. Changes on the same row are
+    merged, and ones that make no difference or are past the end of the
+    song are dropped."""
+    changes = []
+    for row, bpm in bpms:
+        ms = row_time(path, bpm, rows_per_beat)
+        if changes and changes[-1][0] == row:
+            changes.pop()
+        if row >= num_rows:
+            break
+        if row == 0:
+            row_ms = ms
+        elif ms != (changes[-1][1] if changes else row_ms):
+            changes.append((row, ms))
+    if len(changes) > MAX_TEMPO_CHANGES:
+        raise ChartError("%s: more than %d tempo changes"
+                         % (path, MAX_TEMPO_CHANGES))
+    return row_ms, changes
+
+
+def parse_chart(path):
+    """Return (name, milliseconds per row, rows, tempo changes) for a chart
+    (see tempo_changes())"""
+    settings = {"name": os.path.splitext(os.path.basename(path))[0],
+                "rows-per-beat": "1"}
+    rows = []
+    bpms = []
+    with open(path) as f:
+        for number, line in enumerate(f, 1):
+            line = line.split("#")[0].replace("|", "").strip()
+            if not line:
+                continue
+            setting = re.match(r"([a-z-]+)\s*:\s*(.*)$", line)
+            if setting:
+                if rows and setting.group(1) == "bpm":
+                    bpms.append((len(rows), setting.group(2)))
+                    continue
+                if rows:
+                    raise ChartError("%s:%d: setting after the notes"
+                                     % (path, number))
+                settings[setting.group(1)] = setting.group(2)
+                continue
+            row = re.match(r"([x.]{%d})\s*(?:\*\s*(\d+))?$" % NUM_LANES, line)
+            if not row:
+                raise ChartError("%s:%d: can't understand '%s'"
+                                 % (path, number, line))
+            value = sum(1 << i for i, c in enumerate(row.group(1)) if c == "x")
+            rows += [value] * int(row.group(2) or 1)
+
+    try:
+        rows_per_beat = int(settings["rows-per-beat"])
+        bpm = float(settings.get("bpm", 60))
+        if "midi" in settings:
+            if rows:
+                raise ChartError("%s: notes given as well as a MIDI file"
+                                 % path)
+            midi = os.path.join(os.path.dirname(path), settings["midi"])
+            lanes = [int(n) for n in settings.get("lanes", "").split()]
+            rows, tempos = midi_rows(midi, lanes or DEFAULT_LANE_NOTES,
+                                     rows_per_beat)
+            if "bpm" not in settings:
+                bpm = 60e6 / tempos[0][1]
+                bpms = [(row, 60e6 / tempo) for row, tempo in tempos[1:]]
+        bpms = [(row, float(value)) for row, value in bpms]
+    except ValueError as e:
+        raise ChartError("%s: %s" % (path, e))
+
+    if not rows or len(rows) > MAX_ROWS:
+        raise ChartError("%s: songs must have 1 to %d rows" % (path, MAX_ROWS))
+    row_ms, changes = tempo_changes(path, row_time(path, bpm, rows_per_beat),
+                                    bpms, rows_per_beat, len(rows))
+    return settings["name"], row_ms, rows, changes
+
+
+def c_bytes(data):
+    return "\n".join("\t" + " ".join("0x%02X," % b for b in data[i:i + 8])
+                     for i in range(0, len(data), 8))
+
+
+def generate(charts):
+    """Return the contents of songdata.c and songdata.h"""
+    songs = []
+    for path in charts:
+        name, row_ms, rows, changes = parse_chart(path)
+        stream = encode(rows)
+        assert decode(stream) == rows
+        songs.append((os.path.basename(path), name, row_ms, rows, stream,
+                      changes))
+
+    banner = ("/*\n * %s\n *\n * Generated by tools/chart_compiler.py from "
+              "the charts in songs/ - don't edit.\n */\n")
+    source = banner % "songdata.c"
+    source += '\n#include "songlib.h"\n#include <avr/pgmspace.h>\n'
+    for i, (chart, name, row_ms, rows, stream, changes) in enumerate(songs):
+        source += ("\n// %s: %d rows in %d bytes\n"
+                   "static const uint8_t song_%d[] PROGMEM = {\n%s\n};\n"
+                   "static const char name_%d[] PROGMEM = \"%s\";\n"
+                   % (chart, len(rows), len(stream), i, c_bytes(stream),
+                      i, name.replace("\\", "\\\\").replace('"', '\\"')))
+        if changes:
+            source += ("static const TempoChange tempo_%d[] PROGMEM = {\n"
+                       "%s\n};\n"
+                       % (i, "\n".join("\t{%d, %d}," % change
+                                       for change in changes)))
+    source += "\nconst SongInfo song_library[NUM_LIBRARY_SONGS] PROGMEM = {\n"
+    for i, (chart, name, row_ms, rows, stream, changes) in enumerate(songs):
+        source += ("\t{name_%d, song_%d, %d, %d, %s, %d},\n"
+                   % (i, i, len(rows), row_ms,
+                      "tempo_%d" % i if changes else "NULL", len(changes)))
+    source += "};\n"
+
+    header = banner % "songdata.h"
+    header += ("\n#ifndef SONGDATA_H_\n#define SONGDATA_H_\n\n"
+               "#define NUM_LIBRARY_SONGS %d\n\n#endif /* SONGDATA_H_ */\n"
+               % len(songs))
+    return source, header
+
+
+def write_if_changed(path, contents):
+    try:
+        with open(path) as f:
+            if f.read() == contents:
+                return
+    except FileNotFoundError:
+        pass
+    with open(path, "w") as f:
+        f.write(contents)
+    print("chart_compiler: wrote %s" % path)
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(
+        description="Compile song charts into the AVR Hero song library")
+    parser.add_argument("-o", "--output", default=os.path.join(
+        os.path.dirname(os.path.abspath(__file__)), "..", "src"),
+        help="directory to write songdata.c and songdata.h to")
+    parser.add_argument("charts", nargs="+", help="chart files")
+    args = parser.parse_args(argv)
+    try:
+        source, header = generate(args.charts)
+    except (ChartError, OSError) as e:
+        sys.exit("chart_compiler: %s" % e)
+    write_if_changed(os.path.join(args.output, "songdata.c"), source)
+    write_if_changed(os.path.join(args.output, "songdata.h"), header)
+
+
+if __name__ == "__main__":
+    main()
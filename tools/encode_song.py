@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+"""Encode a song for the AVR Hero song library (src/songlib.c).
+
+The song file holds one hex byte per row of the track (e.g. "0x08, 0x04"),
+the same as the built in track used to be written. The encoded stream is
+printed as a C initialiser:
+
+    encode_song.py song.txt
+
+See src/songlib.h for the token format.
+"""
+
+import re
+import sys
+
+LITERAL = 0x00
+REST = 0x40
+RUN = 0x80
+REPEAT = 0xC0
+MAX_COUNT = 64
+MAX_DISTANCE = 255
+
+
+def encode(rows):
+    """Encode rows, returning the stream as a list of bytes. Repeats can't
+    be nested, so short repeats can get in the way of longer ones later -
+    a few minimum repeat lengths are tried and the shortest result kept."""
+    return min((encode_with(rows, n) for n in range(3, 12)), key=len)
+
+
+def encode_with(rows, min_repeat):
+    """Encode rows, only using repeats of at least min_repeat rows"""
+    out = []
+    # Where each token that a repeat may start at begins:
+    # (row index, stream offset, rows it covers)
+    starts = []
+    i = 0
+    # Offset of the literal token being added to (if any)
+    literal_at = None
+
+    while i < len(rows):
+        # Longest earlier phrase that can be repeated from a token start.
+        # A repeat must not run into another repeat token.
+        best_len, best_offset = 0, 0
+        for k, (row, offset, _) in enumerate(starts):
+            if len(out) - offset > MAX_DISTANCE:
+                continue
+            limit = 0
+            for _, _, covered in starts[k:]:
+                if covered is None:
+                    break
+                limit += covered
+            length = 0
+            while (length < min(limit, MAX_COUNT) and i + length < len(rows)
+                   and row + length < i
+                   and rows[row + length] == rows[i + length]):
+                length += 1
+            if length > best_len:
+                best_len, best_offset = length, offset
+        if best_len >= min_repeat:
+            literal_at = None
+            starts.append((i, len(out), None))
+            out += [REPEAT | (best_len - 1), len(out) - best_offset]
+            i += best_len
+            continue
+
+        run = 1
+        while (i + run < len(rows) and rows[i + run] == rows[i]
+               and run < MAX_COUNT):
+            run += 1
+        if rows[i] == 0:
+            literal_at = None
+            starts.append((i, len(out), run))
+            out.append(REST | (run - 1))
+            i += run
+        elif run >= 2:
+            literal_at = None
+            starts.append((i, len(out), run))
+            out += [RUN | (run - 1), rows[i]]
+            i += run
+        else:
+            if literal_at is None or out[literal_at] == LITERAL | (MAX_COUNT - 1):
+                literal_at = len(out)
+                starts.append((i, len(out), 0))
+                out.append(LITERAL)
+            else:
+                out[literal_at] += 1
+            k = max(n for n, s in enumerate(starts) if s[1] == literal_at)
+            starts[k] = (starts[k][0], literal_at, starts[k][2] + 1)
+            out.append(rows[i])
+            i += 1
+    return out
+
+
+def decode(stream):
+    """Decode a stream (as the firmware does) - used to check encode()"""
+    def play(pos, count, nested):
+        rows = []
+        while len(rows) < count and pos < len(stream):
+            token, n = stream[pos] & 0xC0, (stream[pos] & 0x3F) + 1
+            if token == REPEAT:
+                assert not nested, "repeat of a repeat"
+                rows += play(pos - stream[pos + 1], n, True)
+                pos += 2
+            elif token == LITERAL:
+                rows += stream[pos + 1:pos + 1 + n]
+                pos += 1 + n
+            elif token == REST:
+                rows += [0] * n
+                pos += 1
+            else:
+                rows += [stream[pos + 1]] * n
+                pos += 2
+        return rows[:count]
+    return play(0, len(stream) * MAX_COUNT, False)
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(__doc__)
+    with open(sys.argv[1]) as f:
+        rows = [int(h, 16) for h in re.findall(r"(?:0x)?[0-9a-fA-F]+", f.read())]
+    stream = encode(rows)
+    assert decode(stream) == rows
+    print("// %d rows in %d bytes" % (len(rows), len(stream)))
+    for i in range(0, len(stream), 8):
+        print("\t" + " ".join("0x%02X," % b for b in stream[i:i + 8]))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,296 @@
+#!/usr/bin/env python3
+"""Stream frames to the AVR Hero LED matrix over the serial port.
+
+The game must be showing the start screen - the first packet puts it into
+display server mode (see src/frameserver.h for the packet format). Frames
+are generated here by one of the built-in effects, sent as a full frame or
+as just the pixels that changed (whichever is smaller) and drawn on the
+matrix as they arrive.
+
+    frame_server.py /dev/ttyUSB0 plasma
+    frame_server.py /dev/ttyUSB0 life --frames 500
+
+Frames are sent as fast as the board takes them unless --fps is given. The
+frames per second achieved are printed every second (the board shows its
+own count on the terminal). Needs pyserial.
+"""
+
+import argparse
+import math
+import random
+import sys
+import time
+
+import serial
+
+STX = 0x02
+ACK = 0x06
+NAK = 0x15
+MAX_PAYLOAD = 32
+PALETTE_SIZE = 16
+COLUMNS = 16
+ROWS = 8
+# Packets that may be sent before the first of them is answered
+WINDOW = 2
+ANSWER_TIMEOUT = 1.0
+
+
+def crc8(data):
+    """CRC-8, polynomial 0x07, initial value 0 (avr-libc _crc8_ccitt_update)"""
+    crc = 0
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else crc << 1
+    return crc
+
+
+def colour(red, green):
+    """PixelColour with the given red and green levels (0 to 15)"""
+    return (green << 4) | red
+
+
+def runs(pixels):
+    """Run bytes (run length less one in the high four bits, palette index
+    in the low four) for a list of palette indexes"""
+    result = []
+    i = 0
+    while i < len(pixels):
+        length = 1
+        while (i + length < len(pixels) and length < 16
+               and pixels[i + length] == pixels[i]):
+            length += 1
+        result.append(((length - 1) << 4) | pixels[i])
+        i += length
+    return result
+
+
+def packet_payload(pixel, items):
+    return bytes([pixel & 0xFF, pixel >> 8]) + bytes(items)
+
+
+def encode_full(frame):
+    """'F' payloads for a whole frame (a list of rows, bottom row first).
+    Packets are split at the ends of rows so the board can send whole rows
+    to the matrix."""
+    payloads = []
+    pixel = 0
+    items = []
+    for y, row in enumerate(frame):
+        row_runs = runs(row)
+        if items and len(items) + len(row_runs) > MAX_PAYLOAD - 2:
+            payloads.append(packet_payload(pixel, items))
+            pixel = y * COLUMNS
+            items = []
+        items += row_runs
+    payloads.append(packet_payload(pixel, items))
+    return payloads
+
+
+def encode_delta(previous, frame):
+    """'D' payloads for the pixels of frame that differ from previous"""
+    old = [p for row in previous for p in row]
+    new = [p for row in frame for p in row]
+    changes = []    # (start, palette indexes) of each changed stretch
+    i = 0
+    while i < len(new):
+        if new[i] == old[i]:
+            i += 1
+            continue
+        start = i
+        while i < len(new) and new[i] != old[i]:
+            i += 1
+        changes.append((start, new[start:i]))
+
+    payloads = []
+    pixel = None    # pixel after the last run in the packet
+    items = []
+    for start, pixels in changes:
+        for run in runs(pixels):
+            if pixel is not None and (start - pixel > 255
+                                      or len(items) + 2 > MAX_PAYLOAD - 2):
+                payloads.append(packet_payload(first, items))
+                pixel = None
+            if pixel is None:
+                first = pixel = start
+                items = []
+            items += [start - pixel, run]
+            length = (run >> 4) + 1
+            start += length
+            pixel = start
+    if pixel is not None:
+        payloads.append(packet_payload(first, items))
+    return payloads
+
+
+def size(payloads):
+    return sum(len(p) + 5 for p in payloads)
+
+
+class Plasma:
+    palette = ([colour(15 - i * 2, i * 2) for i in range(8)]
+               + [colour(i * 2, 15 - i * 2) for i in range(8)])
+
+    def __init__(self):
+        self.t = 0.0
+
+    def frame(self):
+        self.t += 0.15
+        rows = []
+        for y in range(ROWS):
+            row = []
+            for x in range(COLUMNS):
+                v = (math.sin(x / 2.5 + self.t) + math.sin(y / 1.7 - self.t)
+                     + math.sin((x + y) / 4.0 + self.t / 2))
+                row.append(int((v + 3) / 6 * (PALETTE_SIZE - 1) + 0.5))
+            rows.append(row)
+        return rows
+
+
+class Life:
+    palette = [colour(0, 0), colour(0, 15), colour(15, 0)]
+
+    def __init__(self):
+        self.cells = self.random_cells()
+        self.generation = 0
+
+    @staticmethod
+    def random_cells():
+        return [[random.random() < 0.3 for _ in range(COLUMNS)]
+                for _ in range(ROWS)]
+
+    def frame(self):
+        cells = self.cells
+        new = [[False] * COLUMNS for _ in range(ROWS)]
+        for y in range(ROWS):
+            for x in range(COLUMNS):
+                n = sum(cells[(y + dy) % ROWS][(x + dx) % COLUMNS]
+                        for dy in (-1, 0, 1) for dx in (-1, 0, 1)
+                        if dx or dy)
+                new[y][x] = n == 3 or (cells[y][x] and n == 2)
+        self.generation += 1
+        if new == cells or self.generation > 200:
+            new = self.random_cells()
+            self.generation = 0
+        # New cells are red, ones that have lived on green
+        frame = [[(1 if cells[y][x] else 2) if new[y][x] else 0
+                  for x in range(COLUMNS)] for y in range(ROWS)]
+        self.cells = new
+        return frame
+
+
+EFFECTS = {"plasma": Plasma, "life": Life}
+
+
+class Link:
+    """Sends packets, keeping at most WINDOW of them unanswered"""
+
+    def __init__(self, port):
+        self.port = port
+        self.sequence = 0
+        self.outstanding = []
+        self.naks = 0
+        self.bytes_sent = 0
+
+    def send(self, command, payload=b""):
+        while len(self.outstanding) >= WINDOW:
+            self.wait_answer()
+        body = bytes([ord(command), self.sequence, len(payload)]) + payload
+        frame = bytes([STX]) + body + bytes([crc8(body)])
+        self.port.write(frame)
+        self.bytes_sent += len(frame)
+        self.outstanding.append(self.sequence)
+        self.sequence = (self.sequence + 1) & 0xFF
+
+    def wait_answer(self):
+        """Wait for the answer to the oldest packet sent. Anything else the
+        game prints (e.g. its frame count) is skipped."""
+        deadline = time.monotonic() + ANSWER_TIMEOUT
+        while time.monotonic() < deadline:
+            c = self.port.read(1)
+            if not c or c[0] not in (ACK, NAK):
+                continue
+            digits = self.port.read(2)
+            try:
+                sequence = int(digits, 16)
+            except ValueError:
+                continue
+            if sequence in self.outstanding:
+                # Anything older has been lost - its answer won't come
+                del self.outstanding[:self.outstanding.index(sequence) + 1]
+                if c[0] == NAK:
+                    self.naks += 1
+                return
+        sys.exit("no answer to packet %d" % self.outstanding[0])
+
+    def flush(self):
+        while self.outstanding:
+            self.wait_answer()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("port", help="serial port the game is connected to")
+    parser.add_argument("effect", choices=sorted(EFFECTS))
+    parser.add_argument("--frames", type=int, default=0,
+                        help="number of frames to send (default: until ^C)")
+    parser.add_argument("--fps", type=float, default=0,
+                        help="frame rate to send at (default: as fast as possible)")
+    parser.add_argument("--full", action="store_true",
+                        help="always send full frames")
+    parser.add_argument("--baud", type=int, default=19200)
+    args = parser.parse_args()
+
+    effect = EFFECTS[args.effect]()
+    port = serial.Serial(args.port, args.baud, timeout=0.1)
+    link = Link(port)
+
+    palette = effect.palette + [0] * (PALETTE_SIZE - len(effect.palette))
+    link.send("P", bytes([0] + palette))
+
+    previous = None
+    frames = 0
+    report_frames = 0
+    report_bytes = 0
+    report_time = time.monotonic()
+    next_frame_time = report_time
+    try:
+        while not args.frames or frames < args.frames:
+            frame = effect.frame()
+            full = encode_full(frame)
+            if previous is None or args.full or link.naks:
+                # (After a damaged packet the whole frame is sent again)
+                commands = [("F", p) for p in full]
+                link.naks = 0
+            else:
+                delta = encode_delta(previous, frame)
+                commands = ([("D", p) for p in delta]
+                            if size(delta) < size(full)
+                            else [("F", p) for p in full])
+            for command, payload in commands:
+                link.send(command, payload)
+            link.send("E")
+            previous = frame
+            frames += 1
+            report_frames += 1
+
+            now = time.monotonic()
+            if now - report_time >= 1.0:
+                print("%.1f frames/s, %.0f bytes/frame" % (
+                    report_frames / (now - report_time),
+                    (link.bytes_sent - report_bytes) / report_frames))
+                report_frames = 0
+                report_bytes = link.bytes_sent
+                report_time = now
+            if args.fps:
+                next_frame_time += 1 / args.fps
+                time.sleep(max(0.0, next_frame_time - time.monotonic()))
+    except KeyboardInterrupt:
+        pass
+    link.send("Q")
+    link.flush()
+    print("%d frames sent" % frames)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,25 @@
+# PlatformIO pre-build script (see extra_scripts in platformio.ini) that
+# generates the sources built from data files, so they always match:
+#   - the song library (src/songdata.c and .h) from the charts in songs/
+#   - the LED matrix animations (src/animdata.c and .h) from animations/
+
+import glob
+import os
+import sys
+
+Import("env")  # noqa: F821 - provided by PlatformIO
+
+project_dir = env["PROJECT_DIR"]  # noqa: F821
+src_dir = os.path.join(project_dir, "src")
+sys.path.insert(0, os.path.join(project_dir, "tools"))
+import anim_compiler  # noqa: E402
+import chart_compiler  # noqa: E402
+
+songs_dir = os.path.join(project_dir, "songs")
+with open(os.path.join(songs_dir, "library.txt")) as f:
+    charts = [os.path.join(songs_dir, line.strip()) for line in f
+              if line.strip() and not line.startswith("#")]
+chart_compiler.main(["-o", src_dir] + charts)
+
+animations = sorted(glob.glob(os.path.join(project_dir, "animations", "*.anim")))
+anim_compiler.main(["-o", src_dir] + animations)
@@ -0,0 +1,564 @@
+/*
+ * busload.c
+ *
+ * Author: Michael Blauberg
+ *
+ * SPI and serial port utilisation harness. Starts a game of the built-in
+ * song and, from the start of the game to the end, timestamps every byte
+ * sent to the LED matrix and out of the serial port. From these it works
+ * out how busy each bus was in every window of time (10ms unless -w is
+ * given), the longest burst of back-to-back bytes and how much of the
+ * CPU's time was spent inside spi_send_byte() and uart_put_char(), which
+ * busy-wait for the SPI transfer to finish and for space in the serial
+ * output buffer.
+ *
+ * A byte is seen when the firmware writes it to SPDR0 or UDR0, so it is
+ * taken to be on the wire from then (or, for the serial port, once the
+ * byte before it has been sent) for its transfer time. The transfer times
+ * come from the SPI and USART registers as each byte is written, so any
+ * divider or baud rate the firmware chooses is accounted for.
+ *
+ * Usage: busload [-w window_ms] [-k keys] [-c file.csv] [-o file.vcd]
+ *                [-m mmcu] firmware.elf
+ *   -w  length of the windows the busy fraction is worked out over (ms)
+ *   -k  keys typed on the start screen before the game is started (e.g.
+ *       "3" for the extreme speed or ":spi 16\n" - see shell.h)
+ *   -c  write each window's busy fractions and byte counts as CSV
+ *   -o  write the bytes and the steps of the game as a VCD file, for a
+ *       waveform viewer such as GTKWave
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "harness.h"
+
+#define SESSION_TIMEOUT_US (15ULL * 60 * 1000000)
+#define SETUP_US 1500000
+#define START_PRESS_DELAY_US 300000
+#define BUTTON_HOLD_US 5000
+
+// Data space addresses of the ATmega324A registers the transfer times are
+// worked out from
+#define SPCR0_ADDR	0x4C
+#define SPSR0_ADDR	0x4D
+#define UCSR0A_ADDR	0xC0
+#define UBRR0L_ADDR	0xC4
+#define UBRR0H_ADDR	0xC5
+#define SPI2X0_BIT	0
+#define U2X0_BIT	1
+
+// Bits in a serial character (start, 8 data, stop)
+#define UART_FRAME_BITS 10
+
+// Bytes less than this many byte times apart are part of the same burst
+#define BURST_GAP_BYTES 1
+
+#define HISTOGRAM_BUCKETS 10
+
+#define NUM_BUSES 2
+#define BUS_SPI 0
+#define BUS_UART 1
+
+typedef struct
+{
+	const char* name;
+	const char* function;	// the firmware function that sends a byte
+
+	uint32_t bytes;
+	uint64_t busy_ns;
+	uint64_t free_ns;		// when the last byte has been sent
+
+	// Busy time and bytes in each window
+	uint64_t* window_busy_ns;
+	uint32_t* window_bytes;
+	int num_windows;
+
+	// Current and longest bursts of back-to-back bytes
+	uint64_t burst_start_ns;
+	uint32_t burst_bytes;
+	uint64_t longest_burst_ns;
+	uint32_t longest_burst_bytes;
+	uint64_t longest_burst_at_ns;
+
+	// Where the sending function is in flash, and the cycles spent in it
+	int found;
+	uint32_t function_start;
+	uint32_t function_end;
+	uint64_t function_cycles;
+} Bus;
+
+// A change of a signal in the VCD file
+typedef struct
+{
+	uint64_t time_ns;
+	uint32_t order;			// keeps changes at the same time in order
+	char id;
+	uint8_t width;
+	uint32_t value;
+} VcdChange;
+
+typedef struct
+{
+	Bus buses[NUM_BUSES];
+	uint64_t window_ns;
+	uint32_t frequency;
+
+	int playing;
+	uint64_t start_ns;
+	uint64_t end_ns;
+	uint64_t start_cycle;
+	uint64_t end_cycle;
+	uint64_t last_cycle;
+	uint32_t last_pc;
+	uint32_t steps;
+
+	int vcd;
+	VcdChange* changes;
+	uint32_t num_changes;
+	uint32_t max_changes;
+} Run;
+
+static uint64_t now_ns(const Harness* h)
+{
+	return h->avr->cycle * 1000000000ULL / h->avr->frequency;
+}
+
+static void* grow(void* array, size_t size)
+{
+	void* grown = realloc(array, size);
+	if (!grown)
+	{
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	return grown;
+}
+
+static void add_change(Run* r, uint64_t time_ns, char id, uint8_t width,
+		uint32_t value)
+{
+	if (!r->vcd)
+	{
+		return;
+	}
+	if (r->num_changes == r->max_changes)
+	{
+		r->max_changes = r->max_changes ? r->max_changes * 2 : 4096;
+		r->changes = grow(r->changes, r->max_changes * sizeof(VcdChange));
+	}
+	VcdChange* change = &r->changes[r->num_changes];
+	change->time_ns = time_ns;
+	change->order = r->num_changes++;
+	change->id = id;
+	change->width = width;
+	change->value = value;
+}
+
+// Make sure the bus has windows up to and including the given one
+static void add_windows(Bus* bus, int window)
+{
+	if (window < bus->num_windows)
+	{
+		return;
+	}
+	int count = window + 1;
+	bus->window_busy_ns = grow(bus->window_busy_ns,
+			count * sizeof(bus->window_busy_ns[0]));
+	bus->window_bytes = grow(bus->window_bytes,
+			count * sizeof(bus->window_bytes[0]));
+	for (int i = bus->num_windows; i < count; i++)
+	{
+		bus->window_busy_ns[i] = 0;
+		bus->window_bytes[i] = 0;
+	}
+	bus->num_windows = count;
+}
+
+// Record a byte on the wire from start to end (ns since the game started)
+static void add_byte(Run* r, int which, uint64_t start, uint64_t end)
+{
+	Bus* bus = &r->buses[which];
+	uint64_t byte_ns = end - start;
+
+	bus->bytes++;
+	bus->busy_ns += byte_ns;
+	add_windows(bus, end / r->window_ns);
+	bus->window_bytes[start / r->window_ns]++;
+	// Split the busy time between the windows the byte falls in
+	for (uint64_t from = start; from < end; )
+	{
+		int window = from / r->window_ns;
+		uint64_t window_end = (window + 1) * r->window_ns;
+		uint64_t until = end < window_end ? end : window_end;
+		bus->window_busy_ns[window] += until - from;
+		from = until;
+	}
+
+	if (bus->burst_bytes && start < bus->free_ns + BURST_GAP_BYTES * byte_ns)
+	{
+		bus->burst_bytes++;
+	}
+	else
+	{
+		bus->burst_start_ns = start;
+		bus->burst_bytes = 1;
+	}
+	if (end - bus->burst_start_ns > bus->longest_burst_ns)
+	{
+		bus->longest_burst_ns = end - bus->burst_start_ns;
+		bus->longest_burst_bytes = bus->burst_bytes;
+		bus->longest_burst_at_ns = bus->burst_start_ns;
+	}
+	bus->free_ns = end;
+}
+
+static void spi_byte(Harness* h, uint8_t byte)
+{
+	static const uint8_t dividers[] = {4, 16, 64, 128};
+	Run* r = h->user;
+
+	if (!r->playing)
+	{
+		return;
+	}
+	uint32_t divider = dividers[h->avr->data[SPCR0_ADDR] & 0x03];
+	if (h->avr->data[SPSR0_ADDR] & (1 << SPI2X0_BIT))
+	{
+		divider /= 2;
+	}
+	uint64_t start = now_ns(h) - r->start_ns;
+	uint64_t end = start + 8 * divider * 1000000000ULL / h->avr->frequency;
+	add_byte(r, BUS_SPI, start, end);
+	add_change(r, start, 's', 8, byte);
+	add_change(r, start, 'S', 1, 1);
+	add_change(r, end, 'S', 1, 0);
+}
+
+static void uart_byte(Harness* h, uint8_t byte)
+{
+	Run* r = h->user;
+	Bus* bus = &r->buses[BUS_UART];
+
+	if (!r->playing)
+	{
+		return;
+	}
+	uint32_t ubrr = h->avr->data[UBRR0L_ADDR]
+			| (h->avr->data[UBRR0H_ADDR] & 0x0F) << 8;
+	uint32_t clocks_per_bit = (ubrr + 1)
+			* ((h->avr->data[UCSR0A_ADDR] & (1 << U2X0_BIT)) ? 8 : 16);
+	// UDR0 is buffered, so a byte waits for the one before to be sent
+	uint64_t start = now_ns(h) - r->start_ns;
+	if (bus->bytes && start < bus->free_ns)
+	{
+		start = bus->free_ns;
+	}
+	uint64_t end = start + UART_FRAME_BITS * clocks_per_bit * 1000000000ULL
+			/ h->avr->frequency;
+	add_byte(r, BUS_UART, start, end);
+	add_change(r, start, 'u', 8, byte);
+	add_change(r, start, 'U', 1, 1);
+	add_change(r, end, 'U', 1, 0);
+}
+
+// Charge the instruction just run to the function it was in
+static void step(Harness* h)
+{
+	Run* r = h->user;
+	if (r->playing)
+	{
+		uint64_t cycles = h->avr->cycle - r->last_cycle;
+		for (int i = 0; i < NUM_BUSES; i++)
+		{
+			Bus* bus = &r->buses[i];
+			if (r->last_pc >= bus->function_start
+					&& r->last_pc < bus->function_end)
+			{
+				bus->function_cycles += cycles;
+			}
+		}
+	}
+	r->last_cycle = h->avr->cycle;
+	r->last_pc = h->avr->pc;
+}
+
+static void marker(Harness* h, uint8_t event, uint8_t payload)
+{
+	Run* r = h->user;
+
+	switch (event)
+	{
+		case SIM_EVENT_GAME_START:
+			r->playing = 1;
+			r->start_ns = now_ns(h);
+			r->start_cycle = h->avr->cycle;
+			add_change(r, 0, 'n', 16, 0);
+			break;
+		case SIM_EVENT_BEAT:
+			if (r->playing)
+			{
+				add_change(r, now_ns(h) - r->start_ns, 'n', 16, ++r->steps);
+			}
+			break;
+		case SIM_EVENT_GAME_OVER:
+			if (r->playing)
+			{
+				r->playing = 0;
+				r->end_ns = now_ns(h);
+				r->end_cycle = h->avr->cycle;
+				h->done = 1;
+			}
+			break;
+	}
+}
+
+static int compare_changes(const void* a, const void* b)
+{
+	const VcdChange* x = a;
+	const VcdChange* y = b;
+	if (x->time_ns != y->time_ns)
+	{
+		return x->time_ns < y->time_ns ? -1 : 1;
+	}
+	return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static int write_vcd(Run* r, const char* filename)
+{
+	FILE* file = fopen(filename, "w");
+	if (!file)
+	{
+		fprintf(stderr, "Unable to write %s\n", filename);
+		return -1;
+	}
+	fprintf(file, "$timescale 1ns $end\n"
+			"$scope module avr_hero $end\n"
+			"$var wire 8 s spi_byte $end\n"
+			"$var wire 1 S spi_busy $end\n"
+			"$var wire 8 u uart_byte $end\n"
+			"$var wire 1 U uart_busy $end\n"
+			"$var integer 16 n step $end\n"
+			"$upscope $end\n"
+			"$enddefinitions $end\n"
+			"$dumpvars\nbxxxxxxxx s\n0S\nbxxxxxxxx u\n0U\nb0 n\n$end\n");
+
+	qsort(r->changes, r->num_changes, sizeof(VcdChange), compare_changes);
+	uint64_t time = UINT64_MAX;
+	for (uint32_t i = 0; i < r->num_changes; i++)
+	{
+		VcdChange* change = &r->changes[i];
+		if (change->time_ns != time)
+		{
+			time = change->time_ns;
+			fprintf(file, "#%llu\n", (unsigned long long)time);
+		}
+		if (change->width == 1)
+		{
+			fprintf(file, "%u%c\n", change->value, change->id);
+			continue;
+		}
+		fputc('b', file);
+		for (int bit = change->width - 1; bit >= 0; bit--)
+		{
+			fputc(change->value >> bit & 1 ? '1' : '0', file);
+		}
+		fprintf(file, " %c\n", change->id);
+	}
+	fclose(file);
+	return 0;
+}
+
+static int write_csv(Run* r, const char* filename)
+{
+	FILE* file = fopen(filename, "w");
+	if (!file)
+	{
+		fprintf(stderr, "Unable to write %s\n", filename);
+		return -1;
+	}
+	int num_windows = (r->end_ns - r->start_ns + r->window_ns - 1)
+			/ r->window_ns;
+	fprintf(file, "start_ms");
+	for (int b = 0; b < NUM_BUSES; b++)
+	{
+		fprintf(file, ",%s_busy_pct,%s_bytes", r->buses[b].name,
+				r->buses[b].name);
+	}
+	fprintf(file, "\n");
+	for (int i = 0; i < num_windows; i++)
+	{
+		fprintf(file, "%.3f", i * r->window_ns / 1e6);
+		for (int b = 0; b < NUM_BUSES; b++)
+		{
+			Bus* bus = &r->buses[b];
+			add_windows(bus, i);
+			fprintf(file, ",%.1f,%u",
+					100.0 * bus->window_busy_ns[i] / r->window_ns,
+					bus->window_bytes[i]);
+		}
+		fprintf(file, "\n");
+	}
+	fclose(file);
+	return 0;
+}
+
+static void report(Run* r)
+{
+	double seconds = (r->end_ns - r->start_ns) / 1e9;
+	uint64_t cycles = r->end_cycle - r->start_cycle;
+	// Only whole windows count towards the busiest and the histogram
+	int num_windows = (r->end_ns - r->start_ns) / r->window_ns;
+
+	printf("Game of %.2f s (%u steps), %.1f ms windows\n", seconds, r->steps,
+			r->window_ns / 1e6);
+	for (int b = 0; b < NUM_BUSES; b++)
+	{
+		Bus* bus = &r->buses[b];
+		int histogram[HISTOGRAM_BUCKETS] = {0};
+		int busiest = 0;
+
+		add_windows(bus, num_windows);
+		for (int i = 0; i < num_windows; i++)
+		{
+			int bucket = HISTOGRAM_BUCKETS * bus->window_busy_ns[i]
+					/ r->window_ns;
+			histogram[bucket < HISTOGRAM_BUCKETS ? bucket
+					: HISTOGRAM_BUCKETS - 1]++;
+			if (bus->window_busy_ns[i] > bus->window_busy_ns[busiest])
+			{
+				busiest = i;
+			}
+		}
+
+		printf("\n%s: %u bytes (%.0f bytes/s), busy %.1f%% of the game\n",
+				bus->name, bus->bytes, bus->bytes / seconds,
+				100.0 * bus->busy_ns / (r->end_ns - r->start_ns));
+		if (num_windows)
+		{
+			printf("  busiest window %.1f%% at %.1f ms (%u bytes)\n",
+					100.0 * bus->window_busy_ns[busiest] / r->window_ns,
+					busiest * r->window_ns / 1e6, bus->window_bytes[busiest]);
+		}
+		printf("  longest burst %.3f ms (%u bytes) at %.1f ms\n",
+				bus->longest_burst_ns / 1e6, bus->longest_burst_bytes,
+				bus->longest_burst_at_ns / 1e6);
+		if (bus->found)
+		{
+			printf("  in %s(): %.1f ms, %.2f%% of the CPU\n", bus->function,
+					bus->function_cycles * 1e3 / r->frequency,
+					100.0 * bus->function_cycles / (cycles ? cycles : 1));
+		}
+		printf("  windows by busy fraction:\n");
+		for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+		{
+			printf("    %3d-%3d%% %6d\n", i * 100 / HISTOGRAM_BUCKETS,
+					(i + 1) * 100 / HISTOGRAM_BUCKETS, histogram[i]);
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	static Harness harness;
+	static Run run;
+	const char* mmcu = NULL;
+	const char* keys = NULL;
+	const char* csv = NULL;
+	const char* vcd = NULL;
+	double window_ms = 10;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "w:k:c:o:m:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'w':
+				window_ms = atof(optarg);
+				break;
+			case 'k':
+				keys = optarg;
+				break;
+			case 'c':
+				csv = optarg;
+				break;
+			case 'o':
+				vcd = optarg;
+				break;
+			case 'm':
+				mmcu = optarg;
+				break;
+			default:
+				optind = argc;
+				break;
+		}
+	}
+	if (argc - optind != 1 || window_ms <= 0)
+	{
+		fprintf(stderr, "Usage: %s [-w window_ms] [-k keys] [-c file.csv] "
+				"[-o file.vcd] [-m mmcu] firmware.elf\n", argv[0]);
+		return 2;
+	}
+	const char* firmware = argv[optind];
+
+	run.window_ns = window_ms * 1e6;
+	run.vcd = vcd != NULL;
+	run.buses[BUS_SPI].name = "spi";
+	run.buses[BUS_SPI].function = "spi_send_byte";
+	run.buses[BUS_UART].name = "uart";
+	run.buses[BUS_UART].function = "uart_put_char";
+	for (int b = 0; b < NUM_BUSES; b++)
+	{
+		Bus* bus = &run.buses[b];
+		bus->found = harness_find_function(firmware, bus->function,
+				&bus->function_start, &bus->function_end) == 0;
+		if (!bus->found)
+		{
+			fprintf(stderr, "%s() not found in %s - its time won't be "
+					"counted\n", bus->function, firmware);
+		}
+	}
+
+	if (harness_init(&harness, firmware, mmcu) != 0)
+	{
+		return 1;
+	}
+	harness.user = &run;
+	harness.on_marker = marker;
+	harness.on_spi = spi_byte;
+	harness.on_uart = uart_byte;
+	harness.on_step = step;
+	run.frequency = harness.avr->frequency;
+
+	harness_run(&harness, SETUP_US);
+	if (keys)
+	{
+		harness_type(&harness, keys);
+	}
+	harness_press_button(&harness, 0, START_PRESS_DELAY_US, BUTTON_HOLD_US);
+	if (harness_run(&harness, SESSION_TIMEOUT_US) != 0)
+	{
+		printf("Game did not finish\n");
+		return 1;
+	}
+
+	report(&run);
+
+	// Stack and static RAM once the game is over
+	HarnessRam ram;
+	if (harness_ram_report(&harness, &ram) == 0)
+	{
+		putchar('\n');
+		harness_print_ram(&ram);
+	}
+	if (csv && write_csv(&run, csv) != 0)
+	{
+		return 1;
+	}
+	if (vcd && write_vcd(&run, vcd) != 0)
+	{
+		return 1;
+	}
+	return 0;
+}
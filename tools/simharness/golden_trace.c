@@ -0,0 +1,351 @@
+/*
+ * golden_trace.c
+ *
+ * Author: Michael Blauberg
+ *
+ * Golden trace regression harness for renderer changes. Plays a scripted
+ * session (button presses at given beats) against the firmware and, after
+ * every beat, compares what is on the LED matrix with a committed golden
+ * trace. It is the decoded screen that is compared, not the SPI byte
+ * stream, so a renderer that sends fewer bytes but shows the same thing
+ * passes. The number of SPI bytes sent for each beat is reported so any
+ * saving can be seen.
+ *
+ * Usage: golden_trace [-u] [-v] [-m mmcu] firmware.elf session.txt golden.txt
+ *   -u  write (update) the golden trace instead of checking against it
+ *   -v  print the SPI bytes sent for every beat
+ *
+ * Session files have one "beat button" pair per line. The button is
+ * pushed just after the notes advance to that beat. Lines starting
+ * with # are ignored.
+ *
+ * Golden files have one line per beat: the beat number, the SPI bytes sent
+ * for the beat and then every pixel that changed since the previous beat
+ * as xy=cc (column, row and colour in hex).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "harness.h"
+
+#define MAX_PRESSES 4096
+#define MAX_LINE 4096
+
+// Time from pressing the start button to the end of a song. Anything
+// longer than this has hung.
+#define SESSION_TIMEOUT_US (15ULL * 60 * 1000000)
+#define BUTTON_HOLD_US 10000
+#define START_PRESS_DELAY_US 100000
+
+typedef struct
+{
+	uint16_t beat;
+	uint8_t button;
+} Press;
+
+typedef struct
+{
+	Press presses[MAX_PRESSES];
+	int num_presses;
+	int next_press;
+
+	int update;
+	int verbose;
+	FILE* golden;
+
+	int playing;
+	uint16_t beat;
+	uint32_t beat_start_bytes;
+	PixelColour previous[MATRIX_NUM_COLUMNS][MATRIX_NUM_ROWS];
+	PixelColour expected[MATRIX_NUM_COLUMNS][MATRIX_NUM_ROWS];
+
+	uint32_t bytes_total;
+	uint32_t golden_bytes_total;
+	uint32_t bytes_max;
+	int beats_checked;
+	int beats_failed;
+	int golden_ended;
+} Trace;
+
+static int load_session(Trace* t, const char* path)
+{
+	FILE* f = fopen(path, "r");
+	char line[MAX_LINE];
+	unsigned beat, button;
+
+	if (f == NULL)
+	{
+		perror(path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f))
+	{
+		if (line[0] == '#' || sscanf(line, "%u %u", &beat, &button) != 2)
+		{
+			continue;
+		}
+		if (t->num_presses == MAX_PRESSES)
+		{
+			fprintf(stderr, "%s: too many presses\n", path);
+			break;
+		}
+		t->presses[t->num_presses].beat = beat;
+		t->presses[t->num_presses].button = button;
+		t->num_presses++;
+	}
+	fclose(f);
+	return 0;
+}
+
+// Write the pixels that changed this beat to the golden file
+static void write_beat(Trace* t, Harness* h, uint32_t bytes)
+{
+	fprintf(t->golden, "%u %u", t->beat, bytes);
+	for (uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++)
+	{
+		for (uint8_t y = 0; y < MATRIX_NUM_ROWS; y++)
+		{
+			if (h->matrix.pixels[x][y] != t->previous[x][y])
+			{
+				fprintf(t->golden, " %x%x=%02x", x, y, h->matrix.pixels[x][y]);
+			}
+		}
+	}
+	fputc('\n', t->golden);
+}
+
+// Read the next beat from the golden file and check the screen against it
+static void check_beat(Trace* t, Harness* h, uint32_t bytes)
+{
+	char line[MAX_LINE];
+	unsigned golden_beat, golden_bytes;
+	int offset;
+
+	t->beats_checked++;
+	if (t->golden_ended || !fgets(line, sizeof(line), t->golden)
+			|| sscanf(line, "%u %u%n", &golden_beat, &golden_bytes, &offset) != 2)
+	{
+		if (!t->golden_ended)
+		{
+			printf("beat %u: golden trace ended early\n", t->beat);
+		}
+		t->golden_ended = 1;
+		t->beats_failed++;
+		return;
+	}
+	t->golden_bytes_total += golden_bytes;
+	if (golden_beat != t->beat)
+	{
+		printf("beat %u: golden trace is at beat %u\n", t->beat, golden_beat);
+	}
+
+	// Apply the changes to our copy of the expected screen
+	char* p = line + offset;
+	unsigned xy, colour;
+	int n;
+	while (sscanf(p, " %2x=%2x%n", &xy, &colour, &n) == 2)
+	{
+		t->expected[xy >> 4][xy & 0x0F] = colour;
+		p += n;
+	}
+
+	int mismatches = 0;
+	for (uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++)
+	{
+		for (uint8_t y = 0; y < MATRIX_NUM_ROWS; y++)
+		{
+			if (h->matrix.pixels[x][y] != t->expected[x][y])
+			{
+				if (mismatches++ == 0)
+				{
+					printf("beat %u:", t->beat);
+				}
+				printf(" (%u,%u) is %02x not %02x", x, y,
+						h->matrix.pixels[x][y], t->expected[x][y]);
+			}
+		}
+	}
+	if (mismatches)
+	{
+		putchar('\n');
+		t->beats_failed++;
+	}
+}
+
+static void end_of_beat(Trace* t, Harness* h)
+{
+	uint32_t bytes = h->spi_bytes - t->beat_start_bytes;
+
+	if (matrix_model_busy(&h->matrix))
+	{
+		printf("beat %u: LED matrix command still in progress\n", t->beat);
+	}
+	if (t->verbose)
+	{
+		printf("beat %u: %u SPI bytes\n", t->beat, bytes);
+	}
+	t->bytes_total += bytes;
+	if (bytes > t->bytes_max)
+	{
+		t->bytes_max = bytes;
+	}
+	if (t->update)
+	{
+		write_beat(t, h, bytes);
+	}
+	else
+	{
+		check_beat(t, h, bytes);
+	}
+	memcpy(t->previous, h->matrix.pixels, sizeof(t->previous));
+	t->beat_start_bytes = h->spi_bytes;
+
+	// Push any buttons scripted for this beat
+	while (t->next_press < t->num_presses
+			&& t->presses[t->next_press].beat <= t->beat)
+	{
+		if (t->presses[t->next_press].beat == t->beat)
+		{
+			harness_press_button(h, t->presses[t->next_press].button, 1000,
+					BUTTON_HOLD_US);
+		}
+		t->next_press++;
+	}
+}
+
+static void marker(Harness* h, uint8_t event, uint8_t payload)
+{
+	Trace* t = h->user;
+
+	switch (event)
+	{
+		case SIM_EVENT_GAME_START:
+			// The screen as the game starts is beat 0. (Any bytes sent
+			// before now are the start screen and countdown.)
+			t->playing = 1;
+			t->beat = 0;
+			t->beat_start_bytes = h->spi_bytes;
+			end_of_beat(t, h);
+			break;
+		case SIM_EVENT_BEAT:
+			if (!t->playing)
+			{
+				break;
+			}
+			t->beat++;
+			if ((t->beat & 0xFF) != payload)
+			{
+				printf("beat %u: firmware reports beat %u (mod 256)\n",
+						t->beat, payload);
+			}
+			end_of_beat(t, h);
+			break;
+		case SIM_EVENT_GAME_OVER:
+			if (t->playing)
+			{
+				h->done = 1;
+			}
+			break;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	static Trace trace;
+	static Harness harness;
+	const char* mmcu = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "uvm:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'u':
+				trace.update = 1;
+				break;
+			case 'v':
+				trace.verbose = 1;
+				break;
+			case 'm':
+				mmcu = optarg;
+				break;
+			default:
+				optind = argc;
+				break;
+		}
+	}
+	if (argc - optind != 3)
+	{
+		fprintf(stderr, "Usage: %s [-u] [-v] [-m mmcu] firmware.elf "
+				"session.txt golden.txt\n", argv[0]);
+		return 2;
+	}
+	if (load_session(&trace, argv[optind + 1]) != 0)
+	{
+		return 2;
+	}
+	trace.golden = fopen(argv[optind + 2], trace.update ? "w" : "r");
+	if (trace.golden == NULL)
+	{
+		perror(argv[optind + 2]);
+		return 2;
+	}
+	if (harness_init(&harness, argv[optind], mmcu) != 0)
+	{
+		return 2;
+	}
+	harness.user = &trace;
+	harness.on_marker = marker;
+
+	// Leave the start screen
+	harness_press_button(&harness, 0, START_PRESS_DELAY_US, BUTTON_HOLD_US);
+	if (harness_run(&harness, SESSION_TIMEOUT_US) != 0)
+	{
+		printf("Session did not reach game over (beat %u)\n", trace.beat);
+		return 1;
+	}
+
+	if (!trace.update)
+	{
+		char line[MAX_LINE];
+		if (!trace.golden_ended && fgets(line, sizeof(line), trace.golden))
+		{
+			printf("Game ended at beat %u but the golden trace continues\n",
+					trace.beat);
+			trace.beats_failed++;
+		}
+	}
+	fclose(trace.golden);
+
+	printf("%d beats, %u SPI bytes (max %u in a beat)", trace.beats_checked
+			? trace.beats_checked : trace.beat + 1, trace.bytes_total,
+			trace.bytes_max);
+	if (!trace.update && trace.golden_bytes_total)
+	{
+		long saved = (long)trace.golden_bytes_total - (long)trace.bytes_total;
+		printf(", golden %u (%+.1f%%)", trace.golden_bytes_total,
+				-100.0 * saved / trace.golden_bytes_total);
+	}
+	putchar('\n');
+
+	// Stack and static RAM once the session is over
+	HarnessRam ram;
+	if (harness_ram_report(&harness, &ram) == 0)
+	{
+		harness_print_ram(&ram);
+	}
+	else
+	{
+		printf("No answer to :ram\n");
+	}
+	if (trace.update)
+	{
+		printf("Golden trace written to %s\n", argv[optind + 2]);
+		return 0;
+	}
+	printf("%s: %d of %d beats differ\n", trace.beats_failed ? "FAIL" : "PASS",
+			trace.beats_failed, trace.beats_checked);
+	return trace.beats_failed ? 1 : 0;
+}
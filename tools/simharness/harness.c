@@ -0,0 +1,442 @@
+/*
+ * harness.c
+ *
+ * Author: Michael Blauberg
+ *
+ * See harness.h.
+ */
+
+#include "harness.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <gelf.h>
+#include "sim_elf.h"
+#include "sim_time.h"
+#include "avr_ioport.h"
+#include "avr_spi.h"
+#include "avr_uart.h"
+
+#define DEFAULT_MMCU "atmega324a"
+#define DEFAULT_FREQUENCY 8000000
+
+// Time between characters typed on the serial port. One character takes
+// about 520us at 19200 baud, so this is a little slower than the line.
+#define SERIAL_CHAR_US 1000
+
+// Longest wait for the answer to :ram (a couple of thousand characters at
+// most), and the space to collect it in
+#define RAM_REPORT_US 3000000
+#define RAM_REPORT_SIZE 4096
+
+// The answer to :ram as it arrives, with each terminal escape sequence
+// replaced by a line break
+static char ram_text[RAM_REPORT_SIZE];
+static size_t ram_length;
+static int ram_escape;
+
+static void spi_output(struct avr_irq_t* irq, uint32_t value, void* param)
+{
+	Harness* h = param;
+	h->spi_bytes++;
+	matrix_model_byte(&h->matrix, (uint8_t)value);
+	if (h->on_spi)
+	{
+		h->on_spi(h, (uint8_t)value);
+	}
+}
+
+static void uart_output(struct avr_irq_t* irq, uint32_t value, void* param)
+{
+	Harness* h = param;
+	h->uart_bytes++;
+	if (h->on_uart)
+	{
+		h->on_uart(h, (uint8_t)value);
+	}
+}
+
+static void marker_write(struct avr_t* avr, avr_io_addr_t addr, uint8_t v,
+		void* param)
+{
+	Harness* h = param;
+	avr->data[addr] = v;
+	if (h->on_marker)
+	{
+		h->on_marker(h, v, avr->data[SIM_MARKER_PAYLOAD_ADDR]);
+	}
+}
+
+int harness_init(Harness* h, const char* firmware, const char* mmcu)
+{
+	elf_firmware_t f;
+
+	memset(h, 0, sizeof(*h));
+	memset(&f, 0, sizeof(f));
+	if (elf_read_firmware(firmware, &f) != 0)
+	{
+		fprintf(stderr, "Unable to load firmware %s\n", firmware);
+		return -1;
+	}
+	if (mmcu == NULL)
+	{
+		mmcu = f.mmcu[0] ? f.mmcu : DEFAULT_MMCU;
+	}
+	if (f.frequency == 0)
+	{
+		f.frequency = DEFAULT_FREQUENCY;
+	}
+	h->avr = avr_make_mcu_by_name(mmcu);
+	if (h->avr == NULL)
+	{
+		fprintf(stderr, "Unknown AVR part %s\n", mmcu);
+		return -1;
+	}
+	avr_init(h->avr);
+	avr_load_firmware(h->avr, &f);
+
+	matrix_model_init(&h->matrix);
+
+	// Don't let simavr echo the serial port to stdout - the harnesses
+	// print their own reports.
+	uint32_t flags = 0;
+	avr_ioctl(h->avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+	flags &= ~AVR_UART_FLAG_STDIO;
+	avr_ioctl(h->avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+	flags = 0;
+	avr_ioctl(h->avr, AVR_IOCTL_UART_GET_FLAGS('1'), &flags);
+	flags &= ~AVR_UART_FLAG_STDIO;
+	avr_ioctl(h->avr, AVR_IOCTL_UART_SET_FLAGS('1'), &flags);
+
+	avr_irq_register_notify(
+			avr_io_getirq(h->avr, AVR_IOCTL_SPI_GETIRQ(0), SPI_IRQ_OUTPUT),
+			spi_output, h);
+	avr_irq_register_notify(
+			avr_io_getirq(h->avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT),
+			uart_output, h);
+	avr_register_io_write(h->avr, SIM_MARKER_EVENT_ADDR, marker_write, h);
+
+	for (uint8_t i = 0; i < HARNESS_NUM_BUTTONS; i++)
+	{
+		h->button_events[i].harness = h;
+		h->button_events[i].button = i;
+	}
+	return 0;
+}
+
+int harness_run(Harness* h, uint64_t max_us)
+{
+	avr_cycle_count_t limit = avr_usec_to_cycles(h->avr, max_us);
+	int state = cpu_Running;
+
+	while (!h->done && h->avr->cycle < limit
+			&& state != cpu_Done && state != cpu_Crashed)
+	{
+		state = avr_run(h->avr);
+		if (h->on_step)
+		{
+			h->on_step(h);
+		}
+	}
+	if (state == cpu_Crashed)
+	{
+		fprintf(stderr, "Firmware crashed at %llu us\n",
+				(unsigned long long)harness_now_us(h));
+	}
+	return h->done ? 0 : -1;
+}
+
+int harness_run_boards(Harness* boards[], int num_boards, uint64_t max_us)
+{
+	int state[num_boards];
+	int done = 0;
+
+	for (int i = 0; i < num_boards; i++)
+	{
+		state[i] = cpu_Running;
+	}
+	while (!done)
+	{
+		// Run whichever board is furthest behind
+		int next = -1;
+		for (int i = 0; i < num_boards; i++)
+		{
+			if (boards[i]->done)
+			{
+				done = 1;
+			}
+			if (state[i] == cpu_Done || state[i] == cpu_Crashed
+					|| harness_now_us(boards[i]) >= max_us)
+			{
+				continue;
+			}
+			if (next < 0
+					|| harness_now_us(boards[i]) < harness_now_us(boards[next]))
+			{
+				next = i;
+			}
+		}
+		if (done || next < 0)
+		{
+			break;
+		}
+		state[next] = avr_run(boards[next]->avr);
+		if (boards[next]->on_step)
+		{
+			boards[next]->on_step(boards[next]);
+		}
+		if (state[next] == cpu_Crashed)
+		{
+			fprintf(stderr, "Board %d crashed at %llu us\n", next,
+					(unsigned long long)harness_now_us(boards[next]));
+		}
+	}
+	return done ? 0 : -1;
+}
+
+// Pass a byte sent from one board's USART1 to another's
+static void link_output(struct avr_irq_t* irq, uint32_t value, void* param)
+{
+	Harness* to = param;
+	avr_raise_irq(avr_io_getirq(to->avr, AVR_IOCTL_UART_GETIRQ('1'),
+			UART_IRQ_INPUT), (uint8_t)value);
+}
+
+void harness_link(Harness* leader, Harness* follower)
+{
+	avr_irq_register_notify(avr_io_getirq(leader->avr,
+			AVR_IOCTL_UART_GETIRQ('1'), UART_IRQ_OUTPUT), link_output,
+			follower);
+	avr_irq_register_notify(avr_io_getirq(follower->avr,
+			AVR_IOCTL_UART_GETIRQ('1'), UART_IRQ_OUTPUT), link_output,
+			leader);
+}
+
+int harness_find_function(const char* firmware, const char* name,
+		uint32_t* start, uint32_t* end)
+{
+	int result = -1;
+	int fd = open(firmware, O_RDONLY);
+	if (fd < 0)
+	{
+		return -1;
+	}
+	elf_version(EV_CURRENT);
+	Elf* elf = elf_begin(fd, ELF_C_READ, NULL);
+	Elf_Scn* section = NULL;
+	while (result != 0 && elf && (section = elf_nextscn(elf, section)))
+	{
+		GElf_Shdr header;
+		if (!gelf_getshdr(section, &header) || header.sh_type != SHT_SYMTAB)
+		{
+			continue;
+		}
+		Elf_Data* data = elf_getdata(section, NULL);
+		size_t count = header.sh_size / header.sh_entsize;
+		for (size_t i = 0; i < count; i++)
+		{
+			GElf_Sym symbol;
+			const char* symbol_name;
+			if (!gelf_getsym(data, i, &symbol)
+					|| GELF_ST_TYPE(symbol.st_info) != STT_FUNC)
+			{
+				continue;
+			}
+			symbol_name = elf_strptr(elf, header.sh_link, symbol.st_name);
+			if (symbol_name && strcmp(symbol_name, name) == 0)
+			{
+				*start = symbol.st_value;
+				*end = symbol.st_value + symbol.st_size;
+				result = 0;
+				break;
+			}
+		}
+	}
+	if (elf)
+	{
+		elf_end(elf);
+	}
+	close(fd);
+	return result;
+}
+
+static void ram_output(Harness* h, uint8_t byte)
+{
+	if (ram_escape)
+	{
+		// An escape sequence ends with a letter
+		ram_escape = !((byte >= 'A' && byte <= 'Z')
+				|| (byte >= 'a' && byte <= 'z'));
+		return;
+	}
+	if (ram_length + 1 >= RAM_REPORT_SIZE)
+	{
+		h->done = 1;
+		return;
+	}
+	if (byte == 0x1B)
+	{
+		ram_escape = 1;
+		byte = '\n';
+	}
+	ram_text[ram_length++] = byte;
+	ram_text[ram_length] = '\0';
+
+	// The last line is "other" (padded to 10 characters) and its bytes
+	const char* other = strstr(ram_text, "other");
+	if (other && strlen(other) >= 15)
+	{
+		h->done = 1;
+	}
+}
+
+int harness_ram_report(Harness* h, HarnessRam* ram)
+{
+	HarnessMarkerHandler on_marker = h->on_marker;
+	HarnessByteHandler on_spi = h->on_spi;
+	HarnessByteHandler on_uart = h->on_uart;
+	HarnessStepHandler on_step = h->on_step;
+	int done = h->done;
+	h->on_marker = NULL;
+	h->on_spi = NULL;
+	h->on_uart = ram_output;
+	h->on_step = NULL;
+	h->done = 0;
+	ram_length = 0;
+	ram_text[0] = '\0';
+	ram_escape = 0;
+
+	harness_type(h, ":ram\n");
+	int result = harness_run(h, harness_now_us(h) + RAM_REPORT_US);
+
+	h->on_marker = on_marker;
+	h->on_spi = on_spi;
+	h->on_uart = on_uart;
+	h->on_step = on_step;
+	h->done = done;
+	if (result != 0)
+	{
+		return -1;
+	}
+
+	memset(ram, 0, sizeof(*ram));
+	int found = 0;
+	for (char* line = strtok(ram_text, "\r\n"); line;
+			line = strtok(NULL, "\r\n"))
+	{
+		HarnessRamBudget* s = &ram->subsystems[ram->num_subsystems];
+		if (sscanf(line, "RAM: %u static, %u stack peak, %u never used",
+				&ram->static_bytes, &ram->stack_peak, &ram->never_used) == 3)
+		{
+			found = 1;
+		}
+		else if (sscanf(line, " other %u", &ram->other) == 1)
+		{
+			break;
+		}
+		else if (found && ram->num_subsystems < HARNESS_MAX_SUBSYSTEMS
+				&& sscanf(line, " %11s %u / %u", s->name, &s->used,
+				&s->budget) == 3)
+		{
+			ram->over += s->used > s->budget;
+			ram->num_subsystems++;
+		}
+	}
+	return found ? 0 : -1;
+}
+
+void harness_print_ram(const HarnessRam* ram)
+{
+	printf("RAM: %u bytes static, stack peak %u bytes, %u bytes never "
+			"used\n", ram->static_bytes, ram->stack_peak, ram->never_used);
+	for (int i = 0; i < ram->num_subsystems; i++)
+	{
+		const HarnessRamBudget* s = &ram->subsystems[i];
+		printf("  %-10s %4u / %4u%s\n", s->name, s->used, s->budget,
+				s->used > s->budget ? " OVER" : "");
+	}
+	printf("  %-10s %4u\n", "other", ram->other);
+	if (ram->over)
+	{
+		printf("  %d subsystems over budget\n", ram->over);
+	}
+}
+
+uint64_t harness_now_us(const Harness* h)
+{
+	return avr_cycles_to_usec(h->avr, h->avr->cycle);
+}
+
+static avr_cycle_count_t button_release(struct avr_t* avr,
+		avr_cycle_count_t when, void* param)
+{
+	ButtonEvent* event = param;
+	avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'),
+			event->button), 0);
+	return 0;
+}
+
+static avr_cycle_count_t button_press(struct avr_t* avr,
+		avr_cycle_count_t when, void* param)
+{
+	ButtonEvent* event = param;
+	avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'),
+			event->button), 1);
+	avr_cycle_timer_register_usec(avr, event->hold_us, button_release,
+			event);
+	return 0;
+}
+
+void harness_press_button(Harness* h, uint8_t button, uint32_t delay_us,
+		uint32_t hold_us)
+{
+	ButtonEvent* event = &h->button_events[button % HARNESS_NUM_BUTTONS];
+
+	// A new press replaces any press or release still pending
+	avr_cycle_timer_cancel(h->avr, button_press, event);
+	avr_cycle_timer_cancel(h->avr, button_release, event);
+	event->hold_us = hold_us;
+	if (delay_us == 0)
+	{
+		button_press(h->avr, h->avr->cycle, event);
+	}
+	else
+	{
+		avr_cycle_timer_register_usec(h->avr, delay_us, button_press, event);
+	}
+}
+
+static avr_cycle_count_t serial_next(struct avr_t* avr,
+		avr_cycle_count_t when, void* param)
+{
+	Harness* h = param;
+	if (h->serial_head == h->serial_tail)
+	{
+		return 0;
+	}
+	avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'),
+			UART_IRQ_INPUT), (uint8_t)h->serial_queue[h->serial_tail]);
+	h->serial_tail = (h->serial_tail + 1) % HARNESS_SERIAL_QUEUE;
+	return when + avr_usec_to_cycles(avr, SERIAL_CHAR_US);
+}
+
+void harness_type(Harness* h, const char* text)
+{
+	int idle = h->serial_head == h->serial_tail;
+	for (; *text; text++)
+	{
+		uint16_t next = (h->serial_head + 1) % HARNESS_SERIAL_QUEUE;
+		if (next == h->serial_tail)
+		{
+			fprintf(stderr, "Serial queue full - input dropped\n");
+			break;
+		}
+		h->serial_queue[h->serial_head] = *text;
+		h->serial_head = next;
+	}
+	if (idle)
+	{
+		avr_cycle_timer_register_usec(h->avr, SERIAL_CHAR_US, serial_next, h);
+	}
+}
@@ -0,0 +1,136 @@
+/*
+ * harness.h
+ *
+ * Author: Michael Blauberg
+ *
+ * Common simavr plumbing for the simulation harnesses. Loads a firmware
+ * image built from the simharness environment, decodes the SPI stream
+ * into an LED matrix model, watches the simulation markers (see
+ * src/simmarker.h) and lets a harness push buttons and type on the
+ * serial port. Several boards can be simulated together with their
+ * USART1 links wired up (see src/link.h).
+ */
+
+#ifndef HARNESS_H_
+#define HARNESS_H_
+
+#include <stdint.h>
+#include "sim_avr.h"
+#include "matrix_model.h"
+#include "../../src/simmarker.h"
+
+#define HARNESS_NUM_BUTTONS 4
+#define HARNESS_SERIAL_QUEUE 256
+#define HARNESS_MAX_SUBSYSTEMS 32
+
+typedef struct Harness Harness;
+
+// Called for every simulation marker written by the firmware
+typedef void (*HarnessMarkerHandler)(Harness* h, uint8_t event,
+		uint8_t payload);
+// Called for every byte sent over SPI (after the matrix model is updated)
+// or over the serial port
+typedef void (*HarnessByteHandler)(Harness* h, uint8_t byte);
+// Called after every instruction the firmware runs
+typedef void (*HarnessStepHandler)(Harness* h);
+
+typedef struct
+{
+	Harness* harness;
+	uint8_t button;
+	uint32_t hold_us;
+} ButtonEvent;
+
+// Stack and static RAM figures reported by the firmware (see
+// src/stackmon.h)
+typedef struct
+{
+	char name[12];
+	unsigned used;
+	unsigned budget;
+} HarnessRamBudget;
+
+typedef struct
+{
+	unsigned static_bytes;
+	unsigned stack_peak;		// deepest the stack has been since reset
+	unsigned never_used;
+	int num_subsystems;
+	HarnessRamBudget subsystems[HARNESS_MAX_SUBSYSTEMS];
+	unsigned other;				// static RAM no subsystem owns
+	int over;					// subsystems over their budget
+} HarnessRam;
+
+struct Harness
+{
+	avr_t* avr;
+	MatrixModel matrix;
+
+	uint32_t spi_bytes;		// total bytes sent to the LED matrix
+	uint32_t uart_bytes;	// total bytes sent out of the serial port
+
+	HarnessMarkerHandler on_marker;
+	HarnessByteHandler on_spi;
+	HarnessByteHandler on_uart;
+	HarnessStepHandler on_step;
+	void* user;				// for use by the harness program
+
+	ButtonEvent button_events[HARNESS_NUM_BUTTONS];
+
+	// Characters waiting to be typed on the serial port
+	char serial_queue[HARNESS_SERIAL_QUEUE];
+	uint16_t serial_head;
+	uint16_t serial_tail;
+
+	int done;
+};
+
+// Load the firmware (an ELF file) and set up the simulated board. mmcu
+// may be NULL to use the part recorded in the ELF file (or the ATmega324A
+// if none is recorded). Returns 0 on success.
+int harness_init(Harness* h, const char* firmware, const char* mmcu);
+
+// Run the simulation until the harness sets done, the firmware crashes or
+// max_us microseconds of simulated time have passed. Returns 0 if the run
+// finished because the harness set done.
+int harness_run(Harness* h, uint64_t max_us);
+
+// Wire the USART1 link between a leader and a follower board: the
+// leader's TXD1 to the follower's RXD1 and back. Several followers may be
+// linked to one leader.
+void harness_link(Harness* leader, Harness* follower);
+
+// Run several boards together (as harness_run()), keeping their simulated
+// times in step. Stops when any of them is done. A board's clock can be
+// made fast or slow by changing its avr->frequency after harness_init().
+int harness_run_boards(Harness* boards[], int num_boards, uint64_t max_us);
+
+// Find the function with the given name in the firmware (an ELF file).
+// Sets *start to its address and *end to the address after it (both in
+// bytes, like avr->pc). Returns 0 if it was found.
+int harness_find_function(const char* firmware, const char* name,
+		uint32_t* start, uint32_t* end);
+
+// Ask the firmware for its stack high water mark and static RAM budgets
+// (the :ram shell command), running the simulation until they have all
+// arrived. The harness's handlers aren't called meanwhile. Best done once
+// the game is over, so the answer doesn't disturb the figures being
+// measured. Returns 0 on success.
+int harness_ram_report(Harness* h, HarnessRam* ram);
+
+// Print RAM figures as part of a report
+void harness_print_ram(const HarnessRam* ram);
+
+// Simulated time since reset
+uint64_t harness_now_us(const Harness* h);
+
+// Press the given button (0 to 3) after delay_us and release it hold_us
+// later.
+void harness_press_button(Harness* h, uint8_t button, uint32_t delay_us,
+		uint32_t hold_us);
+
+// Queue characters to be typed on the serial port (sent at a little under
+// the line rate).
+void harness_type(Harness* h, const char* text);
+
+#endif /* HARNESS_H_ */
@@ -0,0 +1,374 @@
+/*
+ * latency.c
+ *
+ * Author: Michael Blauberg
+ *
+ * Input-to-photon latency harness. Plays the built-in song at each speed
+ * preset and with each amount of serial output, pressing the button for a
+ * note in the scoring area at a random time within a step. The latency of
+ * each press is the time from the button's pin changing to the last SPI
+ * byte of the update that turns the note green having been shifted out
+ * on MOSI. The distribution (median, 99th percentile and worst) is
+ * reported for each combination, followed by the stack and static RAM
+ * figures (see src/stackmon.h) of the game whose stack went deepest.
+ *
+ * Which lane's note turned green is worked out from the LED matrix model,
+ * so any way of drawing it counts (a pixel, a column or the whole
+ * display). The SPI bytes are seen as the firmware writes them, so the
+ * time to shift a byte out at the SPI clock rate is added.
+ *
+ * Output loads:
+ *     quiet   nothing printed during the game (:verbose 0 - see shell.h)
+ *     normal  the score printed every pass of the game loop
+ *     heavy   every late step printed, and the counters asked for over the
+ *             serial port every step (:verbose 2, :stats)
+ *
+ * Usage: latency [-v] [-n presses] [-s seed] [-d divider] [-m mmcu]
+ *                firmware.elf
+ *   -v  print every press and its latency
+ *   -n  most presses measured in each game (default 500)
+ *   -s  seed for the random press times (default 1)
+ *   -d  LED matrix SPI clock divider to use (default 128)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "harness.h"
+#include "../../src/playfield.h"
+
+#define MAX_SAMPLES 4096
+
+#define SESSION_TIMEOUT_US (15ULL * 60 * 1000000)
+// The settings are typed once the start screen has been printed (so they
+// fit in the serial input buffer), and the game started a little after
+#define SETUP_US 1500000
+#define START_PRESS_DELAY_US 300000
+#define BUTTON_HOLD_US 5000
+
+// A press whose note hasn't turned green after this long has been missed
+#define RESPONSE_TIMEOUT_US 200000
+
+typedef struct
+{
+	const char* name;
+	const char* keys;		// typed on the start screen to choose it
+} Speed;
+
+static const Speed speeds[] = {
+	{"normal", "1"},
+	{"fast", "2"},
+	{"extreme", "3"},
+};
+#define NUM_SPEEDS (sizeof(speeds) / sizeof(speeds[0]))
+
+typedef struct
+{
+	const char* name;
+	const char* keys;		// typed on the start screen to set it up
+	int stats_every_step;	// ask for the counters every step
+} Load;
+
+static const Load loads[] = {
+	{"quiet", ":verbose 0\n", 0},
+	{"normal", ":verbose 1\n", 0},
+	{"heavy", ":verbose 2\n", 1},
+};
+#define NUM_LOADS (sizeof(loads) / sizeof(loads[0]))
+
+typedef struct
+{
+	const Load* load;
+	int verbose;
+	int max_samples;
+	uint32_t byte_us;		// time to shift an SPI byte out
+
+	int playing;
+	uint64_t last_step_us;
+	uint64_t step_us;
+
+	// The press being timed
+	int pending;
+	uint8_t lane;
+	uint64_t edge_us;
+	int green_before;		// green notes in the lane when it was pressed
+
+	uint32_t samples[MAX_SAMPLES];
+	int num_samples;
+	int presses;
+	int no_response;
+
+	HarnessRam ram;			// once the game is over
+	int ram_reported;
+} Run;
+
+// Number of columns from the scoring area on in which the given lane has
+// a note of the given colour
+static int notes_coloured(Harness* h, uint8_t lane, PixelColour colour,
+		uint8_t last_column)
+{
+	int count = 0;
+	for (uint8_t x = PLAYFIELD_SCORING_START; x <= last_column; x++)
+	{
+		int whole = 1;
+		for (uint8_t i = 0; i < PLAYFIELD_LANE_WIDTH; i++)
+		{
+			if (h->matrix.pixels[x][lane * PLAYFIELD_LANE_WIDTH + i] != colour)
+			{
+				whole = 0;
+			}
+		}
+		count += whole;
+	}
+	return count;
+}
+
+// Press the button for a note in the scoring area (if there is one) at a
+// random time before the next step is due
+static void press_note(Run* r, Harness* h)
+{
+	uint8_t lanes[PLAYFIELD_NUM_LANES];
+	int num_lanes = 0;
+
+	// Notes in the last column may have gone before the button is pressed
+	for (uint8_t lane = 0; lane < PLAYFIELD_NUM_LANES; lane++)
+	{
+		if (notes_coloured(h, lane, COLOUR_RED, MATRIX_NUM_COLUMNS - 2))
+		{
+			lanes[num_lanes++] = lane;
+		}
+	}
+	if (num_lanes == 0 || r->step_us == 0)
+	{
+		return;
+	}
+	r->lane = lanes[rand() % num_lanes];
+	uint32_t delay = 1 + rand() % r->step_us;
+	r->edge_us = harness_now_us(h) + delay;
+	r->green_before = notes_coloured(h, r->lane, COLOUR_GREEN,
+			MATRIX_NUM_COLUMNS - 1);
+	r->pending = 1;
+	r->presses++;
+	// Button n plays lane NUM_LANES - 1 - n (see play_chord())
+	harness_press_button(h, PLAYFIELD_NUM_LANES - 1 - r->lane, delay,
+			BUTTON_HOLD_US);
+}
+
+static void marker(Harness* h, uint8_t event, uint8_t payload)
+{
+	Run* r = h->user;
+	uint64_t now = harness_now_us(h);
+
+	switch (event)
+	{
+		case SIM_EVENT_GAME_START:
+			r->playing = 1;
+			r->last_step_us = now;
+			break;
+		case SIM_EVENT_BEAT:
+			if (!r->playing)
+			{
+				break;
+			}
+			r->step_us = now - r->last_step_us;
+			r->last_step_us = now;
+			if (r->load->stats_every_step)
+			{
+				harness_type(h, ":stats\n");
+			}
+			if (r->pending && now > r->edge_us + RESPONSE_TIMEOUT_US)
+			{
+				r->pending = 0;
+				r->no_response++;
+			}
+			if (!r->pending && r->presses < r->max_samples)
+			{
+				press_note(r, h);
+			}
+			break;
+		case SIM_EVENT_GAME_OVER:
+			if (r->playing)
+			{
+				h->done = 1;
+			}
+			break;
+	}
+}
+
+static void spi_byte(Harness* h, uint8_t byte)
+{
+	Run* r = h->user;
+	uint64_t now = harness_now_us(h);
+
+	if (!r->pending || now < r->edge_us)
+	{
+		return;
+	}
+	// Notes that were green leaving the display would hide a new one, so
+	// compare with the fewest there have been since the press
+	int green = notes_coloured(h, r->lane, COLOUR_GREEN,
+			MATRIX_NUM_COLUMNS - 1);
+	if (green < r->green_before)
+	{
+		r->green_before = green;
+	}
+	else if (green > r->green_before)
+	{
+		uint32_t latency = now + r->byte_us - r->edge_us;
+		if (r->verbose)
+		{
+			printf("  press at %.3f ms, lane %u: %u us\n", r->edge_us / 1000.0,
+					r->lane, latency);
+		}
+		if (r->num_samples < MAX_SAMPLES)
+		{
+			r->samples[r->num_samples++] = latency;
+		}
+		r->pending = 0;
+	}
+}
+
+static int compare_samples(const void* a, const void* b)
+{
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+// Sample at the given percentile (nearest rank) of sorted samples
+static double percentile(const uint32_t* samples, int n, int percent)
+{
+	int rank = (n * percent + 99) / 100;
+	return samples[rank > 0 ? rank - 1 : 0] / 1000.0;
+}
+
+static int run_game(const char* firmware, const char* mmcu,
+		const Speed* speed, const Load* load, int divider, Run* r)
+{
+	static Harness harness;
+	char keys[64];
+
+	if (harness_init(&harness, firmware, mmcu) != 0)
+	{
+		return -1;
+	}
+	harness.user = r;
+	harness.on_marker = marker;
+	harness.on_spi = spi_byte;
+	r->load = load;
+	r->byte_us = 8 * divider * 1000000ULL / harness.avr->frequency;
+
+	// Choose the speed and output load on the start screen, then start
+	harness_run(&harness, SETUP_US);
+	snprintf(keys, sizeof(keys), "%s%s:spi %d\n", speed->keys, load->keys,
+			divider);
+	harness_type(&harness, keys);
+	harness_press_button(&harness, 0, START_PRESS_DELAY_US, BUTTON_HOLD_US);
+	if (harness_run(&harness, SESSION_TIMEOUT_US) != 0)
+	{
+		printf("%s/%s: game did not finish\n", speed->name, load->name);
+		return -1;
+	}
+	r->ram_reported = harness_ram_report(&harness, &r->ram) == 0;
+	avr_terminate(harness.avr);
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	static Run run;
+	static HarnessRam deepest;
+	const char* deepest_game = NULL;
+	const char* deepest_load = NULL;
+	const char* mmcu = NULL;
+	int verbose = 0;
+	int max_samples = 500;
+	unsigned seed = 1;
+	int divider = 128;
+	int failed = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "vn:s:d:m:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'v':
+				verbose = 1;
+				break;
+			case 'n':
+				max_samples = atoi(optarg);
+				break;
+			case 's':
+				seed = strtoul(optarg, NULL, 0);
+				break;
+			case 'd':
+				divider = atoi(optarg);
+				break;
+			case 'm':
+				mmcu = optarg;
+				break;
+			default:
+				optind = argc;
+				break;
+		}
+	}
+	if (argc - optind != 1)
+	{
+		fprintf(stderr, "Usage: %s [-v] [-n presses] [-s seed] [-d divider] "
+				"[-m mmcu] firmware.elf\n", argv[0]);
+		return 2;
+	}
+	if (max_samples > MAX_SAMPLES)
+	{
+		max_samples = MAX_SAMPLES;
+	}
+
+	printf("Button edge to note drawn green (SPI divider %d)\n", divider);
+	printf("%-8s %-7s %7s %7s %8s %8s %8s\n", "speed", "load", "presses",
+			"missed", "p50 ms", "p99 ms", "max ms");
+	for (unsigned s = 0; s < NUM_SPEEDS; s++)
+	{
+		for (unsigned l = 0; l < NUM_LOADS; l++)
+		{
+			srand(seed);
+			memset(&run, 0, sizeof(run));
+			run.verbose = verbose;
+			run.max_samples = max_samples;
+			if (run_game(argv[optind], mmcu, &speeds[s], &loads[l], divider,
+					&run) != 0)
+			{
+				failed = 1;
+				continue;
+			}
+			printf("%-8s %-7s %7d %7d", speeds[s].name, loads[l].name,
+					run.presses, run.no_response);
+			if (run.num_samples)
+			{
+				qsort(run.samples, run.num_samples, sizeof(run.samples[0]),
+						compare_samples);
+				printf(" %8.2f %8.2f %8.2f\n",
+						percentile(run.samples, run.num_samples, 50),
+						percentile(run.samples, run.num_samples, 99),
+						run.samples[run.num_samples - 1] / 1000.0);
+			}
+			else
+			{
+				printf(" %8s %8s %8s\n", "-", "-", "-");
+			}
+			if (run.ram_reported && (!deepest_game
+					|| run.ram.stack_peak > deepest.stack_peak))
+			{
+				deepest = run.ram;
+				deepest_game = speeds[s].name;
+				deepest_load = loads[l].name;
+			}
+		}
+	}
+	if (deepest_game)
+	{
+		printf("\nDeepest stack (%s/%s) - ", deepest_game, deepest_load);
+		harness_print_ram(&deepest);
+	}
+	return failed;
+}
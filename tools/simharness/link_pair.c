@@ -0,0 +1,174 @@
+/*
+ * link_pair.c
+ *
+ * Author: Michael Blauberg
+ *
+ * Linked play harness (see src/link.h). Runs a leader and a follower
+ * board with their USART1 links wired together, the follower's clock
+ * running fast or slow by the given amount, and starts a game on the
+ * leader. The time each board takes each step of the notes is compared,
+ * and the run fails if the boards ever get further apart than allowed
+ * once the follower has had a few steps to catch up.
+ *
+ * Usage: link_pair [-v] [-d ppm] [-n steps] [-t max_us] [-m mmcu]
+ *                  firmware.elf
+ *   -v  print the times of every step
+ *   -d  follower's clock error in parts per million (default 500)
+ *   -n  number of steps to compare (default 300)
+ *   -t  largest difference allowed between the boards' steps, in us
+ *       (default 1000, a millisecond)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "harness.h"
+
+#define NUM_BOARDS 2
+#define MAX_STEPS 4096
+
+// Steps the follower is given to get in step before they are checked
+#define SETTLING_STEPS 10
+
+// The leader is told to start once the follower has had time to answer a
+// few pings
+#define CHOOSE_BOARD_US 200000
+#define START_US 800000
+#define SESSION_TIMEOUT_US (10ULL * 60 * 1000000)
+
+typedef struct
+{
+	Harness boards[NUM_BOARDS];
+	int verbose;
+	int num_steps;
+	int steps[NUM_BOARDS];
+	uint64_t step_times[NUM_BOARDS][MAX_STEPS];
+} Pair;
+
+static void marker(Harness* h, uint8_t event, uint8_t payload)
+{
+	Pair* p = h->user;
+	int board = h == &p->boards[0] ? 0 : 1;
+
+	if (event == SIM_EVENT_GAME_START)
+	{
+		p->steps[board] = 0;
+	}
+	else if (event == SIM_EVENT_BEAT && p->steps[board] < p->num_steps)
+	{
+		p->step_times[board][p->steps[board]++] = harness_now_us(h);
+	}
+	else if (event == SIM_EVENT_GAME_OVER)
+	{
+		h->done = 1;
+	}
+	if (p->steps[0] == p->num_steps && p->steps[1] == p->num_steps)
+	{
+		h->done = 1;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	static Pair pair;
+	const char* mmcu = NULL;
+	double ppm = 500;
+	long max_difference = 1000;
+	int opt;
+
+	pair.num_steps = 300;
+	while ((opt = getopt(argc, argv, "vd:n:t:m:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'v':
+				pair.verbose = 1;
+				break;
+			case 'd':
+				ppm = atof(optarg);
+				break;
+			case 'n':
+				pair.num_steps = atoi(optarg);
+				break;
+			case 't':
+				max_difference = atol(optarg);
+				break;
+			case 'm':
+				mmcu = optarg;
+				break;
+			default:
+				optind = argc;
+				break;
+		}
+	}
+	if (argc - optind != 1 || pair.num_steps <= SETTLING_STEPS
+			|| pair.num_steps > MAX_STEPS)
+	{
+		fprintf(stderr, "Usage: %s [-v] [-d ppm] [-n steps] [-t max_us] "
+				"[-m mmcu] firmware.elf\n", argv[0]);
+		return 2;
+	}
+
+	Harness* boards[NUM_BOARDS];
+	for (int i = 0; i < NUM_BOARDS; i++)
+	{
+		if (harness_init(&pair.boards[i], argv[optind], mmcu) != 0)
+		{
+			return 2;
+		}
+		pair.boards[i].user = &pair;
+		pair.boards[i].on_marker = marker;
+		boards[i] = &pair.boards[i];
+	}
+	// Simulated time is measured by the leader's clock
+	boards[1]->avr->frequency *= 1 + ppm / 1e6;
+	harness_link(boards[0], boards[1]);
+
+	// Choose the boards on the start screen ('b' steps through off,
+	// leader, board 2...) then start on the leader
+	harness_run_boards(boards, NUM_BOARDS, CHOOSE_BOARD_US);
+	harness_type(boards[0], "b");
+	harness_type(boards[1], "bb");
+	harness_run_boards(boards, NUM_BOARDS, START_US);
+	harness_type(boards[0], "s");
+	if (harness_run_boards(boards, NUM_BOARDS, SESSION_TIMEOUT_US) != 0)
+	{
+		printf("The boards did not finish (steps %d and %d)\n",
+				pair.steps[0], pair.steps[1]);
+		return 1;
+	}
+
+	int steps = pair.steps[0] < pair.steps[1] ? pair.steps[0] : pair.steps[1];
+	long worst = 0;
+	int worst_step = 0;
+	double total = 0;
+	for (int i = 0; i < steps; i++)
+	{
+		long difference = (long)(pair.step_times[1][i] - pair.step_times[0][i]);
+		if (pair.verbose)
+		{
+			printf("step %d: leader %llu us, follower %+ld us\n", i + 1,
+					(unsigned long long)pair.step_times[0][i], difference);
+		}
+		if (i < SETTLING_STEPS)
+		{
+			continue;
+		}
+		total += difference;
+		if (labs(difference) > labs(worst))
+		{
+			worst = difference;
+			worst_step = i + 1;
+		}
+	}
+	if (steps <= SETTLING_STEPS)
+	{
+		printf("FAIL: only %d steps were taken on both boards\n", steps);
+		return 1;
+	}
+	printf("%d steps, follower clock %+.0f ppm: mean %+.0f us, "
+			"worst %+ld us (step %d)\n", steps, ppm,
+			total / (steps - SETTLING_STEPS), worst, worst_step);
+	printf("%s\n", labs(worst) > max_difference ? "FAIL" : "PASS");
+	return labs(worst) > max_difference ? 1 : 0;
+}
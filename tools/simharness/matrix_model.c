@@ -0,0 +1,161 @@
+/*
+ * matrix_model.c
+ *
+ * Author: Michael Blauberg
+ *
+ * Decodes the LED matrix SPI command stream (see src/ledmatrix.c for the
+ * encoder side).
+ */
+
+#include "matrix_model.h"
+#include <string.h>
+
+#define CMD_UPDATE_ALL		(0x00)
+#define CMD_UPDATE_PIXEL	(0x01)
+#define CMD_UPDATE_ROW		(0x02)
+#define CMD_UPDATE_COL		(0x03)
+#define CMD_SHIFT_DISPLAY	(0x04)
+#define CMD_CLEAR_SCREEN	(0x0F)
+
+#define NO_COMMAND			(0xFF)
+
+// Shift directions (argument bits of CMD_SHIFT_DISPLAY)
+#define SHIFT_RIGHT	(0x01)
+#define SHIFT_LEFT	(0x02)
+#define SHIFT_DOWN	(0x04)
+#define SHIFT_UP	(0x08)
+
+void matrix_model_init(MatrixModel* model)
+{
+	memset(model->pixels, 0, sizeof(model->pixels));
+	model->command = NO_COMMAND;
+	model->received = 0;
+}
+
+int matrix_model_busy(const MatrixModel* model)
+{
+	return model->command != NO_COMMAND;
+}
+
+static void shift(MatrixModel* model, uint8_t direction)
+{
+	if (direction & SHIFT_LEFT)
+	{
+		memmove(model->pixels[0], model->pixels[1],
+				sizeof(model->pixels[0]) * (MATRIX_NUM_COLUMNS - 1));
+		memset(model->pixels[MATRIX_NUM_COLUMNS - 1], 0,
+				sizeof(model->pixels[0]));
+	}
+	if (direction & SHIFT_RIGHT)
+	{
+		memmove(model->pixels[1], model->pixels[0],
+				sizeof(model->pixels[0]) * (MATRIX_NUM_COLUMNS - 1));
+		memset(model->pixels[0], 0, sizeof(model->pixels[0]));
+	}
+	for (uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++)
+	{
+		PixelColour* column = model->pixels[x];
+		if (direction & SHIFT_UP)
+		{
+			memmove(&column[1], &column[0], MATRIX_NUM_ROWS - 1);
+			column[0] = 0;
+		}
+		if (direction & SHIFT_DOWN)
+		{
+			memmove(&column[0], &column[1], MATRIX_NUM_ROWS - 1);
+			column[MATRIX_NUM_ROWS - 1] = 0;
+		}
+	}
+}
+
+void matrix_model_byte(MatrixModel* model, uint8_t byte)
+{
+	if (model->command == NO_COMMAND)
+	{
+		model->received = 0;
+		switch (byte)
+		{
+			case CMD_CLEAR_SCREEN:
+				memset(model->pixels, 0, sizeof(model->pixels));
+				break;
+			case CMD_UPDATE_ALL:
+			case CMD_UPDATE_PIXEL:
+			case CMD_UPDATE_ROW:
+			case CMD_UPDATE_COL:
+			case CMD_SHIFT_DISPLAY:
+				model->command = byte;
+				break;
+			default:
+				// Unknown commands are ignored by the board
+				break;
+		}
+		return;
+	}
+
+	uint16_t n = model->received++;
+	switch (model->command)
+	{
+		case CMD_UPDATE_ALL:
+			// Row by row, each row left to right
+			model->pixels[n % MATRIX_NUM_COLUMNS][n / MATRIX_NUM_COLUMNS] = byte;
+			if (model->received == MATRIX_NUM_COLUMNS * MATRIX_NUM_ROWS)
+			{
+				model->command = NO_COMMAND;
+			}
+			break;
+		case CMD_UPDATE_PIXEL:
+			if (n == 0)
+			{
+				model->first_arg = byte;
+			}
+			else
+			{
+				uint8_t x = model->first_arg & 0x0F;
+				uint8_t y = (model->first_arg >> 4) & 0x07;
+				if (x < MATRIX_NUM_COLUMNS)
+				{
+					model->pixels[x][y] = byte;
+				}
+				model->command = NO_COMMAND;
+			}
+			break;
+		case CMD_UPDATE_ROW:
+			if (n == 0)
+			{
+				model->first_arg = byte & 0x07;
+			}
+			else
+			{
+				model->pixels[n - 1][model->first_arg] = byte;
+				if (n == MATRIX_NUM_COLUMNS)
+				{
+					model->command = NO_COMMAND;
+				}
+			}
+			break;
+		case CMD_UPDATE_COL:
+			if (n == 0)
+			{
+				model->first_arg = byte & 0x0F;
+			}
+			else
+			{
+				if (model->first_arg < MATRIX_NUM_COLUMNS)
+				{
+					model->pixels[model->first_arg][n - 1] = byte;
+				}
+				if (n == MATRIX_NUM_ROWS)
+				{
+					model->command = NO_COMMAND;
+				}
+			}
+			break;
+		case CMD_SHIFT_DISPLAY:
+			shift(model, byte);
+			model->command = NO_COMMAND;
+			break;
+		default:
+			model->command = NO_COMMAND;
+			break;
+	}
+}
@@ -0,0 +1,34 @@
+/*
+ * matrix_model.h
+ *
+ * Author: Michael Blauberg
+ *
+ * A model of the LED matrix board. SPI bytes sent by the firmware are fed
+ * in one at a time and decoded the same way the matrix board does, so we
+ * always know exactly what is on screen (rather than what bytes were sent).
+ */
+
+#ifndef MATRIX_MODEL_H_
+#define MATRIX_MODEL_H_
+
+#include <stdint.h>
+#include "../../src/ledmatrix.h"
+
+typedef struct
+{
+	PixelColour pixels[MATRIX_NUM_COLUMNS][MATRIX_NUM_ROWS];
+	uint8_t command;		// command being received (or NO_COMMAND)
+	uint16_t received;		// argument bytes received for the command
+	uint8_t first_arg;		// first argument byte of the command
+} MatrixModel;
+
+// Clear the model to a blank screen with no command in progress.
+void matrix_model_init(MatrixModel* model);
+
+// Decode the next byte sent over SPI.
+void matrix_model_byte(MatrixModel* model, uint8_t byte);
+
+// Returns non-zero if a command is only partially received.
+int matrix_model_busy(const MatrixModel* model);
+
+#endif /* MATRIX_MODEL_H_ */
@@ -0,0 +1,434 @@
+/*
+ * stress.c
+ *
+ * Author: Michael Blauberg
+ *
+ * Maximum sustainable speed benchmark. Plays the stress charts (songs
+ * with notes in every row - see tools/stress_chart.py) with each SPI
+ * clock divider and amount of serial output, sweeping the game speed (ms
+ * per row) down until steps start being taken late (more than
+ * LOOPMON_LATE_MS after they were due - see src/loopmon.h). The fastest
+ * speed at which a whole song was played with no late steps is reported
+ * as a note rate for each chart and configuration, along with a headline
+ * figure: the rate for every lane with the shipped configuration.
+ *
+ * The sweep comes down in big steps and goes back up to the last speed
+ * that kept up with smaller ones when steps are late, so each combination
+ * takes about a dozen games. The game speed is set with the command
+ * shell's tempo, and the speed the firmware chose is read back from its
+ * answer, so only the speeds the tempo can give are tried.
+ *
+ * The notes are played by the firmware's autoplay (see src/autoplay.h),
+ * so hits are drawn and judged as they would be with a player. The stack
+ * and static RAM figures (see src/stackmon.h) of the game whose stack went
+ * deepest are reported at the end.
+ *
+ * Usage: stress [-v] [-a late] [-d dividers] [-b mode] [-m mmcu]
+ *               firmware.elf
+ *   -v  print every game played
+ *   -a  late steps allowed in a game that keeps up (default 0)
+ *   -d  comma separated SPI clock dividers to try (default 128,16,2)
+ *   -b  autoplay mode (default 1, perfect - 0 leaves the notes unplayed)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "harness.h"
+
+#define SESSION_TIMEOUT_US (5ULL * 60 * 1000000)
+#define SETUP_US 1500000
+#define KEY_WAIT_US 100000
+#define SETTINGS_WAIT_US 300000
+#define START_PRESS_DELAY_US 100000
+#define BUTTON_HOLD_US 5000
+
+// Time each row of the stress charts takes at 100% tempo (see
+// tools/stress_chart.py), and the tempos the shell accepts
+#define CHART_ROW_MS 25
+#define MIN_TEMPO 25
+#define MAX_TEMPO 400
+
+// Most times 't' is pressed looking for a chart
+#define MAX_TRACKS 16
+
+#define MAX_DIVIDERS 8
+#define OUTPUT_SIZE 4096
+
+// Speeds are tried this many apart at first
+#define FIRST_STRIDE 16
+
+typedef struct
+{
+	const char* name;		// as shown on the start screen
+	const char* label;
+	int notes_per_row;
+} Chart;
+
+static const Chart charts[] = {
+	{"Stress Lanes", "lanes", 4},
+	{"Stress Chords", "chords", 2},
+};
+#define NUM_CHARTS (sizeof(charts) / sizeof(charts[0]))
+
+typedef struct
+{
+	const char* name;
+	const char* keys;		// typed on the start screen to set it up
+} Load;
+
+static const Load loads[] = {
+	{"quiet", ":verbose 0\n"},
+	{"normal", ":verbose 1\n"},
+	{"chatty", ":verbose 2\n"},
+};
+#define NUM_LOADS (sizeof(loads) / sizeof(loads[0]))
+
+// The shipped configuration, for the headline figure
+#define HEADLINE_CHART 0
+#define HEADLINE_LOAD 1
+#define HEADLINE_DIVIDER 128
+
+typedef struct
+{
+	int playing;
+	uint32_t steps;
+	uint32_t late_steps;
+	uint8_t worst_late_ms;
+
+	// Serial output on the start screen
+	char output[OUTPUT_SIZE];
+	int output_length;
+} Game;
+
+// RAM figures of the game whose stack went deepest
+static HarnessRam deepest;
+static int deepest_found;
+
+// Game speed (ms per row) the firmware works out for a chart at the given
+// tempo (see update_game_speed() in project.c)
+static int speed_at(int percent)
+{
+	return CHART_ROW_MS * (100000 / percent) / 1000;
+}
+
+static void marker(Harness* h, uint8_t event, uint8_t payload)
+{
+	Game* g = h->user;
+
+	switch (event)
+	{
+		case SIM_EVENT_GAME_START:
+			g->playing = 1;
+			break;
+		case SIM_EVENT_BEAT:
+			g->steps += g->playing;
+			break;
+		case SIM_EVENT_LATE_STEP:
+			if (g->playing)
+			{
+				g->late_steps++;
+				if (payload > g->worst_late_ms)
+				{
+					g->worst_late_ms = payload;
+				}
+			}
+			break;
+		case SIM_EVENT_GAME_OVER:
+			if (g->playing)
+			{
+				h->done = 1;
+			}
+			break;
+	}
+}
+
+static void uart_byte(Harness* h, uint8_t byte)
+{
+	Game* g = h->user;
+	if (!g->playing && byte && g->output_length < OUTPUT_SIZE - 1)
+	{
+		g->output[g->output_length++] = byte;
+		g->output[g->output_length] = '\0';
+	}
+}
+
+static void clear_output(Game* g)
+{
+	g->output_length = 0;
+	g->output[0] = '\0';
+}
+
+// Press 't' until the chart is chosen. Returns 0 if it was found.
+static int choose_chart(Harness* h, Game* g, const Chart* chart)
+{
+	char track[64];
+	snprintf(track, sizeof(track), "Track: %s ", chart->name);
+	for (int i = 0; i < MAX_TRACKS; i++)
+	{
+		clear_output(g);
+		harness_type(h, "t");
+		harness_run(h, harness_now_us(h) + KEY_WAIT_US);
+		if (strstr(g->output, track))
+		{
+			return 0;
+		}
+	}
+	return -1;
+}
+
+// Play a chart at the given tempo. Returns the game speed the firmware
+// chose (ms per row), or -1 if the game couldn't be played.
+static int play(const char* firmware, const char* mmcu, const Chart* chart,
+		const Load* load, int divider, int autoplay, int percent, Game* g)
+{
+	static Harness harness;
+	char keys[64];
+	int speed;
+
+	memset(g, 0, sizeof(*g));
+	if (harness_init(&harness, firmware, mmcu) != 0)
+	{
+		return -1;
+	}
+	harness.user = g;
+	harness.on_marker = marker;
+	harness.on_uart = uart_byte;
+
+	harness_run(&harness, SETUP_US);
+	if (choose_chart(&harness, g, chart) != 0)
+	{
+		printf("%s isn't in the song library\n", chart->name);
+		avr_terminate(harness.avr);
+		return -1;
+	}
+	clear_output(g);
+	snprintf(keys, sizeof(keys), "%s:spi %d\n:auto %d\n:tempo %d\n",
+			load->keys, divider, autoplay, percent);
+	harness_type(&harness, keys);
+	harness_run(&harness, harness_now_us(&harness) + SETTINGS_WAIT_US);
+	// The command itself is echoed too, so look for the answer
+	speed = -1;
+	for (const char* answer = g->output;
+			speed < 0 && (answer = strstr(answer, "tempo ")); answer++)
+	{
+		if (sscanf(answer, "tempo %*u%% (%d ms per row)", &speed) != 1)
+		{
+			speed = -1;
+		}
+	}
+	if (speed < 0)
+	{
+		printf("no answer to :tempo %d\n", percent);
+		avr_terminate(harness.avr);
+		return -1;
+	}
+
+	harness_press_button(&harness, 0, START_PRESS_DELAY_US, BUTTON_HOLD_US);
+	if (harness_run(&harness, harness_now_us(&harness) + SESSION_TIMEOUT_US)
+			!= 0)
+	{
+		printf("game did not finish\n");
+		avr_terminate(harness.avr);
+		return -1;
+	}
+	HarnessRam ram;
+	if (harness_ram_report(&harness, &ram) == 0
+			&& (!deepest_found || ram.stack_peak > deepest.stack_peak))
+	{
+		deepest = ram;
+		deepest_found = 1;
+	}
+	avr_terminate(harness.avr);
+	return speed;
+}
+
+// Sweep the game speed down for one chart and configuration. Returns the
+// fastest speed (ms per row) that kept up, 0 if even the slowest didn't,
+// or -1 if a game couldn't be played. *fastest_tried is set to the
+// fastest speed the tempo can give.
+static int sweep(const char* firmware, const char* mmcu, const Chart* chart,
+		const Load* load, int divider, int autoplay, int allowed_late,
+		int verbose, int* fastest_tried)
+{
+	static Game game;
+	// The tempos that give each game speed, slowest first
+	int percents[MAX_TEMPO - MIN_TEMPO + 1];
+	int num_speeds = 0;
+	for (int percent = MIN_TEMPO; percent <= MAX_TEMPO; percent++)
+	{
+		if (num_speeds == 0
+				|| speed_at(percent) != speed_at(percents[num_speeds - 1]))
+		{
+			percents[num_speeds++] = percent;
+		}
+	}
+	*fastest_tried = speed_at(percents[num_speeds - 1]);
+
+	int kept_up = -1;		// index of the fastest speed that kept up
+	int stride = FIRST_STRIDE;
+	int i = 0;
+	while (i < num_speeds)
+	{
+		int speed = play(firmware, mmcu, chart, load, divider, autoplay,
+				percents[i], &game);
+		if (speed < 0)
+		{
+			return -1;
+		}
+		int ok = (int)game.late_steps <= allowed_late;
+		if (verbose)
+		{
+			printf("  %s %s spi %d: %d ms per row, %u steps, %u late "
+					"(worst %u ms)\n", chart->label, load->name, divider,
+					speed, game.steps, game.late_steps, game.worst_late_ms);
+		}
+		if (ok)
+		{
+			kept_up = i;
+		}
+		else if (stride == 1)
+		{
+			break;
+		}
+		else
+		{
+			// Come down from the last speed that kept up more slowly
+			stride /= 2;
+			if (kept_up < 0)
+			{
+				break;
+			}
+			i = kept_up;
+		}
+		if (i + stride >= num_speeds && i < num_speeds - 1)
+		{
+			stride = num_speeds - 1 - i;
+		}
+		i += stride;
+	}
+	return kept_up < 0 ? 0 : speed_at(percents[kept_up]);
+}
+
+static void print_rate(const Chart* chart, int speed, int fastest_tried)
+{
+	if (speed <= 0)
+	{
+		printf(" %11s", speed < 0 ? "failed" : "none");
+		return;
+	}
+	char rate[16];
+	snprintf(rate, sizeof(rate), "%s%.0f", speed == fastest_tried ? ">=" : "",
+			chart->notes_per_row * 1000.0 / speed);
+	printf(" %5d %5s", speed, rate);
+}
+
+int main(int argc, char* argv[])
+{
+	const char* mmcu = NULL;
+	const char* divider_list = "128,16,2";
+	int dividers[MAX_DIVIDERS];
+	int num_dividers = 0;
+	int allowed_late = 0;
+	int autoplay = 1;
+	int verbose = 0;
+	int failed = 0;
+	int headline = -1;
+	int headline_fastest = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "va:d:b:m:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'v':
+				verbose = 1;
+				break;
+			case 'a':
+				allowed_late = atoi(optarg);
+				break;
+			case 'd':
+				divider_list = optarg;
+				break;
+			case 'b':
+				autoplay = atoi(optarg);
+				break;
+			case 'm':
+				mmcu = optarg;
+				break;
+			default:
+				optind = argc;
+				break;
+		}
+	}
+	if (argc - optind != 1)
+	{
+		fprintf(stderr, "Usage: %s [-v] [-a late] [-d dividers] [-b mode] "
+				"[-m mmcu] firmware.elf\n", argv[0]);
+		return 2;
+	}
+	for (const char* d = divider_list; *d && num_dividers < MAX_DIVIDERS; )
+	{
+		dividers[num_dividers++] = strtol(d, (char**)&d, 10);
+		d += *d == ',';
+	}
+
+	printf("Fastest game speed (ms per row) with no more than %d late "
+			"steps, and notes/s\n", allowed_late);
+	printf("%-7s %-4s", "load", "spi");
+	for (unsigned c = 0; c < NUM_CHARTS; c++)
+	{
+		printf(" %11s", charts[c].label);
+	}
+	printf("\n");
+	for (unsigned l = 0; l < NUM_LOADS; l++)
+	{
+		for (int d = 0; d < num_dividers; d++)
+		{
+			int speeds[NUM_CHARTS];
+			int fastest_tried[NUM_CHARTS];
+			for (unsigned c = 0; c < NUM_CHARTS; c++)
+			{
+				speeds[c] = sweep(argv[optind], mmcu, &charts[c], &loads[l],
+						dividers[d], autoplay, allowed_late, verbose,
+						&fastest_tried[c]);
+				if (speeds[c] < 0)
+				{
+					failed = 1;
+				}
+				else if (c == HEADLINE_CHART && l == HEADLINE_LOAD
+						&& dividers[d] == HEADLINE_DIVIDER)
+				{
+					headline = speeds[c];
+					headline_fastest = fastest_tried[c];
+				}
+			}
+			printf("%-7s %-4d", loads[l].name, dividers[d]);
+			for (unsigned c = 0; c < NUM_CHARTS; c++)
+			{
+				print_rate(&charts[c], speeds[c], fastest_tried[c]);
+			}
+			printf("\n");
+			fflush(stdout);
+		}
+	}
+
+	if (headline > 0)
+	{
+		printf("\nHeadline: %s%.0f notes/s (every lane, %s output, "
+				"spi %d)\n", headline == headline_fastest ? ">=" : "",
+				charts[HEADLINE_CHART].notes_per_row * 1000.0 / headline,
+				loads[HEADLINE_LOAD].name, HEADLINE_DIVIDER);
+	}
+	else if (headline == 0)
+	{
+		printf("\nHeadline: the slowest speed tried was too fast\n");
+	}
+	if (deepest_found)
+	{
+		printf("\nDeepest stack of all the games - ");
+		harness_print_ram(&deepest);
+	}
+	return failed;
+}
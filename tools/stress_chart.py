@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+"""Generate worst-case song charts for the speed sweep benchmark.
+
+    stress_chart.py [-p PATTERN] [-r ROWS] [-m ROW_MS] [-n NAME] OUTPUT
+
+Writes a chart (see chart_compiler.py) in which every row has notes, so
+every step of the game moves as many notes as it can and every column of
+the display changes. The patterns are
+
+    lanes    a note in every lane of every row
+    chords   alternating chords (lanes 1 and 3, then 2 and 4), so every
+             pixel of a lane changes colour from one row to the next
+
+The charts are fast (ROW_MS, 25ms by default, is the time each row takes
+at 100% tempo), so the command shell's tempo can take the game speed down
+to a few milliseconds per row. The stress harness (tools/simharness)
+sweeps the game speed down on them until steps are taken late. The
+generated charts are songs/stress_lanes.chart and songs/stress_chords.chart:
+
+    stress_chart.py -p lanes -n "Stress Lanes" songs/stress_lanes.chart
+    stress_chart.py -p chords -n "Stress Chords" songs/stress_chords.chart
+"""
+
+import argparse
+import sys
+
+NUM_LANES = 4
+
+PATTERNS = {
+    "lanes": ["x" * NUM_LANES],
+    "chords": ["x.x.", ".x.x"],
+}
+
+
+def chart(pattern, rows, row_ms, name):
+    """Return the text of a chart of the given number of rows"""
+    rows_of = PATTERNS[pattern]
+    text = ("# Generated by tools/stress_chart.py -p %s -r %d -m %d\n"
+            "name: %s\nbpm: %g\nrows-per-beat: 1\n\n"
+            % (pattern, rows, row_ms, name, 60000 / row_ms))
+    if len(rows_of) == 1:
+        return text + "%s *%d\n" % (rows_of[0], rows)
+    return text + "".join(rows_of[i % len(rows_of)] + "\n"
+                          for i in range(rows))
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(
+        description="Generate worst-case charts for the speed sweep")
+    parser.add_argument("-p", "--pattern", choices=sorted(PATTERNS),
+                        default="lanes", help="notes on each row")
+    parser.add_argument("-r", "--rows", type=int, default=200,
+                        help="rows in the chart")
+    parser.add_argument("-m", "--row-ms", type=int, default=25,
+                        help="milliseconds per row at 100%% tempo")
+    parser.add_argument("-n", "--name", help="name shown on the start screen")
+    parser.add_argument("output", help="chart file to write")
+    args = parser.parse_args(argv)
+    if not 1 <= args.rows <= 0xFFFF or not 1 <= args.row_ms <= 0xFFFF:
+        sys.exit("stress_chart: rows and row time must be 1 to 65535")
+    with open(args.output, "w") as f:
+        f.write(chart(args.pattern, args.rows, args.row_ms,
+                      args.name or "Stress " + args.pattern.title()))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+"""Upload a song to one of the AVR Hero song slots over the serial port.
+
+The game must be showing the start screen. A song is one byte per row of
+the track, with the notes for lanes 0 to 3 in the low four bits (bit 0 is
+the lane played with 'a' - see tools/chart_compiler.py). The song file is either raw bytes or
+text holding hex bytes (e.g. "0x08, 0x04 0x02") if its name ends in .txt.
+
+    upload_song.py /dev/ttyUSB0 2 song.txt
+
+See src/upload.h for the frame format. Needs pyserial.
+"""
+
+import argparse
+import re
+import sys
+
+import serial
+
+SOH = 0x01
+ACK = 0x06
+NAK = 0x15
+MAX_PAYLOAD = 32
+NUM_SLOTS = 3
+MAX_LENGTH = 2048 - 4
+RETRIES = 5
+
+
+def crc8(data):
+    """CRC-8, polynomial 0x07, initial value 0 (avr-libc _crc8_ccitt_update)"""
+    crc = 0
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else crc << 1
+    return crc
+
+
+def read_song(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if path.endswith(".txt"):
+        text = data.decode("ascii")
+        return bytes(int(h, 16) for h in re.findall(r"(?:0x)?[0-9a-fA-F]+", text))
+    return data
+
+
+def wait_answer(port, sequence):
+    """Wait for ACK/NAK for the given sequence number. Anything else the
+    game prints (e.g. the start screen's progress) is skipped."""
+    while True:
+        c = port.read(1)
+        if not c:
+            return None
+        if c[0] in (ACK, NAK):
+            digits = port.read(2)
+            if len(digits) == 2 and int(digits, 16) == sequence:
+                return c[0]
+
+
+def send_frame(port, command, sequence, payload=b""):
+    body = bytes([ord(command), sequence, len(payload)]) + payload
+    frame = bytes([SOH]) + body + bytes([crc8(body)])
+    for _ in range(RETRIES):
+        port.write(frame)
+        if wait_answer(port, sequence) == ACK:
+            return
+    sys.exit("no answer to frame %d ('%s')" % (sequence, command))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("port", help="serial port the game is connected to")
+    parser.add_argument("slot", type=int, help="song slot (1 to %d)" % NUM_SLOTS)
+    parser.add_argument("song", help="song file")
+    parser.add_argument("--baud", type=int, default=19200)
+    args = parser.parse_args()
+
+    if not 1 <= args.slot <= NUM_SLOTS:
+        sys.exit("slot must be 1 to %d" % NUM_SLOTS)
+    song = read_song(args.song)
+    if not song or len(song) > MAX_LENGTH:
+        sys.exit("song must be 1 to %d bytes" % MAX_LENGTH)
+
+    with serial.Serial(args.port, args.baud, timeout=1) as port:
+        sequence = 0
+        send_frame(port, "B", sequence,
+                   bytes([args.slot - 1, len(song) & 0xFF, len(song) >> 8]))
+        for offset in range(0, len(song), MAX_PAYLOAD):
+            sequence = (sequence + 1) & 0xFF
+            send_frame(port, "D", sequence, song[offset:offset + MAX_PAYLOAD])
+            sent = min(offset + MAX_PAYLOAD, len(song))
+            print("\r%d%%" % (sent * 100 // len(song)), end="", flush=True)
+        sequence = (sequence + 1) & 0xFF
+        send_frame(port, "E", sequence)
+        print("\nuploaded %d rows to slot %d" % (len(song), args.slot))
+
+
+if __name__ == "__main__":
+    main()